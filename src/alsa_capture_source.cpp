@@ -0,0 +1,293 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <ctime>
+#include "alsa_capture_source.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AlsaCaptureSource::AlsaCaptureSource(const std::string& device, int sampling_rate, int channel_count,
+                                     int period_frames) {
+      assert(channel_count > 0);
+      assert(period_frames > 0);
+
+      device_ = device;
+      sample_rate_ = sampling_rate;
+      channel_count_ = channel_count;
+      period_frames_ = period_frames;
+      overrun_count_ = 0;
+      capture_handle_ = NULL;
+      status_ = NULL;
+      monotonic_tstamp_ = false;
+      pending_xrun_first_ = 0;
+      pending_xrun_count_ = 0;
+      error_description_ = "no error";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AlsaCaptureSource::~AlsaCaptureSource() {
+      Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::Open() {
+      assert(capture_handle_ == NULL);
+
+      int err;
+
+      if ((err = snd_pcm_open(&capture_handle_, device_.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+            capture_handle_ = NULL;
+            goto fatal_error;
+      }
+      if ((err = SetHardwareParameters()) < 0) {
+            goto fatal_error;
+      }
+      if ((err = SetSoftwareParameters()) < 0) {
+            goto fatal_error;
+      }
+      if ((err = snd_pcm_status_malloc(&status_)) < 0) {
+            status_ = NULL;
+            goto fatal_error;
+      }
+
+      pending_xrun_first_ = 0;
+      pending_xrun_count_ = 0;
+      return 0;
+
+fatal_error:
+      error_description_ = snd_strerror(err);
+      Close();
+      return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::SetHardwareParameters() {
+
+      int err;
+      snd_pcm_hw_params_t* hw_params = NULL;
+
+      // Inicialización del dispositivo de captura de audio: Parámetros HW
+      // ---------------------------------------------------------------------------------------------------------------
+      if ((err = snd_pcm_hw_params_malloc(&hw_params)) < 0) {
+            return err;
+      }
+      if ((err = snd_pcm_hw_params_any(capture_handle_, hw_params)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_hw_params_set_access(capture_handle_, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_hw_params_set_format(capture_handle_, hw_params, SND_PCM_FORMAT_S32_LE)) < 0) {
+            goto end;
+      }
+      // Restrict a configuration space to contain only real hardware rates
+      if ((err = snd_pcm_hw_params_set_rate_resample(capture_handle_, hw_params, 0)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_hw_params_set_rate_min(capture_handle_, hw_params, &sample_rate_, NULL)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_hw_params_set_channels(capture_handle_, hw_params, channel_count_)) < 0) {
+            goto end;
+      }
+      err = snd_pcm_hw_params(capture_handle_, hw_params);
+
+end:
+      snd_pcm_hw_params_free(hw_params);
+      return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::SetSoftwareParameters() {
+
+      int err;
+      snd_pcm_sw_params_t* sw_params = NULL;
+
+      // Inicialización del dispositivo de captura de audio: Parámetros SW
+      // ---------------------------------------------------------------------------------------------------------------
+      if ((err = snd_pcm_sw_params_malloc(&sw_params)) < 0) {
+            return err;
+      }
+      if ((err = snd_pcm_sw_params_current(capture_handle_, sw_params)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_sw_params_set_avail_min(capture_handle_, sw_params, period_frames_)) < 0) {
+            goto end;
+      }
+      if ((err = snd_pcm_sw_params_set_start_threshold(capture_handle_, sw_params, 0U)) < 0) {
+            goto end;
+      }
+      // Marcas de tiempo del estado (htstamp) con el reloj monotónico, comparables con las de los bloques. Los
+      // núcleos antiguos no permiten elegir el reloj, entonces son de gettimeofday() y no se usan.
+      if ((err = snd_pcm_sw_params_set_tstamp_mode(capture_handle_, sw_params, SND_PCM_TSTAMP_ENABLE)) < 0) {
+            goto end;
+      }
+      monotonic_tstamp_ = (snd_pcm_sw_params_set_tstamp_type(capture_handle_, sw_params,
+                                                             SND_PCM_TSTAMP_TYPE_MONOTONIC) >= 0);
+      err = snd_pcm_sw_params(capture_handle_, sw_params);
+
+end:
+      snd_pcm_sw_params_free(sw_params);
+      return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::Reconfigure(int sample_rate, int period_frames) {
+      assert(capture_handle_ != NULL);
+      assert(period_frames > 0);
+
+      int err;
+      unsigned int previous_rate = sample_rate_;
+      int previous_period = period_frames_;
+      bool rate_changed = ((unsigned int) sample_rate != previous_rate);
+
+      // Si la frecuencia no cambia no se toca el hardware, solo el umbral de lectura (avail_min), que se puede cambiar
+      // con la captura en marcha. El hardware elige la frecuencia nativa igual o inmediatamente superior a la pedida.
+      sample_rate_ = sample_rate;
+      period_frames_ = period_frames;
+
+      if (rate_changed == true) {
+            // Los parámetros HW solo se pueden cambiar con el dispositivo parado, las muestras del búfer se pierden.
+            snd_pcm_drop(capture_handle_);
+            if ((err = SetHardwareParameters()) < 0) {
+                  goto restore;
+            }
+      }
+      if ((err = SetSoftwareParameters()) < 0) {
+            goto restore;
+      }
+      if (rate_changed == true && (err = snd_pcm_prepare(capture_handle_)) < 0) {
+            goto restore;
+      }
+      return 0;
+
+restore:
+      error_description_ = snd_strerror(err);
+      sample_rate_ = previous_rate;
+      period_frames_ = previous_period;
+      if (rate_changed == true) {
+            SetHardwareParameters();
+            SetSoftwareParameters();
+            snd_pcm_prepare(capture_handle_);
+      } else {
+            SetSoftwareParameters();
+      }
+      return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AlsaCaptureSource::Close() {
+      if (capture_handle_ != NULL) {
+            snd_pcm_close(capture_handle_);
+            capture_handle_ = NULL;
+      }
+      if (status_ != NULL) {
+            snd_pcm_status_free(status_);
+            status_ = NULL;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::Prepare() {
+      assert(capture_handle_ != NULL);
+
+      int err;
+      if ((err = snd_pcm_prepare(capture_handle_)) < 0) {
+            error_description_ = snd_strerror(err);
+            return 1;
+      }
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AlsaCaptureSource::Read(int32_t* buffer, int frames) {
+      assert(capture_handle_ != NULL);
+
+      int r;
+      int32_t* b = buffer;
+      int pending = frames;
+
+      do {
+            // Bloqueante
+            r = snd_pcm_readi(capture_handle_, b, pending);
+            if (r < 0) {
+                  // OVERRUN (-EPIPE) o suspensión (-ESTRPIPE). Se recupera y se sigue llenando el bloque, las muestras
+                  // perdidas no se recuperan.
+                  if (r == -EPIPE) {
+                        overrun_count_++;
+                        RecordXrun();
+                  }
+
+                  r = snd_pcm_recover(capture_handle_, r, 1); //1 = silent
+                  if (r < 0) {
+                        error_description_ = snd_strerror(r);
+                        return -1;
+                  }
+                  continue;
+            }
+
+            b += r * channel_count_;
+            pending -= r;
+
+      } while (pending > 0);
+
+      return frames;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AlsaCaptureSource::RecordXrun() {
+
+      if (pending_xrun_count_ == kMaxPendingXruns) {
+            return;
+      }
+
+      XrunRecord* x = &pending_xruns_[(pending_xrun_first_ + pending_xrun_count_) % kMaxPendingXruns];
+      pending_xrun_count_++;
+      memset(x, 0, sizeof(XrunRecord));
+
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      x->timestamp_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+
+      // Estado del dispositivo antes de recuperarlo, que descarta lo que haya en el búfer.
+      if (snd_pcm_status(capture_handle_, status_) < 0) {
+            return;
+      }
+
+      snd_htimestamp_t now;
+      snd_htimestamp_t trigger;
+      snd_pcm_status_get_htstamp(status_, &now);
+      snd_pcm_status_get_trigger_htstamp(status_, &trigger);
+      x->delay_frames = snd_pcm_status_get_delay(status_);
+      x->frames_lost = snd_pcm_status_get_avail(status_);
+
+      if (monotonic_tstamp_ == true) {
+            x->device_timestamp_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+            x->trigger_timestamp_ns = trigger.tv_sec * 1000000000ULL + trigger.tv_nsec;
+      }
+
+      // Con el dispositivo en estado XRUN, el trigger htstamp es el instante en que se detuvo la captura: desde
+      // entonces se pierde lo que llega.
+      if (snd_pcm_status_get_state(status_) == SND_PCM_STATE_XRUN) {
+            double stopped = (now.tv_sec - trigger.tv_sec) + (now.tv_nsec - trigger.tv_nsec) * 1e-9;
+            if (stopped > 0) {
+                  x->frames_lost += (int64_t) (stopped * sample_rate_);
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool AlsaCaptureSource::PopXrun(XrunRecord* record) {
+
+      if (pending_xrun_count_ == 0) {
+            return false;
+      }
+
+      *record = pending_xruns_[pending_xrun_first_];
+      pending_xrun_first_ = (pending_xrun_first_ + 1) % kMaxPendingXruns;
+      pending_xrun_count_--;
+      return true;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,293 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include "analyzer_config.h"
+#include <cmath>
+#include <cassert>
+
+using namespace thd_analyzer;
+
+// Unos -0.09 dBFS.
+const double AnalyzerConfig::kDefaultClipLevel = 0.99;
+
+namespace {
+
+      // Reserva en todos los informes la lista de intervalos más larga posible, uno por cada dos frecuencias
+      // positivas, para que el hilo de procesado nunca tenga que ampliarla. Hay que llamarla después de cada
+      // push_back() o erase() en |reports|: al copiar un std::vector (también cuando |reports| crece) la copia no
+      // conserva la capacidad reservada.
+      void ReserveViolations(std::vector<MaskReport>* reports, int fft_size) {
+            size_t i;
+            for (i = 0; i < reports->size(); i++) {
+                  (*reports)[i].violations.reserve(fft_size / 4 + 1);
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig::AnalyzerConfig(int channel_count, int sampling_rate, int fft_size) {
+
+      channel_count_ = channel_count;
+      sample_rate_ = sampling_rate;
+      fft_size_ = fft_size;
+      channel_.resize(channel_count_);
+      retired_next_ = NULL;
+
+      SetWindow(kWindowRectangular);
+      SetClipLevel(kDefaultClipLevel);
+
+      int c;
+      for (c = 0; c < channel_count_; c++) {
+            SetAveraging(c, kAveragingNone);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig::AnalyzerConfig(const AnalyzerConfig& other) {
+
+      channel_count_ = other.channel_count_;
+      sample_rate_ = other.sample_rate_;
+      fft_size_ = other.fft_size_;
+      channel_.resize(channel_count_);
+      retired_next_ = NULL;
+
+      window_ = other.window_;
+      window_coefficients_ = other.window_coefficients_;
+      window_terms_ = other.window_terms_;
+      clip_level_ = other.clip_level_;
+      clip_threshold_ = other.clip_threshold_;
+
+      int c;
+      size_t i;
+      for (c = 0; c < channel_count_; c++) {
+            channel_[c].averaging = other.channel_[c].averaging;
+            channel_[c].averaging_parameter = other.channel_[c].averaging_parameter;
+            channel_[c].alpha = other.channel_[c].alpha;
+            channel_[c].group_size = other.channel_[c].group_size;
+
+            for (i = 0; i < other.channel_[c].masks.size(); i++) {
+                  SpectrumMask* m = new SpectrumMask(*other.channel_[c].masks[i]);
+                  MaskReport r;
+                  r.block = 0;
+                  r.error_count = 0;
+
+                  channel_[c].masks.push_back(m);
+                  channel_[c].report.push_back(r);
+                  channel_[c].report_next.push_back(r);
+            }
+            ReserveViolations(&channel_[c].report, fft_size_);
+            ReserveViolations(&channel_[c].report_next, fft_size_);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig::AnalyzerConfig(const AnalyzerConfig& other, int sampling_rate, int fft_size) {
+
+      channel_count_ = other.channel_count_;
+      sample_rate_ = sampling_rate;
+      fft_size_ = fft_size;
+      channel_.resize(channel_count_);
+      retired_next_ = NULL;
+
+      SetWindow(other.window_);
+      SetClipLevel(other.clip_level_);
+
+      int c;
+      size_t i;
+      for (c = 0; c < channel_count_; c++) {
+            SetAveraging(c, other.channel_[c].averaging, other.channel_[c].averaging_parameter);
+
+            for (i = 0; i < other.channel_[c].masks.size(); i++) {
+                  SpectrumMask* m = new SpectrumMask(*other.channel_[c].masks[i], sample_rate_, fft_size_);
+                  MaskReport r;
+                  r.block = 0;
+                  r.error_count = 0;
+
+                  channel_[c].masks.push_back(m);
+                  channel_[c].report.push_back(r);
+                  channel_[c].report_next.push_back(r);
+            }
+            ReserveViolations(&channel_[c].report, fft_size_);
+            ReserveViolations(&channel_[c].report_next, fft_size_);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig::~AnalyzerConfig() {
+      int c;
+      size_t i;
+      for (c = 0; c < channel_count_; c++) {
+            for (i = 0; i < channel_[c].masks.size(); i++) {
+                  delete channel_[c].masks[i];
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask* AnalyzerConfig::AddMask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      if (FindMask(channel, name) >= 0) {
+            return NULL;
+      }
+
+      SpectrumMask* m = new SpectrumMask(sample_rate_, fft_size_, name);
+      MaskReport r;
+      r.block = 0;
+      r.error_count = 0;
+
+      channel_[channel].masks.push_back(m);
+      channel_[channel].report.push_back(r);
+      channel_[channel].report_next.push_back(r);
+      ReserveViolations(&channel_[channel].report, fft_size_);
+      ReserveViolations(&channel_[channel].report_next, fft_size_);
+
+      return m;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AnalyzerConfig::RemoveMask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      int i = FindMask(channel, name);
+      if (i < 0) {
+            return 1;
+      }
+
+      delete channel_[channel].masks[i];
+      channel_[channel].masks.erase(channel_[channel].masks.begin() + i);
+      channel_[channel].report.erase(channel_[channel].report.begin() + i);
+      channel_[channel].report_next.erase(channel_[channel].report_next.begin() + i);
+      ReserveViolations(&channel_[channel].report, fft_size_);
+      ReserveViolations(&channel_[channel].report_next, fft_size_);
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask* AnalyzerConfig::Mask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      int i = FindMask(channel, name);
+      if (i < 0) {
+            return NULL;
+      }
+      return channel_[channel].masks[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask* AnalyzerConfig::Mask(int channel, int index) {
+      assert(channel < channel_count_);
+      assert(index < (int) channel_[channel].masks.size());
+      return channel_[channel].masks[index];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AnalyzerConfig::MaskCount(int channel) const {
+      assert(channel < channel_count_);
+      return (int) channel_[channel].masks.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AnalyzerConfig::SetWindow(Window window) {
+
+      window_ = window;
+      window_coefficients_.resize(fft_size_);
+
+      // Todas son ventanas de suma de cosenos: w[n] = a0 + a1 cos(x) + a2 cos(2x) + ...
+      switch (window_) {
+      case kWindowHann:
+            window_terms_.assign(2, 0.0);
+            window_terms_[0] = 0.5;
+            window_terms_[1] = -0.5;
+            break;
+      case kWindowBlackmanHarris:
+            window_terms_.assign(4, 0.0);
+            window_terms_[0] = 0.35875;
+            window_terms_[1] = -0.48829;
+            window_terms_[2] = 0.14128;
+            window_terms_[3] = -0.01168;
+            break;
+      case kWindowFlatTop:
+            window_terms_.assign(5, 0.0);
+            window_terms_[0] = 0.21557895;
+            window_terms_[1] = -0.41663158;
+            window_terms_[2] = 0.277263158;
+            window_terms_[3] = -0.083578947;
+            window_terms_[4] = 0.006947368;
+            break;
+      case kWindowRectangular:
+      default:
+            window_terms_.assign(1, 1.0);
+            break;
+      }
+
+      // Normalización por la ganancia coherente (valor medio de la ventana), que en una ventana periódica es a0.
+      size_t m;
+      double gain = window_terms_[0];
+      for (m = 0; m < window_terms_.size(); m++) {
+            window_terms_[m] /= gain;
+      }
+
+      // Ventanas periódicas (no simétricas), que son las adecuadas para análisis espectral con la FFT.
+      double N = (double) fft_size_;
+      int n;
+      for (n = 0; n < fft_size_; n++) {
+            double x = 2.0 * M_PI * n / N;
+            double w = 0.0;
+            for (m = 0; m < window_terms_.size(); m++) {
+                  w += window_terms_[m] * cos(m * x);
+            }
+            window_coefficients_[n] = w;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AnalyzerConfig::SetClipLevel(double level) {
+      assert(level > 0.0 && level <= 1.0);
+
+      clip_level_ = level;
+      // Umbral en la escala de las muestras S32, fondo de escala 2^31. El máximo representable es 2^31 - 1.
+      double t = std::ceil(level * 2147483648.0);
+      clip_threshold_ = (t > 2147483647.0) ? 2147483647 : (int32_t) t;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void AnalyzerConfig::SetAveraging(int channel, Averaging mode, double parameter) {
+      assert(channel < channel_count_);
+
+      ChannelConfig* cc = &channel_[channel];
+      cc->averaging = mode;
+      cc->averaging_parameter = parameter;
+      cc->alpha = 1.0;
+      cc->group_size = 1;
+
+      if (mode == kAveragingExponential && parameter > 0.0) {
+            double block_duration = (double) fft_size_ / (double) sample_rate_;
+            cc->alpha = 1.0 - exp(-block_duration / parameter);
+      }
+      if (mode == kAveragingLinear && parameter >= 1.0) {
+            cc->group_size = (int) parameter;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig::Averaging AnalyzerConfig::GetAveraging(int channel) const {
+      assert(channel < channel_count_);
+      return channel_[channel].averaging;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double AnalyzerConfig::AveragingParameter(int channel) const {
+      assert(channel < channel_count_);
+      return channel_[channel].averaging_parameter;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int AnalyzerConfig::FindMask(int channel, const std::string& name) const {
+      size_t i;
+      for (i = 0; i < channel_[channel].masks.size(); i++) {
+            if (channel_[channel].masks[i]->Name() == name) {
+                  return (int) i;
+            }
+      }
+      return -1;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
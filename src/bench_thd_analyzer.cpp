@@ -0,0 +1,672 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+/**
+ * Medidas de rendimiento del analizador.
+ *
+ * Microbenchmarks de cada etapa del procesado de un bloque (FFT, conversión de formato, decimación, densidad espectral
+ * de potencia, sumas acumuladas, instantáneas compactas, máscaras, búsqueda del máximo y bandas de octava), del
+ * oscilador del generador de funciones y una medida de extremo a extremo, en bloques por segundo, del analizador
+ * completo leyendo de una fuente sintética a toda velocidad.
+ *
+ * Los resultados se escriben en JSON o CSV para poder compararlos entre versiones en la misma máquina. Los tiempos
+ * son en nanosegundos por operación: la media y el mínimo de varias tandas.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "thd_analyzer.h"
+#include "synthetic_capture_source.h"
+#include "dsp_kernels.h"
+#include "decimator.h"
+#include "octave_bands.h"
+#include "oscillator.h"
+#include "fft.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// tabla de opciones para getopt_long
+struct option long_options[] = {
+      { "format",   required_argument, 0, 'f' },
+      { "output",   required_argument, 0, 'o' },
+      { "min-time", required_argument, 0, 't' },
+      { "filter",   required_argument, 0, 'F' },
+      { "help",     no_argument,       0, 'h' },
+      { 0,          0,                 0,  0  }
+};
+
+/**
+ * Un caso de medida. Run() ejecuta una operación, que se repite hasta acumular el tiempo mínimo de medida.
+ */
+class BenchmarkCase {
+public:
+      BenchmarkCase(const std::string& name, int size, double items) : name_(name), size_(size), items_(items) {}
+      virtual ~BenchmarkCase() {}
+      virtual void Run() = 0;
+
+      const std::string& Name() const { return name_; }
+      int Size() const { return size_; }
+
+      // Elementos procesados en cada operación (muestras, puntos del espectro...), para el rendimiento en items/s.
+      double Items() const { return items_; }
+
+private:
+      std::string name_;
+      int size_;
+      double items_;
+};
+
+struct Result {
+      std::string name;
+      int size;
+      int64_t iterations;
+      double ns_per_op;
+      double min_ns_per_op;
+      double items_per_second;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Usage();
+uint64_t NowNanoseconds();
+Result Measure(BenchmarkCase* b, double min_time_ms);
+Result MeasureEndToEnd(int log2_block_size, int channel_count, int mask_count, int blocks);
+void WriteJson(FILE* out, const std::vector<Result>& results);
+void WriteCsv(FILE* out, const std::vector<Result>& results);
+
+// El resultado de cada operación se acumula aquí para que el compilador no la elimine.
+volatile double sink;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class FftCase : public BenchmarkCase {
+public:
+      FftCase(int log2n) : BenchmarkCase("fft", 1 << log2n, 1 << log2n), log2n_(log2n), x_(2 << log2n),
+                           re_(1 << log2n), im_(1 << log2n) {
+            for (size_t i = 0; i < re_.size(); i++) {
+                  x_[2 * i + 0] = cos(0.1 * i);
+                  x_[2 * i + 1] = sin(0.3 * i);
+            }
+      }
+      virtual void Run() {
+            // La FFT es in-place y divide entre N, transformada una y otra vez la señal acabaría en números
+            // subnormales, que son mucho más lentos. Se parte siempre de la misma señal, como en el analizador.
+            size_t n = re_.size();
+            for (size_t i = 0; i < n; i++) {
+                  re_[i] = x_[2 * i + 0];
+                  im_[i] = x_[2 * i + 1];
+            }
+            FFT(1, log2n_, &re_[0], &im_[0]);
+            sink = re_[1];
+      }
+private:
+      int log2n_;
+      std::vector<double> x_;
+      std::vector<double> re_;
+      std::vector<double> im_;
+};
+
+class ConvertCase : public BenchmarkCase {
+public:
+      // |stats|: ConvertChannelStats(), la conversión con las estadísticas de nivel que usa el analizador.
+      ConvertCase(int n, int channel_count, bool stats) : BenchmarkCase(stats ? "convert_stats" : "convert", n,
+                                                                        (double) n * channel_count),
+                                                          channel_count_(channel_count), stats_(stats),
+                                                          frames_(n * channel_count), window_(n, 1.0), out_(n) {
+            for (size_t i = 0; i < frames_.size(); i++) {
+                  frames_[i] = (int32_t) (i * 2654435761U);
+            }
+      }
+      virtual void Run() {
+            SampleStats s;
+            for (int c = 0; c < channel_count_; c++) {
+                  if (stats_ == true) {
+                        ConvertChannelStats(&frames_[0], channel_count_, c, &window_[0], Size(), 2126008810, &out_[0],
+                                            &s);
+                  } else {
+                        ConvertChannel(&frames_[0], channel_count_, c, &window_[0], Size(), &out_[0]);
+                  }
+            }
+            sink = out_[Size() / 2];
+      }
+private:
+      int channel_count_;
+      bool stats_;
+      std::vector<int32_t> frames_;
+      std::vector<double> window_;
+      std::vector<double> out_;
+};
+
+class PsdCase : public BenchmarkCase {
+public:
+      PsdCase(int n) : BenchmarkCase("psd", n, 2.0 * (n / 2 + 1)), re_(n), im_(n), psd0_(n / 2 + 1),
+                       psd1_(n / 2 + 1) {
+            for (int i = 0; i < n; i++) {
+                  re_[i] = cos(0.1 * i);
+                  im_[i] = sin(0.3 * i);
+            }
+      }
+      virtual void Run() {
+            TwoRealPowerSpectra(&re_[0], &im_[0], Size(), 2.0 / (1 + sqrt(2)), &psd0_[0], &psd1_[0]);
+            sink = psd0_[1] + psd1_[1];
+      }
+private:
+      std::vector<double> re_;
+      std::vector<double> im_;
+      std::vector<double> psd0_;
+      std::vector<double> psd1_;
+};
+
+class MaskCase : public BenchmarkCase {
+public:
+      MaskCase(int n, int mask_count) : BenchmarkCase(MaskName(mask_count), n, (double) (n / 2) * mask_count),
+                                        psd_(n / 2), report_(mask_count) {
+            for (int i = 0; i < mask_count; i++) {
+                  SpectrumMask* m = new SpectrumMask(48000, n);
+                  m->Reset(-20.0 - 10.0 * i);
+                  m->SetBandAttenuation(900.0, 1100.0, 0.0);
+                  masks_.push_back(m);
+            }
+            // Ruido con un tono, unos pocos puntos traspasan la máscara
+            for (int k = 0; k < n / 2; k++) {
+                  psd_[k] = 1e-6 * (1 + (k % 7));
+            }
+            psd_[n / 8] = 0.5;
+      }
+      virtual ~MaskCase() {
+            for (size_t i = 0; i < masks_.size(); i++) {
+                  delete masks_[i];
+            }
+      }
+      virtual void Run() {
+            // Igual que ThdAnalyzer::EvaluateMasks(): todas las máscaras sobre cada trozo de 512 puntos
+            const int kChunk = 512;
+            size_t m;
+            int bins = Size() / 2;
+            for (m = 0; m < masks_.size(); m++) {
+                  report_[m].error_count = 0;
+                  report_[m].violations.clear();
+            }
+            for (int k1 = 0; k1 < bins; k1 += kChunk) {
+                  int k2 = (k1 + kChunk < bins) ? k1 + kChunk : bins;
+                  for (m = 0; m < masks_.size(); m++) {
+                        masks_[m]->Evaluate(&psd_[0], k1, k2, &report_[m]);
+                  }
+            }
+            sink = report_[0].error_count;
+      }
+private:
+      static std::string MaskName(int mask_count) {
+            char b[32];
+            snprintf(b, sizeof(b), "mask_x%d", mask_count);
+            return b;
+      }
+      std::vector<double> psd_;
+      std::vector<SpectrumMask*> masks_;
+      std::vector<MaskReport> report_;
+};
+
+class PeakCase : public BenchmarkCase {
+public:
+      PeakCase(int n) : BenchmarkCase("peak", n, n / 2), psd_(n / 2) {
+            for (int k = 0; k < n / 2; k++) {
+                  psd_[k] = 1e-6 * (1 + (k % 13));
+            }
+            psd_[n / 3] = 0.25;
+      }
+      virtual void Run() {
+            double v;
+            sink = FindMaximum(&psd_[0], Size() / 2, 1e-16, &v);
+      }
+private:
+      std::vector<double> psd_;
+};
+
+// Sumas acumuladas de las frecuencias positivas, para SNRI() y SpectrumBandPower().
+class PrefixSumCase : public BenchmarkCase {
+public:
+      PrefixSumCase(int n) : BenchmarkCase("prefix_sum", n, n / 2), psd_(n / 2), sum_(n / 2 + 1) {
+            for (int k = 0; k < n / 2; k++) {
+                  psd_[k] = 1e-6 * (1 + (k % 13));
+            }
+      }
+      virtual void Run() {
+            PrefixSum(&psd_[0], Size() / 2, &sum_[0]);
+            sink = sum_[Size() / 2];
+      }
+private:
+      std::vector<double> psd_;
+      std::vector<double> sum_;
+};
+
+// Instantánea compacta del espectro publicado (ThdAnalyzer::SetSnapshotEncoding()): float o dB con 16 bits.
+class SnapshotCase : public BenchmarkCase {
+public:
+      SnapshotCase(int n, bool decibels) : BenchmarkCase(decibels ? "snapshot_db16" : "snapshot_f32", n, n / 2 + 1),
+                                           decibels_(decibels), psd_(n / 2 + 1), f_(n / 2 + 1), codes_(n / 2 + 1) {
+            for (int k = 0; k <= n / 2; k++) {
+                  psd_[k] = 1e-6 * (1 + (k % 13));
+            }
+      }
+      virtual void Run() {
+            if (decibels_ == true) {
+                  QuantizeDecibels(&psd_[0], Size() / 2 + 1, -200.0, 200.0 / 65535, 65535, &codes_[0]);
+                  sink = codes_[Size() / 4];
+            } else {
+                  ConvertToFloat(&psd_[0], Size() / 2 + 1, &f_[0]);
+                  sink = f_[Size() / 4];
+            }
+      }
+private:
+      bool decibels_;
+      std::vector<double> psd_;
+      std::vector<float> f_;
+      std::vector<uint16_t> codes_;
+};
+
+// Interpolación del máximo con la ventana Blackman-Harris, un tono a 0.3 bins del centro.
+class InterpolateCase : public BenchmarkCase {
+public:
+      InterpolateCase(int n) : BenchmarkCase("interpolate", n, 1), psd_(n) {
+            terms_.push_back(1.0);
+            terms_.push_back(-0.48829 / 0.35875);
+            terms_.push_back(0.14128 / 0.35875);
+            terms_.push_back(-0.01168 / 0.35875);
+            for (int i = -1; i <= 1; i++) {
+                  double a = CosineWindowResponse(&terms_[0], 4, n, i - 0.3);
+                  psd_[n / 3 + i] = a * a;
+            }
+      }
+      virtual void Run() {
+            sink = InterpolatePeak(&psd_[0], Size() / 3, Size(), &terms_[0], (int) terms_.size(), NULL);
+      }
+private:
+      std::vector<double> psd_;
+      std::vector<double> terms_;
+};
+
+// Decimación de un canal, |n| muestras de salida (el tamaño de la FFT) y n * factor de entrada.
+class DecimateCase : public BenchmarkCase {
+public:
+      DecimateCase(int n, int factor) : BenchmarkCase(DecimateName(factor), n, (double) n * factor),
+                                        decimator_(factor, n), out_(n) {
+            double* in = decimator_.Input();
+            for (int i = 0; i < decimator_.InputSize(); i++) {
+                  in[i] = sin(0.001 * i);
+            }
+      }
+      virtual void Run() {
+            decimator_.Process(&out_[0]);
+            sink = out_[Size() / 2];
+      }
+private:
+      static std::string DecimateName(int factor) {
+            char b[32];
+            snprintf(b, sizeof(b), "decimate_x%d", factor);
+            return b;
+      }
+      Decimator decimator_;
+      std::vector<double> out_;
+};
+
+// Bandas de tercio de octava de 20 Hz a 20 kHz de un canal a 48 kHz, sumando bins del espectro o con el banco de
+// filtros. Los elementos son los puntos del espectro o las muestras del bloque.
+class BandsCase : public BenchmarkCase {
+public:
+      BandsCase(int n, OctaveBands::Method method) :
+            BenchmarkCase((method == OctaveBands::kMethodSpectrum) ? "bands_spectrum" : "bands_filterbank", n,
+                          (method == OctaveBands::kMethodSpectrum) ? n / 2 : n),
+            bands_(3, 20.0, 20000.0, method, 1, 48000, n), x_(n), power_(bands_.BandCount()) {
+            for (int i = 0; i < n; i++) {
+                  x_[i] = (method == OctaveBands::kMethodSpectrum) ? 1e-6 : 0.5 * sin(0.1 * i);
+            }
+      }
+      virtual void Run() {
+            if (bands_.GetMethod() == OctaveBands::kMethodSpectrum) {
+                  bands_.SumBins(&x_[0], 1.0, &power_[0]);
+            } else {
+                  bands_.Filter(0, &x_[0], &power_[0]);
+            }
+            sink = power_[0];
+      }
+private:
+      OctaveBands bands_;
+      std::vector<double> x_;
+      std::vector<double> power_;
+};
+
+// Oscilador del generador de funciones, |n| muestras de cada forma de onda. Con libm, cos() de cada muestra como hacía
+// antes el generador.
+class OscillatorCase : public BenchmarkCase {
+public:
+      enum Shape { kCosine, kCosineLibm, kSawTooth, kSquare };
+
+      OscillatorCase(int n, Shape shape) : BenchmarkCase(ShapeName(shape), n, n), shape_(shape), out_(n), n_(0) {
+            oscillator_.SetFrequency(997.0 / 48000.0);
+      }
+      virtual void Run() {
+            switch (shape_) {
+            case kCosine:
+                  oscillator_.Generate(1.0, Size(), &out_[0]);
+                  break;
+            case kCosineLibm: {
+                  double w = 2 * M_PI * 997.0 / 48000.0;
+                  for (int i = 0; i < Size(); i++) {
+                        out_[i] = cos(w * n_);
+                        n_++;
+                  }
+                  break;
+            }
+            case kSawTooth:
+                  oscillator_.GenerateSawTooth(1.0, Size(), &out_[0]);
+                  break;
+            case kSquare:
+                  oscillator_.GenerateSquare(1.0, Size(), &out_[0]);
+                  break;
+            }
+            sink = out_[Size() / 2];
+      }
+private:
+      static std::string ShapeName(Shape shape) {
+            switch (shape) {
+            case kCosineLibm:
+                  return "oscillator_libm";
+            case kSawTooth:
+                  return "oscillator_saw";
+            case kSquare:
+                  return "oscillator_square";
+            default:
+                  return "oscillator";
+            }
+      }
+
+      Shape shape_;
+      Oscillator oscillator_;
+      std::vector<double> out_;
+      int n_;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv) {
+
+      std::string format = "json";
+      std::string output;
+      std::string filter;
+      double min_time_ms = 200.0;
+
+      while (1) {
+
+            int c;
+            int option_index = 0;
+
+            c = getopt_long(argc, argv, "f:o:t:F:h", long_options, &option_index);
+            if (c == -1) {
+                  break;
+            }
+
+            switch (c) {
+            case 'h':
+                  Usage();
+                  exit(0);
+                  break;
+            case 'f':
+                  format = optarg;
+                  break;
+            case 'o':
+                  output = optarg;
+                  break;
+            case 't':
+                  min_time_ms = atof(optarg);
+                  break;
+            case 'F':
+                  filter = optarg;
+                  break;
+            case '?':
+                  // getopt_long already printed an error message
+                  exit(1);
+                  break;
+            }
+      }
+
+      if (format != "json" && format != "csv") {
+            fprintf(stderr, "Error: unknown format %s\n", format.c_str());
+            return 1;
+      }
+
+      // La librería escribe mensajes en la salida estándar. Los resultados van a una copia del descriptor original y
+      // la salida estándar se descarta mientras se mide, así el JSON o CSV queda limpio.
+      FILE* out;
+      if (output.empty() == false) {
+            out = fopen(output.c_str(), "w");
+            if (out == NULL) {
+                  perror(output.c_str());
+                  return 1;
+            }
+      } else {
+            fflush(stdout);
+            out = fdopen(dup(STDOUT_FILENO), "w");
+      }
+      int devnull = open("/dev/null", O_WRONLY);
+      if (devnull >= 0) {
+            fflush(stdout);
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+      }
+
+      std::vector<BenchmarkCase*> cases;
+      int log2n;
+      for (log2n = 8; log2n <= 16; log2n += 2) {
+            cases.push_back(new FftCase(log2n));
+      }
+      for (log2n = 10; log2n <= 16; log2n += 2) {
+            int n = 1 << log2n;
+            cases.push_back(new ConvertCase(n, 2, false));
+            cases.push_back(new ConvertCase(n, 2, true));
+            cases.push_back(new PsdCase(n));
+            cases.push_back(new MaskCase(n, 1));
+            cases.push_back(new MaskCase(n, 4));
+            cases.push_back(new PeakCase(n));
+            cases.push_back(new PrefixSumCase(n));
+            cases.push_back(new SnapshotCase(n, false));
+            cases.push_back(new SnapshotCase(n, true));
+            cases.push_back(new InterpolateCase(n));
+            cases.push_back(new DecimateCase(n, 4));
+            cases.push_back(new DecimateCase(n, 16));
+            cases.push_back(new BandsCase(n, OctaveBands::kMethodSpectrum));
+            cases.push_back(new BandsCase(n, OctaveBands::kMethodFilterBank));
+            cases.push_back(new OscillatorCase(n, OscillatorCase::kCosine));
+            cases.push_back(new OscillatorCase(n, OscillatorCase::kCosineLibm));
+            cases.push_back(new OscillatorCase(n, OscillatorCase::kSawTooth));
+            cases.push_back(new OscillatorCase(n, OscillatorCase::kSquare));
+      }
+
+      std::vector<Result> results;
+      size_t i;
+      for (i = 0; i < cases.size(); i++) {
+            if (filter.empty() == false && cases[i]->Name().find(filter) == std::string::npos) {
+                  continue;
+            }
+            results.push_back(Measure(cases[i], min_time_ms));
+            fprintf(stderr, "%-10s %6d %12.1f ns/op\n", results.back().name.c_str(), results.back().size,
+                    results.back().ns_per_op);
+            delete cases[i];
+      }
+
+      // Extremo a extremo: el analizador completo sobre una señal sintética estéreo, tan rápido como pueda.
+      if (filter.empty() == true || std::string("end_to_end").find(filter) != std::string::npos) {
+            for (log2n = 10; log2n <= 14; log2n += 2) {
+                  // Unos 2 segundos de señal a 48 kHz como mínimo, y al menos 200 bloques
+                  int blocks = (96000 >> log2n) > 200 ? (96000 >> log2n) : 200;
+                  results.push_back(MeasureEndToEnd(log2n, 2, 2, blocks));
+                  fprintf(stderr, "%-10s %6d %12.1f ns/block\n", results.back().name.c_str(), results.back().size,
+                          results.back().ns_per_op);
+            }
+      }
+
+      if (format == "json") {
+            WriteJson(out, results);
+      } else {
+            WriteCsv(out, results);
+      }
+      fclose(out);
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t NowNanoseconds() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Result Measure(BenchmarkCase* b, double min_time_ms) {
+
+      // Calentamiento y calibración: tandas de tamaño creciente hasta que una dure al menos 10 ms
+      int64_t batch = 1;
+      uint64_t t;
+      int64_t i;
+
+      b->Run();
+      while (1) {
+            t = NowNanoseconds();
+            for (i = 0; i < batch; i++) {
+                  b->Run();
+            }
+            t = NowNanoseconds() - t;
+            if (t >= 10000000ULL || batch >= (1LL << 40)) {
+                  break;
+            }
+            batch *= 2;
+      }
+
+      // Medida: tandas hasta acumular min_time_ms, el mínimo por tanda filtra las interrupciones del sistema
+      uint64_t total = 0;
+      int64_t iterations = 0;
+      double min_ns = 1e300;
+
+      do {
+            t = NowNanoseconds();
+            for (i = 0; i < batch; i++) {
+                  b->Run();
+            }
+            t = NowNanoseconds() - t;
+
+            total += t;
+            iterations += batch;
+            double ns = (double) t / batch;
+            if (ns < min_ns) {
+                  min_ns = ns;
+            }
+      } while (total < min_time_ms * 1e6);
+
+      Result r;
+      r.name = b->Name();
+      r.size = b->Size();
+      r.iterations = iterations;
+      r.ns_per_op = (double) total / iterations;
+      r.min_ns_per_op = min_ns;
+      r.items_per_second = b->Items() * 1e9 / r.ns_per_op;
+      return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Result MeasureEndToEnd(int log2_block_size, int channel_count, int mask_count, int blocks) {
+
+      int n = 1 << log2_block_size;
+
+      SyntheticCaptureSource source(48000, channel_count);
+      std::vector<double> harmonics;
+      harmonics.push_back(-60.0);
+      harmonics.push_back(-70.0);
+      source.AddHarmonics(SyntheticCaptureSource::kAllChannels, 1000.0, 0.5, harmonics);
+      source.SetNoise(SyntheticCaptureSource::kAllChannels, 1e-5);
+      source.SetFrameLimit((int64_t) blocks * n);
+      source.Open();
+
+      ThdAnalyzer analyzer(&source, log2_block_size);
+      if (analyzer.Init() != 0) {
+            fprintf(stderr, "Error: %s\n", analyzer.ErrorDescription().c_str());
+            exit(1);
+      }
+
+      AnalyzerConfig* config = analyzer.Configuration();
+      for (int c = 0; c < channel_count; c++) {
+            for (int m = 1; m < mask_count; m++) {
+                  char name[16];
+                  snprintf(name, sizeof(name), "mask%d", m);
+                  config->AddMask(c, name)->Reset(-40.0);
+            }
+      }
+      analyzer.SetConfiguration(config);
+
+      uint64_t t = NowNanoseconds();
+      analyzer.Start();
+      while (analyzer.State() == ThdAnalyzer::kRunning) {
+            usleep(1000);
+      }
+      t = NowNanoseconds() - t;
+
+      Result r;
+      r.name = "end_to_end";
+      r.size = n;
+      r.iterations = analyzer.BlockCount();
+      r.ns_per_op = (double) t / r.iterations;
+      r.min_ns_per_op = r.ns_per_op;
+      r.items_per_second = 1e9 / r.ns_per_op;   // bloques por segundo
+      return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WriteJson(FILE* out, const std::vector<Result>& results) {
+      char host[256];
+      if (gethostname(host, sizeof(host)) != 0) {
+            strcpy(host, "unknown");
+      }
+      host[sizeof(host) - 1] = '\0';
+
+      fprintf(out, "{\n");
+      fprintf(out, "  \"context\": {\n");
+      fprintf(out, "    \"date\": %ld,\n", (long) time(NULL));
+      fprintf(out, "    \"host\": \"%s\",\n", host);
+      fprintf(out, "    \"cpus\": %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+      fprintf(out, "  },\n");
+      fprintf(out, "  \"benchmarks\": [\n");
+      size_t i;
+      for (i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            fprintf(out, "    { \"name\": \"%s\", \"size\": %d, \"iterations\": %lld, \"ns_per_op\": %.2f, "
+                    "\"min_ns_per_op\": %.2f, \"items_per_second\": %.6g }%s\n", r.name.c_str(), r.size,
+                    (long long) r.iterations, r.ns_per_op, r.min_ns_per_op, r.items_per_second,
+                    (i + 1 < results.size()) ? "," : "");
+      }
+      fprintf(out, "  ]\n");
+      fprintf(out, "}\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WriteCsv(FILE* out, const std::vector<Result>& results) {
+      fprintf(out, "name,size,iterations,ns_per_op,min_ns_per_op,items_per_second\n");
+      size_t i;
+      for (i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            fprintf(out, "%s,%d,%lld,%.2f,%.2f,%.6g\n", r.name.c_str(), r.size, (long long) r.iterations, r.ns_per_op,
+                    r.min_ns_per_op, r.items_per_second);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Usage() {
+      printf("Usage: ./bench_thd_analyzer [--format json|csv] [--output <file>] [--min-time <ms>] [--filter <name>]\n");
+      printf("Defaults to JSON on the standard output, 200 ms per benchmark\n");
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,93 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "buffer_arena.h"
+
+using namespace thd_analyzer;
+
+// Tamaño de las páginas grandes de x86-64 y ARM64 con páginas de 4 KB.
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+BufferArena::BufferArena(size_t size, bool huge_pages) {
+
+      // mmap() no admite tamaño 0 y devuelve direcciones alineadas a página, múltiplo de kAlignment.
+      size_ = AlignedSize(size > 0 ? size : 1);
+      used_ = 0;
+      base_ = NULL;
+      pages_ = kPagesNormal;
+
+      void* p = MAP_FAILED;
+      if (huge_pages == true) {
+            mapped_size_ = (size_ + kHugePageSize - 1) & ~(kHugePageSize - 1);
+#ifdef MAP_HUGETLB
+            p = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                  pages_ = kPagesHuge;
+            }
+#endif
+      } else {
+            size_t page = (size_t) sysconf(_SC_PAGESIZE);
+            mapped_size_ = (size_ + page - 1) & ~(page - 1);
+      }
+
+      if (p == MAP_FAILED) {
+            p = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                  throw std::bad_alloc();
+            }
+#ifdef MADV_HUGEPAGE
+            if (huge_pages == true && madvise(p, mapped_size_, MADV_HUGEPAGE) == 0) {
+                  pages_ = kPagesTransparentHuge;
+            }
+#endif
+      }
+
+      base_ = (char*) p;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+BufferArena::~BufferArena() {
+      munmap(base_, mapped_size_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* BufferArena::Allocate(size_t bytes) {
+      size_t n = AlignedSize(bytes);
+      assert(used_ + n <= size_);
+
+      void* p = base_ + used_;
+      used_ += n;
+      return p;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void BufferArena::Prefault() {
+      size_t page = (size_t) sysconf(_SC_PAGESIZE);
+      volatile char* p = base_;
+      size_t i;
+
+      for (i = 0; i < mapped_size_; i += page) {
+            p[i] = p[i];
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double* thd_analyzer::AllocateAlignedDoubles(int count) {
+      void* p = NULL;
+      size_t bytes = BufferArena::AlignedSize(count * sizeof(double));
+
+      if (posix_memalign(&p, BufferArena::kAlignment, bytes > 0 ? bytes : BufferArena::kAlignment) != 0) {
+            throw std::bad_alloc();
+      }
+      return (double*) p;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::FreeAligned(void* p) {
+      free(p);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
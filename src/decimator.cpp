@@ -0,0 +1,195 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include "decimator.h"
+
+using namespace thd_analyzer;
+
+const double Decimator::kPassband = 0.4;
+const double Decimator::kStopbandDb = 120.0;
+
+namespace {
+
+      // Función de Bessel modificada de primera especie y orden 0, para la ventana de Kaiser.
+      double BesselI0(double x) {
+            double sum = 1.0;
+            double term = 1.0;
+            int k;
+
+            for (k = 1; k < 500; k++) {
+                  term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                  sum += term;
+                  if (term < sum * 1e-17) {
+                        break;
+                  }
+            }
+            return sum;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Decimator::Decimator(int factor, int output_size) {
+      assert(factor > 1 && IsValidFactor(factor));
+      assert(output_size > 0);
+
+      factor_ = factor;
+      output_size_ = output_size;
+
+      int stage_count = 0;
+      while ((1 << stage_count) < factor) {
+            stage_count++;
+      }
+
+      for (int i = 0; i < stage_count; i++) {
+            Stage* s = new Stage;
+
+            // La etapa i recibe R = Fs_salida * 2^(stage_count - i). Al decimar por 2, lo que hay entre R/2 - f y
+            // R/2 se pliega sobre [0, f], así que basta con atenuar desde R/2 - kPassband * Fs_salida: la banda de
+            // transición, como fracción de R, va de kPassband * Fs_salida a R/2 - kPassband * Fs_salida.
+            double transition = 0.5 - 2.0 * kPassband / (1 << (stage_count - i));
+            Design(s, transition);
+
+            s->history = 2 * s->half;
+            s->size = output_size * (1 << (stage_count - i));
+            s->input = new double[s->history + s->size];
+            s->even = new double[(s->history + s->size) / 2];
+            s->odd = new double[(s->history + s->size) / 2];
+
+            stages_.push_back(s);
+      }
+
+      Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Decimator::~Decimator() {
+      size_t i;
+      for (i = 0; i < stages_.size(); i++) {
+            delete[] stages_[i]->input;
+            delete[] stages_[i]->even;
+            delete[] stages_[i]->odd;
+            delete stages_[i];
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Decimator::IsValidFactor(int factor) {
+      return factor >= 1 && factor <= kMaxFactor && (factor & (factor - 1)) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int Decimator::TapCount() const {
+      int count = 0;
+      size_t i;
+      for (i = 0; i < stages_.size(); i++) {
+            count += 2 * (int) stages_[i]->taps.size() + 1;
+      }
+      return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double Decimator::Delay() const {
+      // Cada filtro es simétrico, con un retardo de |half| muestras a su entrada. La etapa i trabaja a 1 / 2^i de la
+      // frecuencia de entrada.
+      double delay = 0.0;
+      size_t i;
+      for (i = 0; i < stages_.size(); i++) {
+            delay += stages_[i]->half * (double) (1 << i);
+      }
+      return delay;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Decimator::Process(double* output) {
+      size_t i;
+      for (i = 0; i + 1 < stages_.size(); i++) {
+            Filter(stages_[i], stages_[i + 1]->input + stages_[i + 1]->history);
+      }
+      Filter(stages_[i], output);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Decimator::Reset() {
+      size_t i;
+      for (i = 0; i < stages_.size(); i++) {
+            memset(stages_[i]->input, 0, (stages_[i]->history + stages_[i]->size) * sizeof(double));
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Decimator::Design(Stage* stage, double transition) {
+
+      // Orden y parámetro de la ventana de Kaiser, ver Oppenheim, Schafer, "Discrete-Time Signal Processing",
+      // 7.5.3. Las fórmulas son aproximadas y en la cascada se suman los plegados de varias etapas, así que se diseña
+      // con 10 dB de margen sobre kStopbandDb. |half| tiene que ser impar para que los coeficientes de los extremos
+      // no sean de los nulos.
+      double attenuation = kStopbandDb + 10.0;
+      double order = (attenuation - 7.95) / (14.36 * transition);
+      int half = (int) ceil(order / 2.0);
+      if (half % 2 == 0) {
+            half++;
+      }
+      double beta = 0.1102 * (attenuation - 8.7);
+
+      // Filtro de media banda ideal, h(n) = sin(pi n / 2) / (pi n): 0,5 en el centro, nulo en los n pares y
+      // +-1 / (pi n) en los impares, por la ventana.
+      stage->half = half;
+      stage->taps.clear();
+      double sum = 0.0;
+      int n;
+      for (n = 1; n <= half; n += 2) {
+            double r = (double) n / (double) half;
+            double w = BesselI0(beta * sqrt(1.0 - r * r)) / BesselI0(beta);
+            double h = ((n % 4 == 1) ? 1.0 : -1.0) / (M_PI * n) * w;
+            stage->taps.push_back(h);
+            sum += 2.0 * h;
+      }
+
+      // Ganancia 1 en continua: los coeficientes fuera del centro suman 0,5.
+      size_t k;
+      for (k = 0; k < stage->taps.size(); k++) {
+            stage->taps[k] *= 0.5 / sum;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Decimator::Filter(Stage* stage, double* output) {
+
+      const double* x = stage->input;
+      double* even = stage->even;
+      double* odd = stage->odd;
+      int half = stage->half;
+      int n = (stage->history + stage->size) / 2;
+      int out = stage->size / 2;
+      int m;
+      int j;
+
+      // Descomposición polifásica: y(m) = sum h(i) x(2m + half - i). El centro (i = 0) cae siempre en una muestra
+      // impar de la entrada y el resto de coeficientes no nulos (i impar) en las pares.
+      for (j = 0; j < n; j++) {
+            even[j] = x[2 * j];
+            odd[j] = x[2 * j + 1];
+      }
+
+      const double* center = odd + (half - 1) / 2;
+      for (m = 0; m < out; m++) {
+            output[m] = 0.5 * center[m];
+      }
+
+      // Pareja de coeficientes simétricos h(+-i), i = 2k + 1: x(2m + half - i) y x(2m + half + i)
+      int k;
+      int taps = (int) stage->taps.size();
+      for (k = 0; k < taps; k++) {
+            double h = stage->taps[k];
+            const double* a = even + (half - 1) / 2 - k;
+            const double* b = even + (half + 1) / 2 + k;
+            for (m = 0; m < out; m++) {
+                  output[m] += h * (a[m] + b[m]);
+            }
+      }
+
+      // Las últimas muestras de este bloque son la historia del siguiente
+      memmove(stage->input, stage->input + stage->size, stage->history * sizeof(double));
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,303 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cstddef>
+#include <cmath>
+#include <cassert>
+#include "dsp_kernels.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::ConvertChannel(const int32_t* frames, int channel_count, int channel, const double* window, int n,
+                                  double* out) {
+      const int32_t* x = frames + channel;
+      int i;
+
+      if (window == NULL) {
+            for (i = 0; i < n; i++) {
+                  out[i] = ((double) x[i * channel_count]) / 2147483648.0;
+            }
+            return;
+      }
+
+      for (i = 0; i < n; i++) {
+            // 32 bits con signo
+            out[i] = window[i] * ((double) x[i * channel_count]) / 2147483648.0;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Una muestra de ConvertChannelStats(), se expande en línea.
+// |s| >= umbral con una sola comparación sin signo: s + (umbral - 1) está fuera de [0, 2 (umbral - 1)].
+static inline double ConvertSample(int32_t s, uint32_t clip_offset, int64_t* sum, double* sum_squares,
+                                   int32_t* min, int32_t* max, int* clip_count) {
+      double v = ((double) s) / 2147483648.0;
+      *sum += s;
+      *sum_squares += v * v;
+      *min = (s < *min) ? s : *min;
+      *max = (s > *max) ? s : *max;
+      *clip_count += ((uint32_t) s + clip_offset) > 2 * clip_offset;
+      return v;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::ConvertChannelStats(const int32_t* frames, int channel_count, int channel, const double* window,
+                                       int n, int32_t clip_threshold, double* out, SampleStats* stats) {
+      assert(n > 0);
+      assert(clip_threshold > 0);
+
+      const int32_t* x = frames + channel;
+      int64_t sum = 0;
+      double sq0 = 0.0;
+      double sq1 = 0.0;
+      double sq2 = 0.0;
+      double sq3 = 0.0;
+      int32_t min = x[0];
+      int32_t max = x[0];
+      int clip_count = 0;
+      uint32_t clip_offset = (uint32_t) clip_threshold - 1;
+      int i = 0;
+
+      // La suma de las muestras es entera (exacta, 2^31 por 2^32 muestras cabe en 64 bits) y la de cuadrados se
+      // reparte en cuatro sumas parciales: con un solo acumulador en coma flotante cada muestra esperaría a la suma
+      // anterior y el bucle costaría varias veces la conversión sola. Los extremos y el recorte no tienen saltos.
+      for (; i + 4 <= n; i += 4) {
+            const int32_t* p = x + i * channel_count;
+            out[i]     = ConvertSample(p[0], clip_offset, &sum, &sq0, &min, &max, &clip_count);
+            out[i + 1] = ConvertSample(p[channel_count], clip_offset, &sum, &sq1, &min, &max, &clip_count);
+            out[i + 2] = ConvertSample(p[2 * channel_count], clip_offset, &sum, &sq2, &min, &max, &clip_count);
+            out[i + 3] = ConvertSample(p[3 * channel_count], clip_offset, &sum, &sq3, &min, &max, &clip_count);
+      }
+      for (; i < n; i++) {
+            out[i] = ConvertSample(x[i * channel_count], clip_offset, &sum, &sq0, &min, &max, &clip_count);
+      }
+
+      // La ventana en una segunda pasada sobre |out|, que ya está en la caché.
+      if (window != NULL) {
+            ApplyWindow(window, n, out);
+      }
+
+      stats->sum = ((double) sum) / 2147483648.0;
+      stats->sum_squares = (sq0 + sq1) + (sq2 + sq3);
+      stats->min = min;
+      stats->max = max;
+      stats->clip_count = clip_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::ApplyWindow(const double* window, int n, double* x) {
+      int i;
+
+      for (i = 0; i < n; i++) {
+            x[i] *= window[i];
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::TwoRealPowerSpectra(const double* re, const double* im, int n, double norm, double* psd0,
+                                       double* psd1) {
+      assert((n & (n - 1)) == 0);
+
+      int k;
+      int j;
+      double Xre;
+      double Xim;
+
+      // Las señales son reales: |X(N - k)| = |X(k)|, solo se calculan las frecuencias de 0 a N / 2.
+      if (psd1 == NULL) {
+            for (k = 0; k <= n / 2; k++) {
+                  // X(N - k), con X(N) = X(0)
+                  j = (n - k) & (n - 1);
+
+                  Xre =  ( re[k] + re[j] ) / norm;
+                  Xim =  ( im[k] - im[j] ) / norm;
+                  psd0[k] = Xre*Xre + Xim*Xim; // NO SQRT
+            }
+            return;
+      }
+
+      for (k = 0; k <= n / 2; k++) {
+            // X(N - k), con X(N) = X(0)
+            j = (n - k) & (n - 1);
+
+            // Señal 0
+            Xre =  ( re[k] + re[j] ) / norm;
+            Xim =  ( im[k] - im[j] ) / norm;
+            psd0[k] = Xre*Xre + Xim*Xim; // NO SQRT
+
+            // Señal 1
+            Xre =  ( im[k] + im[j] ) / norm;
+            Xim =  ( re[j] - re[k] ) / norm;
+            psd1[k] = Xre*Xre + Xim*Xim; // NO SQRT
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::PrefixSum(const double* x, int n, double* sum) {
+      double acc = 0.0;
+      int k;
+      sum[0] = 0.0;
+      for (k = 0; k < n; k++) {
+            acc += x[k];
+            sum[k + 1] = acc;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::QuantizeDecibels(const double* psd, int n, double min_db, double step, int max_code,
+                                    uint16_t* codes) {
+      double scale = 1.0 / step;
+      int k;
+
+      for (k = 0; k < n; k++) {
+            double q = (10.0 * log10(psd[k]) - min_db) * scale + 0.5;
+
+            // !(q >= 0) también recoge NaN
+            if (!(q >= 0.0)) {
+                  codes[k] = 0;
+            } else if (q >= max_code) {
+                  codes[k] = (uint16_t) max_code;
+            } else {
+                  codes[k] = (uint16_t) q;
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::ConvertToFloat(const double* x, int n, float* out) {
+      int k;
+
+      for (k = 0; k < n; k++) {
+            out[k] = (float) x[k];
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int thd_analyzer::FindMaximum(const double* x, int n, double threshold, double* value) {
+      int max_index = -1;
+      double max_value = threshold;
+      int k;
+
+      for (k = 0; k < n; k++) {
+            if (x[k] > max_value) {
+                  max_value = x[k];
+                  max_index = k;
+            }
+      }
+
+      *value = max_value;
+      return max_index;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double thd_analyzer::CosineWindowResponse(const double* terms, int term_count, int n, double d) {
+
+      // Cada coseno desplaza el núcleo de Dirichlet de la ventana rectangular m bins a cada lado:
+      // W(d) = sum_m terms[m] / 2 * (D(d - m) + D(d + m)), para m = 0 son dos veces D(d), con
+      // D(x) = exp(-j pi x (n-1)/n) sin(pi x) / (n sin(pi x/n))
+      double wre = 0.0;
+      double wim = 0.0;
+      double sin_d = sin(M_PI * d);
+      int m;
+      int s;
+
+      for (m = 0; m < term_count; m++) {
+            // sin(pi (d + s m)) = (-1)^m sin(pi d)
+            double num = (m % 2 == 0) ? sin_d : -sin_d;
+            double c = terms[m] / 2;
+
+            for (s = -1; s <= 1; s += 2) {
+                  double x = d + s * m;
+
+                  double den = n * sin(M_PI * x / n);
+                  double dirichlet = (fabs(den) < 1e-12) ? 1.0 : num / den;
+                  double phase = -M_PI * x * (n - 1) / n;
+
+                  wre += c * dirichlet * cos(phase);
+                  wim += c * dirichlet * sin(phase);
+            }
+      }
+
+      return sqrt(wre * wre + wim * wim);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// (|W(1 - d)| - |W(1 + d)|) / |W(d)|, la relación entre los bins vecinos y el central de un tono desplazado d bins.
+static double PeakRatio(const double* terms, int term_count, int n, double d) {
+      return (thd_analyzer::CosineWindowResponse(terms, term_count, n, 1.0 - d) -
+              thd_analyzer::CosineWindowResponse(terms, term_count, n, 1.0 + d)) /
+            thd_analyzer::CosineWindowResponse(terms, term_count, n, d);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double thd_analyzer::CosineWindowNoiseBandwidth(const double* terms, int term_count) {
+      assert(term_count > 0);
+
+      // Los cosenos de una ventana periódica son ortogonales: sum(w^2) / n = terms[0]^2 + sum terms[m]^2 / 2, y
+      // sum(w) / n = terms[0].
+      double sum = terms[0] * terms[0];
+      int m;
+      for (m = 1; m < term_count; m++) {
+            sum += terms[m] * terms[m] / 2.0;
+      }
+      return sum / (terms[0] * terms[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double thd_analyzer::InterpolatePeak(const double* psd, int k, int n, const double* terms, int term_count,
+                                     double* gain) {
+      assert(term_count > 0);
+
+      if (gain != NULL) {
+            *gain = 1.0;
+      }
+      if (k < 1 || k > n - 2 || psd[k] <= 0.0) {
+            return 0.0;
+      }
+
+      double r = (sqrt(psd[k + 1]) - sqrt(psd[k - 1])) / sqrt(psd[k]);
+
+      // La relación crece con d en todo el lóbulo principal, así que f(d) = g(d) - r tiene una sola raíz en el
+      // intervalo. Regula falsi con la modificación de Illinois: converge en unas pocas iteraciones.
+      double lo = -0.75;
+      double hi = 0.75;
+      double flo = PeakRatio(terms, term_count, n, lo) - r;
+      double fhi = PeakRatio(terms, term_count, n, hi) - r;
+      double d;
+
+      if (flo >= 0.0) {
+            d = lo;
+      } else if (fhi <= 0.0) {
+            d = hi;
+      } else {
+            int side = 0;
+            int i;
+            d = 0.0;
+            for (i = 0; i < 50; i++) {
+                  d = (lo * fhi - hi * flo) / (fhi - flo);
+                  double f = PeakRatio(terms, term_count, n, d) - r;
+
+                  if (fabs(f) < 1e-10 || hi - lo < 1e-9) {
+                        break;
+                  }
+                  if (f < 0.0) {
+                        lo = d;
+                        flo = f;
+                        if (side == -1) {
+                              fhi /= 2;
+                        }
+                        side = -1;
+                  } else {
+                        hi = d;
+                        fhi = f;
+                        if (side == 1) {
+                              flo /= 2;
+                        }
+                        side = 1;
+                  }
+            }
+      }
+
+      if (gain != NULL) {
+            *gain = CosineWindowResponse(terms, term_count, n, d);
+      }
+      return d;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
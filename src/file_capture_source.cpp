@@ -0,0 +1,274 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <climits>
+#include "file_capture_source.h"
+
+using namespace thd_analyzer;
+
+// Identificadores de formato de la cabecera WAV
+static const int kWaveFormatPcm = 0x0001;
+static const int kWaveFormatIeeeFloat = 0x0003;
+static const int kWaveFormatExtensible = 0xFFFE;
+
+static uint32_t Le16(const uint8_t* p) {
+      return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+static uint32_t Le32(const uint8_t* p) {
+      return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FileCaptureSource::FileCaptureSource(const std::string& file_name) {
+      file_name_ = file_name;
+      fd_ = NULL;
+      sample_rate_ = 0;
+      channel_count_ = 0;
+      format_ = kSampleS16;
+      bytes_per_sample_ = 2;
+      frame_count_ = -1;
+      remaining_frames_ = -1;
+      error_description_ = "no error";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FileCaptureSource::~FileCaptureSource() {
+      Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int FileCaptureSource::OpenFile() {
+      assert(fd_ == NULL);
+
+      fd_ = fopen(file_name_.c_str(), "rb");
+      if (fd_ == NULL) {
+            error_description_ = strerror(errno);
+            return 1;
+      }
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FileCaptureSource::Close() {
+      if (fd_ != NULL) {
+            fclose(fd_);
+            fd_ = NULL;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void FileCaptureSource::SetFormat(int sample_rate, int channel_count, SampleFormat format, int64_t frame_count) {
+      sample_rate_ = sample_rate;
+      channel_count_ = channel_count;
+      format_ = format;
+      frame_count_ = frame_count;
+      remaining_frames_ = frame_count;
+
+      switch (format) {
+      case kSampleS16:
+            bytes_per_sample_ = 2;
+            break;
+      case kSampleS24:
+            bytes_per_sample_ = 3;
+            break;
+      case kSampleS32:
+      case kSampleFloat32:
+            bytes_per_sample_ = 4;
+            break;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int FileCaptureSource::Read(int32_t* buffer, int frames) {
+      assert(fd_ != NULL);
+
+      if (remaining_frames_ >= 0 && frames > remaining_frames_) {
+            frames = (int) remaining_frames_;
+      }
+
+      size_t frame_bytes = (size_t) channel_count_ * bytes_per_sample_;
+      scratch_.resize((size_t) frames * frame_bytes + 1);
+
+      size_t n = fread(&scratch_[0], frame_bytes, frames, fd_);
+      if (n < (size_t) frames && ferror(fd_)) {
+            error_description_ = strerror(errno);
+            return -1;
+      }
+      if (remaining_frames_ >= 0) {
+            remaining_frames_ -= n;
+      }
+
+      // Conversión a S32 justificado a la izquierda
+      const uint8_t* p = &scratch_[0];
+      size_t count = n * channel_count_;
+      size_t i;
+
+      switch (format_) {
+      case kSampleS16:
+            for (i = 0; i < count; i++, p += 2) {
+                  buffer[i] = (int32_t) (Le16(p) << 16);
+            }
+            break;
+      case kSampleS24:
+            for (i = 0; i < count; i++, p += 3) {
+                  buffer[i] = (int32_t) (((uint32_t) p[0] << 8) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 24));
+            }
+            break;
+      case kSampleS32:
+            for (i = 0; i < count; i++, p += 4) {
+                  buffer[i] = (int32_t) Le32(p);
+            }
+            break;
+      case kSampleFloat32:
+            for (i = 0; i < count; i++, p += 4) {
+                  uint32_t u = Le32(p);
+                  float f;
+                  memcpy(&f, &u, sizeof(f));
+
+                  // Saturación en [-1.0, 1.0), como un ADC
+                  double x = (double) f * 2147483648.0;
+                  if (x >= 2147483647.0) {
+                        buffer[i] = INT_MAX;
+                  } else if (x <= -2147483648.0) {
+                        buffer[i] = INT_MIN;
+                  } else {
+                        buffer[i] = (int32_t) x;
+                  }
+            }
+            break;
+      }
+
+      return (int) n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+WavFileCaptureSource::WavFileCaptureSource(const std::string& file_name) : FileCaptureSource(file_name) {
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int WavFileCaptureSource::Open() {
+
+      if (OpenFile() != 0) {
+            return 1;
+      }
+
+      uint8_t riff[12];
+      uint8_t chunk[8];
+      uint8_t fmt[40];
+      bool have_fmt = false;
+      int tag = 0;
+      int channel_count = 0;
+      int sample_rate = 0;
+      int bits = 0;
+      SampleFormat format = kSampleS16;
+
+      if (fread(riff, sizeof(riff), 1, fd_) != 1 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+            error_description_ = "not a WAV file";
+            goto error;
+      }
+
+      // Recorre los chunks hasta "data", que es donde empiezan las muestras
+      while (1) {
+            if (fread(chunk, sizeof(chunk), 1, fd_) != 1) {
+                  error_description_ = "WAV file without data chunk";
+                  goto error;
+            }
+            uint32_t size = Le32(chunk + 4);
+
+            if (memcmp(chunk, "fmt ", 4) == 0) {
+                  if (size < 16 || size > sizeof(fmt)) {
+                        error_description_ = "invalid WAV fmt chunk";
+                        goto error;
+                  }
+                  if (fread(fmt, size, 1, fd_) != 1) {
+                        error_description_ = "truncated WAV file";
+                        goto error;
+                  }
+                  tag = Le16(fmt);
+                  channel_count = Le16(fmt + 2);
+                  sample_rate = Le32(fmt + 4);
+                  bits = Le16(fmt + 14);
+                  if (tag == kWaveFormatExtensible && size >= 26) {
+                        // Los dos primeros bytes del GUID del subformato son el identificador de formato
+                        tag = Le16(fmt + 24);
+                  }
+                  have_fmt = true;
+
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                  break;
+
+            } else {
+                  // Chunk desconocido, los chunks de tamaño impar llevan un byte de relleno
+                  if (fseek(fd_, size + (size & 1), SEEK_CUR) != 0) {
+                        error_description_ = strerror(errno);
+                        goto error;
+                  }
+                  continue;
+            }
+
+            if (size & 1) {
+                  fseek(fd_, 1, SEEK_CUR);
+            }
+      }
+
+      if (have_fmt == false) {
+            error_description_ = "WAV file without fmt chunk";
+            goto error;
+      }
+
+      if (tag == kWaveFormatPcm && bits == 16) {
+            format = kSampleS16;
+      } else if (tag == kWaveFormatPcm && bits == 24) {
+            format = kSampleS24;
+      } else if (tag == kWaveFormatPcm && bits == 32) {
+            format = kSampleS32;
+      } else if (tag == kWaveFormatIeeeFloat && bits == 32) {
+            format = kSampleFloat32;
+      } else {
+            error_description_ = "unsupported WAV sample format";
+            goto error;
+      }
+      if (channel_count <= 0 || sample_rate <= 0) {
+            error_description_ = "invalid WAV fmt chunk";
+            goto error;
+      }
+
+      {
+            // Los ficheros que se graban en streaming dejan el tamaño a 0 o 0xFFFFFFFF, se leen hasta el final.
+            uint32_t data_size = Le32(chunk + 4);
+            int64_t frame_count = -1;
+            if (data_size != 0 && data_size != 0xFFFFFFFFU) {
+                  frame_count = data_size / (channel_count * (bits / 8));
+            }
+            SetFormat(sample_rate, channel_count, format, frame_count);
+      }
+      return 0;
+
+error:
+      Close();
+      return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RawFileCaptureSource::RawFileCaptureSource(const std::string& file_name, int sampling_rate, int channel_count,
+                                           SampleFormat format) : FileCaptureSource(file_name) {
+      assert(sampling_rate > 0);
+      assert(channel_count > 0);
+
+      raw_sample_rate_ = sampling_rate;
+      raw_channel_count_ = channel_count;
+      raw_format_ = format;
+      SetFormat(sampling_rate, channel_count, format, -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int RawFileCaptureSource::Open() {
+      if (OpenFile() != 0) {
+            return 1;
+      }
+      SetFormat(raw_sample_rate_, raw_channel_count_, raw_format_, -1);
+      return 0;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,72 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_ALSA_CAPTURE_SOURCE_H_
+#define THDANALYZER_ALSA_CAPTURE_SOURCE_H_
+
+#include <alsa/asoundlib.h>
+
+#include "capture_source.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Fuente de captura ALSA, formato S32_LE intercalado.
+       */
+      class AlsaCaptureSource : public CaptureSource {
+      public:
+
+            /**
+             * Constructor.
+             *
+             * @param device Dispositivo ALSA de captura, por ejemplo "default", "hw:0,0" o "plughw:1,0".
+             * @param sampling_rate Frecuencia de muestreo pedida. Solo se usan frecuencias nativas del hardware, si
+             * ésta no existe se elige la inmediatamente superior disponible.
+             * @param channel_count Número de canales.
+             * @param period_frames Número de frames que se leen de cada vez, ALSA despierta al lector cuando hay al
+             * menos este número de frames disponibles.
+             */
+            AlsaCaptureSource(const std::string& device, int sampling_rate, int channel_count, int period_frames);
+
+            virtual ~AlsaCaptureSource();
+
+            virtual int Open();
+            virtual bool IsOpen() const { return capture_handle_ != NULL; }
+            virtual void Close();
+            virtual int Prepare();
+            virtual int Reconfigure(int sample_rate, int period_frames);
+            virtual int Read(int32_t* buffer, int frames);
+            virtual int SampleRate() const { return sample_rate_; }
+            virtual int ChannelCount() const { return channel_count_; }
+            virtual bool IsRealTime() const { return true; }
+            virtual int OverrunCount() const { return overrun_count_; }
+            virtual bool PopXrun(XrunRecord* record);
+
+      private:
+
+            std::string device_;
+            unsigned int sample_rate_;
+            int channel_count_;
+            int period_frames_;
+            int overrun_count_;
+
+            // Representa el dispositivo ALSA de captura de audio.
+            snd_pcm_t* capture_handle_;
+
+            // Estado del dispositivo en el momento de cada overrun, reservado en Open().
+            snd_pcm_status_t* status_;
+            bool monotonic_tstamp_;
+
+            // Overruns de los últimos Read() pendientes de PopXrun(). Si hay más de kMaxPendingXruns seguidos solo se
+            // cuentan en overrun_count_.
+            static const int kMaxPendingXruns = 16;
+            XrunRecord pending_xruns_[kMaxPendingXruns];
+            int pending_xrun_first_;
+            int pending_xrun_count_;
+
+            void RecordXrun();
+            int SetHardwareParameters();
+            int SetSoftwareParameters();
+      };
+
+}
+
+#endif // THDANALYZER_ALSA_CAPTURE_SOURCE_H_
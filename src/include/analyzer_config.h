@@ -0,0 +1,196 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_ANALYZER_CONFIG_H_
+#define THDANALYZER_ANALYZER_CONFIG_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "spectrum_mask.h"
+
+namespace thd_analyzer {
+
+      class ThdAnalyzer;
+
+      /**
+       * Configuración del análisis: máscaras y promediado de cada canal y ventana que se aplica a las muestras antes de
+       * la FFT.
+       *
+       * La aplicación obtiene una copia de la configuración en uso con ThdAnalyzer::Configuration(), la modifica a su
+       * gusto en su propio hilo y la entrega con ThdAnalyzer::SetConfiguration(). El hilo de procesado la empieza a
+       * usar en el siguiente bloque, sin parar la captura. Una vez entregada la configuración pertenece al analizador
+       * y la aplicación no debe volver a modificarla.
+       */
+      class AnalyzerConfig {
+      public:
+
+            /**
+             * Ventana que se aplica al bloque de muestras antes de calcular la FFT. Los coeficientes se normalizan con
+             * la ganancia coherente de la ventana, así un tono puro se mide con la misma amplitud con cualquiera de
+             * ellas.
+             */
+            enum Window {
+                  kWindowRectangular,
+                  kWindowHann,
+                  kWindowBlackmanHarris,
+                  kWindowFlatTop
+            };
+
+            /**
+             * Promediado del espectro de un canal, bloque a bloque. El resultado se publica en un plano aparte,
+             * ThdAnalyzer::AveragedPowerSpectralDensity(), el espectro de cada bloque sigue disponible sin promediar.
+             */
+            enum Averaging {
+
+                  // Sin promediado, el plano promediado es el espectro del último bloque.
+                  kAveragingNone,
+
+                  // Promedio exponencial con constante de tiempo configurable, en segundos.
+                  kAveragingExponential,
+
+                  // Media aritmética de grupos de N bloques. Al completar un grupo empieza otro, durante el grupo se
+                  // publica la media de los bloques que lleva.
+                  kAveragingLinear,
+
+                  // Máximo de cada frecuencia desde que se empezó a promediar.
+                  kAveragingPeakHold,
+
+                  // Mínimo de cada frecuencia desde que se empezó a promediar.
+                  kAveragingMinHold
+            };
+
+            /**
+             * Constructor. Crea una configuración con ventana rectangular, sin promediado y sin máscaras.
+             */
+            AnalyzerConfig(int channel_count, int sampling_rate, int fft_size);
+
+            /**
+             * Constructor de copia. Copia también todas las máscaras.
+             */
+            AnalyzerConfig(const AnalyzerConfig& other);
+
+            /**
+             * Copia |other| para otro tamaño de FFT y otra frecuencia de muestreo (ver ThdAnalyzer::Reconfigure()):
+             * misma ventana y mismo promediado, con las constantes recalculadas, y las máscaras copiadas en la nueva
+             * rejilla de frecuencias.
+             */
+            AnalyzerConfig(const AnalyzerConfig& other, int sampling_rate, int fft_size);
+
+            /**
+             * Destructor. Destruye las máscaras.
+             */
+            ~AnalyzerConfig();
+
+            int ChannelCount() const { return channel_count_; }
+            int SamplingFrequency() const { return sample_rate_; }
+            int DftSize() const { return fft_size_; }
+
+            /**
+             * Añade al canal |channel| una máscara de nombre |name|, inicialmente a 0 dB.
+             *
+             * @return La máscara creada, o NULL si ya existe una con ese nombre en el canal.
+             */
+            SpectrumMask* AddMask(int channel, const std::string& name);
+
+            /**
+             * Quita y destruye la máscara de nombre |name| del canal |channel|.
+             *
+             * @return 0 si se ha quitado, 1 si no existe.
+             */
+            int RemoveMask(int channel, const std::string& name);
+
+            /**
+             * Máscara de nombre |name| del canal |channel|, o NULL si no existe.
+             */
+            SpectrumMask* Mask(int channel, const std::string& name);
+
+            /**
+             * Máscara número |index| del canal |channel|, entre 0 y MaskCount(channel) - 1.
+             */
+            SpectrumMask* Mask(int channel, int index);
+
+            /**
+             * Número de máscaras del canal |channel|.
+             */
+            int MaskCount(int channel) const;
+
+            /**
+             * Selecciona la ventana. Los coeficientes se calculan aquí, en el hilo de la aplicación.
+             */
+            void SetWindow(Window window);
+            Window GetWindow() const { return window_; }
+
+            /**
+             * Nivel a partir del cual una muestra cuenta como recortada o casi en el fondo de escala en las
+             * estadísticas de nivel (ver ThdAnalyzer::GetLevelStats()), en valor absoluto y relativo al fondo de
+             * escala: 1.0 solo cuenta las muestras en el fondo de escala. Es el mismo para todos los canales.
+             */
+            void SetClipLevel(double level);
+            double ClipLevel() const { return clip_level_; }
+
+            static const double kDefaultClipLevel;
+
+            /**
+             * Selecciona el promediado del canal |channel|. Cambiar el modo o el parámetro reinicia el promedio.
+             *
+             * @param parameter Para kAveragingExponential es la constante de tiempo en segundos, para
+             * kAveragingLinear el número de bloques de cada grupo. En los demás modos no se usa.
+             */
+            void SetAveraging(int channel, Averaging mode, double parameter = 0.0);
+            Averaging GetAveraging(int channel) const;
+            double AveragingParameter(int channel) const;
+
+      private:
+
+            friend class ThdAnalyzer;
+
+            struct ChannelConfig {
+
+                  std::vector<SpectrumMask*> masks;
+
+                  // Resultado de la comparación con cada máscara, publicado y en cálculo. report[i] corresponde a
+                  // masks[i]. La memoria de los intervalos se reserva al añadir la máscara.
+                  std::vector<MaskReport> report;
+                  std::vector<MaskReport> report_next;
+
+                  Averaging averaging;
+                  double averaging_parameter;
+
+                  // kAveragingExponential: peso del bloque nuevo, 1 - exp(-T / tau), con T la duración de un bloque.
+                  // kAveragingLinear: número de bloques del grupo.
+                  double alpha;
+                  int    group_size;
+            };
+
+            int channel_count_;
+            int sample_rate_;
+            int fft_size_;
+
+            std::vector<ChannelConfig> channel_;
+
+            Window window_;
+
+            // Coeficientes de la ventana, fft_size_ elementos, ya normalizados.
+            std::vector<double> window_coefficients_;
+
+            // La misma ventana como suma de cosenos, w[n] = sum_m window_terms_[m] cos(2 pi m n / N), para la
+            // interpolación de los máximos (ver InterpolatePeak()).
+            std::vector<double> window_terms_;
+
+            // SetClipLevel() y el mismo nivel en la escala de las muestras S32.
+            double clip_level_;
+            int32_t clip_threshold_;
+
+            // Lista de configuraciones que el hilo de procesado ha dejado de usar y que la aplicación tiene que
+            // destruir. Es una lista enlazada para que el hilo de procesado no tenga que pedir memoria.
+            AnalyzerConfig* retired_next_;
+
+            int FindMask(int channel, const std::string& name) const;
+
+            // No se puede asignar, solo copiar.
+            AnalyzerConfig& operator=(const AnalyzerConfig&);
+      };
+
+}
+
+#endif // THDANALYZER_ANALYZER_CONFIG_H_
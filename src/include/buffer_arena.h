@@ -0,0 +1,95 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_BUFFER_ARENA_H_
+#define THDANALYZER_BUFFER_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Bloque de memoria único del que se reparten los vectores de un análisis: muestras de la fuente, planos de
+       * cada canal (señal y FFT, espectros, sumas acumuladas, promedios). Cada vector empieza en una dirección
+       * múltiplo de kAlignment, el tamaño de una línea de caché y de un registro AVX-512, así que dos vectores no
+       * comparten nunca una línea de caché y los bucles pueden usar cargas alineadas.
+       *
+       * Se usa en dos pasos: se suman los tamaños de todos los vectores con AlignedSize(), se crea la arena con el
+       * total y se reparte con Allocate(). No se libera vector a vector, todo se libera al destruir la arena.
+       *
+       * La memoria se pide con mmap() y empieza a cero. Con páginas grandes se intenta primero MAP_HUGETLB (hace
+       * falta reservarlas en /proc/sys/vm/nr_hugepages) y si no hay se usan páginas normales con
+       * madvise(MADV_HUGEPAGE), que el núcleo convierte en páginas grandes transparentes si están activadas. Con
+       * bloques grandes una página de 2 MB en lugar de 512 de 4 KB evita casi todos los fallos de TLB de la FFT.
+       */
+      class BufferArena {
+      public:
+
+            static const size_t kAlignment = 64;
+
+            enum Pages {
+                  // Páginas normales.
+                  kPagesNormal,
+
+                  // Páginas normales con madvise(MADV_HUGEPAGE).
+                  kPagesTransparentHuge,
+
+                  // Páginas grandes reservadas (MAP_HUGETLB).
+                  kPagesHuge
+            };
+
+            /**
+             * Constructor. Reserva |size| bytes. Si no hay memoria lanza std::bad_alloc, como new.
+             */
+            BufferArena(size_t size, bool huge_pages);
+
+            /**
+             * Destructor. Libera toda la memoria.
+             */
+            ~BufferArena();
+
+            /**
+             * |bytes| redondeado al siguiente múltiplo de kAlignment, lo que ocupa un vector en la arena.
+             */
+            static size_t AlignedSize(size_t bytes) { return (bytes + kAlignment - 1) & ~(kAlignment - 1); }
+
+            /**
+             * Siguiente vector de |bytes| bytes, alineado a kAlignment. La suma de los AlignedSize() de todos los
+             * vectores no puede pasar del tamaño de la arena.
+             */
+            void* Allocate(size_t bytes);
+            double* AllocateDoubles(int count) { return (double*) Allocate(count * sizeof(double)); }
+            int32_t* AllocateInt32(int count) { return (int32_t*) Allocate(count * sizeof(int32_t)); }
+
+            /**
+             * Escribe en todas las páginas sin cambiar su contenido, para que los fallos de página ocurran aquí y no
+             * en el hilo de procesado.
+             */
+            void Prefault();
+
+            size_t Size() const { return size_; }
+            size_t Used() const { return used_; }
+            Pages GetPages() const { return pages_; }
+
+      private:
+
+            char* base_;
+            size_t size_;
+            size_t mapped_size_;
+            size_t used_;
+            Pages pages_;
+
+            // No se puede copiar ni asignar.
+            BufferArena(const BufferArena&);
+            BufferArena& operator=(const BufferArena&);
+      };
+
+      /**
+       * Vector de |count| doubles alineado a BufferArena::kAlignment, para los vectores que no viven en una arena
+       * (máscaras). Se libera con FreeAligned(). Si no hay memoria lanza std::bad_alloc, como new.
+       */
+      double* AllocateAlignedDoubles(int count);
+      void FreeAligned(void* p);
+
+}
+
+#endif // THDANALYZER_BUFFER_ARENA_H_
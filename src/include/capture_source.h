@@ -0,0 +1,109 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_CAPTURE_SOURCE_H_
+#define THDANALYZER_CAPTURE_SOURCE_H_
+
+#include <stdint.h>
+#include <string>
+#include "xrun_journal.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Fuente de muestras de audio para ThdAnalyzer.
+       *
+       * Entrega bloques de frames intercalados (L R L R... en estéreo) con muestras de 32 bits con signo, justificadas
+       * a la izquierda: una fuente de 16 bits deja a cero los 16 bits de menor peso. Es el formato S32_LE que usa el
+       * analizador con ALSA.
+       *
+       * Implementaciones: AlsaCaptureSource (dispositivo de captura ALSA, en tiempo real), WavFileCaptureSource y
+       * RawFileCaptureSource (ficheros grabados, tan rápido como se pueda leer), MemoryCaptureSource (un búfer en
+       * memoria) y SyntheticCaptureSource (señales de prueba generadas al vuelo).
+       */
+      class CaptureSource {
+      public:
+
+            virtual ~CaptureSource() {}
+
+            /**
+             * Abre la fuente. Después de Open() SampleRate() y ChannelCount() devuelven los valores reales.
+             *
+             * @return 0 si todo va bien, 1 si hay algún error, descrito en ErrorDescription().
+             */
+            virtual int Open() = 0;
+
+            virtual bool IsOpen() const = 0;
+
+            virtual void Close() = 0;
+
+            /**
+             * Se llama desde el hilo de procesado justo antes de empezar a leer.
+             */
+            virtual int Prepare() { return 0; }
+
+            /**
+             * Cambia la frecuencia de muestreo a |sample_rate| y el número de frames que se leen de cada vez a
+             * |period_frames| con la fuente abierta. ThdAnalyzer::Reconfigure() lo llama entre dos Read(), con el hilo
+             * de procesado detenido. Si la frecuencia no cambia no debería interrumpir la captura. Después
+             * SampleRate() devuelve la frecuencia real, que puede no ser exactamente la pedida.
+             *
+             * Por defecto solo se admite la frecuencia actual (ficheros, búferes en memoria).
+             *
+             * @return 0 si todo va bien, 1 si no se puede, descrito en ErrorDescription(). Si falla la fuente sigue
+             * con la configuración anterior.
+             */
+            virtual int Reconfigure(int sample_rate, int /*period_frames*/) {
+                  if (sample_rate == SampleRate()) {
+                        return 0;
+                  }
+                  error_description_ = "the sample rate of this capture source cannot be changed";
+                  return 1;
+            }
+
+            /**
+             * Lee |frames| frames en |buffer|, que tiene sitio para frames * ChannelCount() muestras. Es bloqueante.
+             *
+             * @return El número de frames leídos, que solo es menor que |frames| cuando se acaban los datos (fin de
+             * fichero), o un valor negativo si hay un error irrecuperable, descrito en ErrorDescription().
+             */
+            virtual int Read(int32_t* buffer, int frames) = 0;
+
+            /**
+             * Frecuencia de muestreo en Hz.
+             */
+            virtual int SampleRate() const = 0;
+
+            /**
+             * Número de canales de cada frame.
+             */
+            virtual int ChannelCount() const = 0;
+
+            /**
+             * Indica si la fuente entrega las muestras al ritmo de la frecuencia de muestreo (un ADC) o tan rápido
+             * como se le pidan (un fichero).
+             */
+            virtual bool IsRealTime() const = 0;
+
+            /**
+             * Número de veces que se han perdido muestras por no leerlas a tiempo (overrun), solo en fuentes de
+             * tiempo real.
+             */
+            virtual int OverrunCount() const { return 0; }
+
+            /**
+             * Saca el más antiguo de los overruns ocurridos durante los Read() anteriores y todavía no consultados,
+             * con los campos que conoce la fuente. Se llama desde el hilo de procesado después de cada Read().
+             *
+             * @return false si no queda ninguno.
+             */
+            virtual bool PopXrun(XrunRecord* /*record*/) { return false; }
+
+            const std::string& ErrorDescription() const { return error_description_; }
+
+      protected:
+
+            std::string error_description_;
+      };
+
+}
+
+#endif // THDANALYZER_CAPTURE_SOURCE_H_
@@ -0,0 +1,125 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_DECIMATOR_H_
+#define THDANALYZER_DECIMATOR_H_
+
+#include <vector>
+
+namespace thd_analyzer {
+
+      /**
+       * Decimador de un canal: filtro paso bajo y reducción de la frecuencia de muestreo en un factor potencia de 2,
+       * por bloques de tamaño fijo.
+       *
+       * Es una cascada de etapas de decimación por 2 con filtros FIR de media banda (half-band, diseñados con ventana
+       * de Kaiser) en forma polifásica: cada etapa separa la entrada en muestras pares e impares y solo calcula las
+       * muestras de salida que se conservan. En un filtro de media banda la mitad de los coeficientes son nulos y el
+       * resto simétricos, así que cada muestra de salida cuesta un producto por cada pareja de coeficientes. Los
+       * bucles recorren memoria contigua para que el compilador los vectorice.
+       *
+       * Cada etapa se diseña para la banda que llega a la salida: hasta kPassband * Fs de salida la atenuación de
+       * lo que se pliega es de kStopbandDb, por encima hay aliasing. Las primeras etapas tienen una banda de
+       * transición mucho más ancha que la última y por eso menos coeficientes.
+       *
+       * El filtro conserva su estado entre bloques: la salida es la de una señal continua, con un retardo de grupo
+       * constante (Delay()).
+       */
+      class Decimator {
+      public:
+
+            /**
+             * Mayor factor de decimación admitido.
+             */
+            static const int kMaxFactor = 64;
+
+            /**
+             * Límite de la banda útil, como fracción de la frecuencia de muestreo de salida (0,5 es Nyquist).
+             */
+            static const double kPassband;
+
+            /**
+             * Atenuación del aliasing dentro de la banda útil, en dB.
+             */
+            static const double kStopbandDb;
+
+            /**
+             * Constructor. Toda la memoria se reserva aquí.
+             *
+             * @param factor Factor de decimación, potencia de 2 entre 2 y kMaxFactor.
+             * @param output_size Número de muestras de salida de cada bloque.
+             */
+            Decimator(int factor, int output_size);
+            ~Decimator();
+
+            /**
+             * true si |factor| es un factor de decimación válido, incluido 1 (sin decimación).
+             */
+            static bool IsValidFactor(int factor);
+
+            int Factor() const { return factor_; }
+            int OutputSize() const { return output_size_; }
+            int InputSize() const { return output_size_ * factor_; }
+            int StageCount() const { return (int) stages_.size(); }
+
+            /**
+             * Número total de coeficientes no nulos de todas las etapas, para comparar costes.
+             */
+            int TapCount() const;
+
+            /**
+             * Retardo de grupo en muestras de entrada.
+             */
+            double Delay() const;
+
+            /**
+             * Búfer en el que se escriben las InputSize() muestras de entrada del bloque antes de Process().
+             */
+            double* Input() { return stages_[0]->input + stages_[0]->history; }
+
+            /**
+             * Filtra y decima el bloque escrito en Input() y deja las OutputSize() muestras en |output|. No pide
+             * memoria.
+             */
+            void Process(double* output);
+
+            /**
+             * Borra el estado del filtro, como si hasta ahora la entrada hubiera sido nula.
+             */
+            void Reset();
+
+      private:
+
+            struct Stage {
+
+                  // Distancia del coeficiente central al último no nulo, impar. El filtro tiene 2 * half + 1
+                  // coeficientes.
+                  int half;
+
+                  // Coeficientes no nulos fuera del centro, h(1), h(3), ... h(half); el central es 0,5.
+                  std::vector<double> taps;
+
+                  // Muestras de entrada a este bloque, precedidas por las |history| = 2 * half últimas del bloque
+                  // anterior.
+                  int history;
+                  int size;
+                  double* input;
+
+                  // Fases par e impar de |input|.
+                  double* even;
+                  double* odd;
+            };
+
+            int factor_;
+            int output_size_;
+            std::vector<Stage*> stages_;
+
+            static void Design(Stage* stage, double transition);
+            static void Filter(Stage* stage, double* output);
+
+            // No se puede copiar ni asignar.
+            Decimator(const Decimator&);
+            Decimator& operator=(const Decimator&);
+      };
+
+}
+
+#endif // THDANALYZER_DECIMATOR_H_
@@ -0,0 +1,107 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_DSP_KERNELS_H_
+#define THDANALYZER_DSP_KERNELS_H_
+
+#include <stdint.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Bucles de procesado de señal del analizador, separados de ThdAnalyzer para poder medirlos por separado
+       * (bench_thd_analyzer) con el mismo código que ejecuta el hilo de procesado.
+       */
+
+      /**
+       * Extrae el canal |channel| de |n| frames intercalados S32 de |channel_count| canales, lo convierte a coma
+       * flotante normalizado en el intervalo [-1.0, 1.0) y lo multiplica por la ventana |window|, si no es NULL.
+       */
+      void ConvertChannel(const int32_t* frames, int channel_count, int channel, const double* window, int n,
+                          double* out);
+
+      /**
+       * Sumas, extremos y muestras recortadas de un bloque de muestras S32, ver ConvertChannelStats(). Las sumas
+       * son de las muestras ya normalizadas en [-1.0, 1.0).
+       */
+      struct SampleStats {
+            double sum;
+            double sum_squares;
+            int32_t min;
+            int32_t max;
+            int clip_count;
+      };
+
+      /**
+       * Lo mismo que ConvertChannel() y, en la misma pasada, las estadísticas |stats| de las |n| muestras, sin la
+       * ventana: suma, suma de cuadrados, mínimo, máximo y número de muestras con valor absoluto mayor o igual que
+       * |clip_threshold| (en la escala S32). Cuesta unos pocos ns más por muestra que la conversión sola, mucho
+       * menos que la FFT del bloque y que volver a recorrer las muestras en otra pasada.
+       */
+      void ConvertChannelStats(const int32_t* frames, int channel_count, int channel, const double* window, int n,
+                               int32_t clip_threshold, double* out, SampleStats* stats);
+
+      /**
+       * Multiplica x[0]...x[n - 1] por la ventana |window|.
+       */
+      void ApplyWindow(const double* window, int n, double* x);
+
+      /**
+       * Separa la FFT compleja de N puntos de dos señales reales, re + j * im, y calcula la densidad espectral de
+       * potencia |X(k)|^2 / norm^2 de cada una en psd0 y psd1, solo las frecuencias de 0 a N / 2 (N / 2 + 1
+       * puntos): las señales son reales y el resto es simétrico, |X(N - k)| = |X(k)|. Si |psd1| es NULL solo se
+       * calcula la primera. Ver Proakis, Manolakis, "Tratamiento digital de señales", capítulo 6.
+       */
+      void TwoRealPowerSpectra(const double* re, const double* im, int n, double norm, double* psd0, double* psd1);
+
+      /**
+       * Cuantifica |n| puntos de densidad espectral |psd| en dB con 16 bits: el código q representa min_db + q *
+       * step dB, de 0 a |max_code|, y los valores fuera del intervalo (y log10(0)) se saturan.
+       */
+      void QuantizeDecibels(const double* psd, int n, double min_db, double step, int max_code, uint16_t* codes);
+
+      /**
+       * out[k] = x[k] en coma flotante de 32 bits, |n| puntos.
+       */
+      void ConvertToFloat(const double* x, int n, float* out);
+
+      /**
+       * Sumas acumuladas de x[0]...x[n - 1]: sum[0] = 0 y sum[k + 1] = sum[k] + x[k], n + 1 elementos.
+       */
+      void PrefixSum(const double* x, int n, double* sum);
+
+      /**
+       * Posición del máximo absoluto de x[0]...x[n - 1] que supere |threshold|, -1 si ninguno lo supera. El valor
+       * del máximo (o |threshold|) se devuelve en |value|.
+       */
+      int FindMaximum(const double* x, int n, double threshold, double* value);
+
+      /**
+       * Módulo de la respuesta en frecuencia (DTFT) de una ventana de suma de cosenos de |n| puntos, a |d| bins del
+       * centro: |W(d)| con w[i] = terms[0] + terms[1] cos(2 pi i / n) + terms[2] cos(4 pi i / n) + ... Con terms[0]
+       * = 1 la ganancia coherente es 1, |W(0)| = 1.
+       */
+      double CosineWindowResponse(const double* terms, int term_count, int n, double d);
+
+      /**
+       * Ancho de banda equivalente de ruido, en bins, de una ventana periódica de suma de cosenos con terms[0] = 1:
+       * n sum(w^2) / sum(w)^2 = 1 + (terms[1]^2 + terms[2]^2 + ...) / 2. La potencia de un tono repartida por los
+       * bins vecinos suma tantas veces la del bin central.
+       */
+      double CosineWindowNoiseBandwidth(const double* terms, int term_count);
+
+      /**
+       * Estimación de la posición exacta de un tono a partir de la densidad espectral |psd| en el máximo |k| y sus
+       * dos vecinos, para la ventana de suma de cosenos |terms| (ver CosineWindowResponse()) de |n| puntos.
+       *
+       * Se busca el desplazamiento d que hace que (|X(k+1)| - |X(k-1)|) / |X(k)| coincida con el de la respuesta
+       * de la ventana, (|W(1-d)| - |W(1+d)|) / |W(d)|. Es exacto para un tono solo, salvo la fuga del tono de
+       * frecuencia negativa, que con la ventana rectangular limita la precisión a unas milésimas de bin.
+       *
+       * @param gain Si no es NULL, |W(d)|: la pérdida por festoneado (scalloping) en el bin |k|, por la que hay
+       * que dividir la amplitud leída en |k| para corregirla.
+       * @return El desplazamiento d en bins, entre -0.75 y 0.75; el tono está en k + d. 0 si |k| no tiene dos
+       * vecinos.
+       */
+      double InterpolatePeak(const double* psd, int k, int n, const double* terms, int term_count, double* gain);
+}
+
+#endif // THDANALYZER_DSP_KERNELS_H_
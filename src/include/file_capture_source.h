@@ -0,0 +1,120 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_FILE_CAPTURE_SOURCE_H_
+#define THDANALYZER_FILE_CAPTURE_SOURCE_H_
+
+#include <cstdio>
+#include <vector>
+
+#include "capture_source.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Fuente de captura que lee muestras de un fichero grabado.
+       *
+       * No lleva el ritmo de la frecuencia de muestreo, Read() entrega los bloques tan rápido como se leen del disco,
+       * así que el análisis de un fichero va a la velocidad de la CPU. Al llegar al final del fichero Read() devuelve
+       * menos frames de los pedidos y el analizador pasa al estado kFinished.
+       *
+       * Es la base de WavFileCaptureSource y RawFileCaptureSource, que solo se diferencian en cómo obtienen el
+       * formato de las muestras.
+       */
+      class FileCaptureSource : public CaptureSource {
+      public:
+
+            /**
+             * Formato de las muestras en el fichero, siempre little endian y con signo.
+             */
+            enum SampleFormat {
+                  kSampleS16,
+                  kSampleS24,      // 3 bytes por muestra, empaquetadas
+                  kSampleS32,
+                  kSampleFloat32   // IEEE 754, en el intervalo [-1.0, 1.0]
+            };
+
+            virtual ~FileCaptureSource();
+
+            virtual bool IsOpen() const { return fd_ != NULL; }
+            virtual void Close();
+            virtual int Read(int32_t* buffer, int frames);
+            virtual int SampleRate() const { return sample_rate_; }
+            virtual int ChannelCount() const { return channel_count_; }
+            virtual bool IsRealTime() const { return false; }
+
+            const std::string& FileName() const { return file_name_; }
+
+            /**
+             * Número total de frames del fichero, -1 si no se conoce (se lee hasta el final del fichero).
+             */
+            int64_t FrameCount() const { return frame_count_; }
+
+      protected:
+
+            FileCaptureSource(const std::string& file_name);
+
+            /**
+             * Abre el fichero para lectura, para usar desde Open().
+             */
+            int OpenFile();
+
+            /**
+             * Fija el formato de las muestras y el número de frames que quedan por leer (-1 = hasta el final).
+             */
+            void SetFormat(int sample_rate, int channel_count, SampleFormat format, int64_t frame_count);
+
+            std::string file_name_;
+            FILE* fd_;
+
+      private:
+
+            int sample_rate_;
+            int channel_count_;
+            SampleFormat format_;
+            int bytes_per_sample_;
+            int64_t frame_count_;
+            int64_t remaining_frames_;
+
+            // Muestras tal cual están en el fichero, antes de convertirlas.
+            std::vector<uint8_t> scratch_;
+
+            // No se puede copiar ni asignar.
+            FileCaptureSource(const FileCaptureSource&);
+            FileCaptureSource& operator=(const FileCaptureSource&);
+      };
+
+
+      /**
+       * Fichero WAV (RIFF/WAVE). Admite PCM de 16, 24 y 32 bits y coma flotante de 32 bits, también con la cabecera
+       * WAVE_FORMAT_EXTENSIBLE. La frecuencia de muestreo y el número de canales se toman de la cabecera.
+       */
+      class WavFileCaptureSource : public FileCaptureSource {
+      public:
+
+            WavFileCaptureSource(const std::string& file_name);
+
+            virtual int Open();
+      };
+
+
+      /**
+       * Fichero de muestras sin cabecera (raw), intercaladas, con el formato que se indica en el constructor. Es por
+       * ejemplo lo que graba "arecord -t raw".
+       */
+      class RawFileCaptureSource : public FileCaptureSource {
+      public:
+
+            RawFileCaptureSource(const std::string& file_name, int sampling_rate, int channel_count,
+                                 SampleFormat format);
+
+            virtual int Open();
+
+      private:
+
+            int raw_sample_rate_;
+            int raw_channel_count_;
+            SampleFormat raw_format_;
+      };
+
+}
+
+#endif // THDANALYZER_FILE_CAPTURE_SOURCE_H_
@@ -0,0 +1,64 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_LATENCY_HISTOGRAM_H_
+#define THDANALYZER_LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Histograma log-lineal de latencias, de memoria fija.
+       *
+       * Cada potencia de dos [2^e, 2^(e+1)) se divide en 16 intervalos iguales, así que el error relativo de los
+       * percentiles es como mucho 1/16 (6 %) en todo el rango, desde unos pocos nanosegundos hasta minutos, con menos
+       * de 5 kB. Record() no pide memoria ni hace divisiones, se puede llamar en cada bloque desde el hilo de
+       * procesado. Los valores mayores que 2^40 (unos 18 minutos en ns) se cuentan en el último intervalo.
+       *
+       * No es thread-safe, el que lo use lo protege. Se puede copiar.
+       */
+      class LatencyHistogram {
+      public:
+
+            LatencyHistogram();
+
+            /**
+             * Añade una medida, normalmente en nanosegundos.
+             */
+            void Record(uint64_t value);
+
+            /**
+             * Borra todas las medidas.
+             */
+            void Reset();
+
+            uint64_t Count() const { return count_; }
+            uint64_t Min() const { return count_ > 0 ? min_ : 0; }
+            uint64_t Max() const { return max_; }
+            double Mean() const { return count_ > 0 ? (double) sum_ / count_ : 0.0; }
+
+            /**
+             * Valor por debajo del cual están el |percentile| % de las medidas, por ejemplo Percentile(99.9). Es el
+             * extremo superior del intervalo en el que cae, nunca mayor que Max(). 0 si no hay medidas.
+             */
+            uint64_t Percentile(double percentile) const;
+
+      private:
+
+            static const int kSubBucketBits = 4;
+            static const int kSubBuckets = 1 << kSubBucketBits;
+            static const int kMaxExponent = 40;
+            static const int kBucketCount = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+            uint64_t counts_[kBucketCount];
+            uint64_t count_;
+            uint64_t sum_;
+            uint64_t min_;
+            uint64_t max_;
+
+            static int BucketIndex(uint64_t value);
+            static uint64_t BucketUpperBound(int index);
+      };
+
+}
+
+#endif // THDANALYZER_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,114 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_MEASUREMENT_H_
+#define THDANALYZER_MEASUREMENT_H_
+
+#include <string>
+#include <vector>
+
+#include "spectrum_mask.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Una medida de una lista de medidas (MeasurementList), ver ThdAnalyzer::Measure().
+       */
+      struct Measurement {
+
+            enum Type {
+
+                  // Máximo del espectro: frecuencia en Hz y amplitud de pico, como ThdAnalyzer::PeakFrequency() y
+                  // PeakAmplitude().
+                  kPeak,
+
+                  // Potencia del espectro entre f1 y f2 Hz, como ThdAnalyzer::SpectrumBandPower().
+                  kBandPower,
+
+                  // SNRI en dB con la señal entre f1 y f2 Hz, como ThdAnalyzer::SNRI().
+                  kSnri,
+
+                  // Amplitud de pico de los armónicos 1 a harmonic_count de la frecuencia f1 (del máximo del
+                  // espectro si f1 es 0) y distorsión armónica total.
+                  kHarmonics,
+
+                  // Informe de la máscara de nombre mask_name, como ThdAnalyzer::GetMaskReport().
+                  kMask
+            };
+
+            Type type;
+            int channel;
+            double f1;
+            double f2;
+            int harmonic_count;
+            std::string mask_name;
+      };
+
+      /**
+       * Resultado de una medida.
+       */
+      struct MeasurementResult {
+
+            Measurement::Type type;
+            int channel;
+
+            // false si la medida no se ha podido hacer, por ejemplo porque la máscara no existe o la fundamental no
+            // está en el espectro.
+            bool valid;
+
+            // kPeak: amplitud de pico. kBandPower: potencia. kSnri: SNRI en dB. kHarmonics: distorsión armónica
+            // total, sqrt(A2^2 + A3^2 + ...) / A1. kMask: número de frecuencias que traspasan la máscara.
+            double value;
+
+            // kPeak: frecuencia del máximo. kHarmonics: frecuencia fundamental, en Hz.
+            double frequency;
+
+            // kHarmonics: amplitud de pico de cada armónico, harmonics[0] es la fundamental. Los que quedan por encima
+            // de Nyquist valen 0.
+            std::vector<double> harmonics;
+
+            // kMask
+            MaskReport mask;
+      };
+
+      /**
+       * Resultado de todas las medidas de una lista, en el mismo orden. Todas son del mismo bloque.
+       */
+      struct MeasurementReport {
+
+            // Número del bloque (ver ThdAnalyzer::BlockCount()) del que son las medidas.
+            int block;
+
+            std::vector<MeasurementResult> results;
+      };
+
+      /**
+       * Lista de medidas que ThdAnalyzer::Measure() evalúa de una vez sobre el último bloque publicado. La aplicación
+       * la prepara una vez y la evalúa en cada bloque.
+       */
+      class MeasurementList {
+      public:
+
+            /**
+             * Añaden una medida al final de la lista (ver Measurement::Type).
+             *
+             * @return La posición de su resultado en MeasurementReport::results.
+             */
+            int AddPeak(int channel);
+            int AddBandPower(int channel, double f1, double f2);
+            int AddSnri(int channel, double f1, double f2);
+            int AddHarmonics(int channel, double fundamental, int count);
+            int AddMask(int channel, const std::string& name);
+
+            int Count() const { return (int) measurements_.size(); }
+            const Measurement& Get(int index) const { return measurements_[index]; }
+            void Clear() { measurements_.clear(); }
+
+      private:
+
+            std::vector<Measurement> measurements_;
+
+            int Add(Measurement::Type type, int channel, double f1, double f2);
+      };
+
+}
+
+#endif // THDANALYZER_MEASUREMENT_H_
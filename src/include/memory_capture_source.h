@@ -0,0 +1,50 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_MEMORY_CAPTURE_SOURCE_H_
+#define THDANALYZER_MEMORY_CAPTURE_SOURCE_H_
+
+#include "capture_source.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Fuente de captura que lee de un búfer en memoria de frames intercalados S32, por ejemplo una señal generada
+       * por el programa. Igual que los ficheros, entrega los bloques tan rápido como se le pidan.
+       *
+       * El búfer no se copia, tiene que existir mientras exista la fuente.
+       */
+      class MemoryCaptureSource : public CaptureSource {
+      public:
+
+            /**
+             * Constructor.
+             *
+             * @param frames Muestras intercaladas, frame_count * channel_count valores.
+             * @param loop Si es true al llegar al final vuelve a empezar, nunca se acaban los datos.
+             */
+            MemoryCaptureSource(const int32_t* frames, int64_t frame_count, int sampling_rate, int channel_count,
+                                bool loop = false);
+
+            virtual int Open();
+            virtual bool IsOpen() const { return open_; }
+            virtual void Close() { open_ = false; }
+            virtual int Read(int32_t* buffer, int frames);
+            virtual int SampleRate() const { return sample_rate_; }
+            virtual int ChannelCount() const { return channel_count_; }
+            virtual bool IsRealTime() const { return false; }
+
+      private:
+
+            const int32_t* frames_;
+            int64_t frame_count_;
+            int sample_rate_;
+            int channel_count_;
+            bool loop_;
+            bool open_;
+
+            // Siguiente frame que se entrega
+            int64_t position_;
+      };
+
+}
+
+#endif // THDANALYZER_MEMORY_CAPTURE_SOURCE_H_
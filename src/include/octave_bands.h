@@ -0,0 +1,156 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_OCTAVE_BANDS_H_
+#define THDANALYZER_OCTAVE_BANDS_H_
+
+#include <vector>
+
+#include "decimator.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Análisis en bandas de fracción de octava (1/1, 1/3, 1/12...) de varios canales, bloque a bloque.
+       *
+       * Las bandas son las de IEC 61260-1 en base 10: razón de octava G = 10^(3/10), frecuencia de referencia
+       * 1000 Hz, frecuencias centrales exactas fm = 1000 G^(x/b) con b impar y 1000 G^((2x+1)/(2b)) con b par, y
+       * bordes fm G^(-1/(2b)) y fm G^(1/(2b)). Se usan las frecuencias exactas, no las nominales redondeadas.
+       *
+       * El resultado de cada banda es su potencia, el valor cuadrático medio de la señal filtrada en la banda: un
+       * tono A cos(wn) dentro de la banda da A^2 / 2. Se calcula de una de estas dos formas:
+       *
+       *  - kMethodSpectrum: suma de los bins de la densidad espectral del bloque dentro de cada banda, con los
+       *    bins de los bordes ponderados por la parte que cae dentro. Los rangos de bins se calculan aquí, por
+       *    bloque solo es una suma por banda. Es exacto mientras las bandas sean bastante más anchas que la
+       *    resolución de la FFT; las bandas más estrechas que unos pocos bins (las bajas con b grande) necesitan
+       *    más resolución: más DftSize() o decimación.
+       *
+       *  - kMethodFilterBank: banco de filtros IIR paso banda de Butterworth de orden 6 (tres secciones de segundo
+       *    orden, transformación bilineal con los bordes predistorsionados), la realización habitual de los
+       *    filtros de IEC 61260. Cada banda se filtra a la menor frecuencia de muestreo en que cabe: la señal se
+       *    decima por 2 octava a octava (Decimator) y cada banda se asigna al primer nivel en que su borde
+       *    superior queda por debajo de kMaxRelativeFrequency veces la frecuencia del nivel. Las bandas bajas
+       *    cuestan muy poco y sus filtros están bien condicionados; la resolución no depende del tamaño de la FFT.
+       *    El estado de los filtros se conserva entre bloques.
+       *
+       * En los dos casos es la potencia de un bloque, sin promediar entre bloques: si el bloque dura solo unos
+       * pocos periodos de la frecuencia central, o del inverso del ancho de la banda, varía de un bloque a otro.
+       *
+       * Toda la memoria se reserva en el constructor, Filter() y SumBins() no piden memoria.
+       */
+      class OctaveBands {
+      public:
+
+            enum Method {
+                  kMethodSpectrum,
+                  kMethodFilterBank
+            };
+
+            /**
+             * En kMethodFilterBank, mayor relación entre el borde superior de una banda y la frecuencia de muestreo
+             * a la que se filtra.
+             */
+            static const double kMaxRelativeFrequency;
+
+            /**
+             * Constructor.
+             *
+             * @param bands_per_octave b, número de bandas por octava: 1 para octavas, 3 para tercios, etc.
+             * @param min_frequency, max_frequency Se incluyen todas las bandas que tienen alguna frecuencia entre
+             * las dos, sin pasar de Nyquist. Por ejemplo de 20 a 20000 Hz en tercios de octava son las bandas de
+             * 20 Hz a 20 kHz nominales.
+             * @param sampling_rate Frecuencia de muestreo de la señal.
+             * @param block_size Muestras de cada bloque, el tamaño de la FFT en kMethodSpectrum.
+             */
+            OctaveBands(int bands_per_octave, double min_frequency, double max_frequency, Method method,
+                        int channel_count, int sampling_rate, int block_size);
+            ~OctaveBands();
+
+            int BandsPerOctave() const { return bands_per_octave_; }
+            Method GetMethod() const { return method_; }
+            int BandCount() const { return (int) band_.size(); }
+
+            /**
+             * Frecuencia central exacta y bordes inferior y superior, en Hz, de la banda |band|.
+             */
+            double CenterFrequency(int band) const { return band_[band].center; }
+            double LowerFrequency(int band) const { return band_[band].lower; }
+            double UpperFrequency(int band) const { return band_[band].upper; }
+
+            /**
+             * kMethodSpectrum: potencia de cada banda a partir de los block_size / 2 + 1 primeros puntos de la
+             * densidad espectral |psd|. |scale| convierte la suma de bins en potencia, depende de la normalización
+             * de la FFT y del ancho de banda equivalente de ruido de la ventana (ver
+             * CosineWindowNoiseBandwidth()). Escribe BandCount() valores en |power|.
+             */
+            void SumBins(const double* psd, double scale, double* power) const;
+
+            /**
+             * kMethodFilterBank: filtra las block_size muestras |x| del canal |channel|, sin ventana, y escribe la
+             * potencia de cada banda en el bloque en |power| (BandCount() valores).
+             */
+            void Filter(int channel, const double* x, double* power);
+
+            /**
+             * Borra el estado de los filtros, como si hasta ahora la entrada hubiera sido nula.
+             */
+            void Reset();
+
+      private:
+
+            // Sección de segundo orden con un cero en z = 1 y otro en z = -1:
+            // H(z) = g (1 - z^-2) / (1 + a1 z^-1 + a2 z^-2)
+            struct Section {
+                  double g;
+                  double a1;
+                  double a2;
+            };
+
+            struct Band {
+                  double center;
+                  double lower;
+                  double upper;
+
+                  // kMethodSpectrum: bins de first_bin a last_bin, los de los extremos con los pesos first_weight y
+                  // last_weight (todos los demás pesan 1).
+                  int first_bin;
+                  int last_bin;
+                  double first_weight;
+                  double last_weight;
+
+                  // kMethodFilterBank: nivel de decimación (la banda se filtra a sampling_rate / 2^level) y filtro.
+                  int level;
+                  Section section[3];
+            };
+
+            int bands_per_octave_;
+            Method method_;
+            int channel_count_;
+            int sample_rate_;
+            int block_size_;
+
+            std::vector<Band> band_;
+
+            // kMethodFilterBank: niveles de decimación que se usan, decimadores de cada canal (decimator_[c *
+            // (level_count_ - 1) + l] pasa del nivel l al l + 1), estado de las secciones (dos valores por sección,
+            // canal a canal) y señal de cada nivel a partir del 1.
+            int level_count_;
+            std::vector<Decimator*> decimator_;
+            std::vector<double> state_;
+            std::vector<double*> level_signal_;
+
+            void MapBins(Band* band) const;
+            void Design(Band* band) const;
+
+            // Filtra |in| (|n| muestras) con las bandas |a| y |b| a la vez y escribe su potencia. Con |state_b| NULL
+            // solo filtra |a|.
+            static void FilterPair(const Band& a, const Band& b, const double* in, int n, double* state_a,
+                                   double* state_b, double* power_a, double* power_b);
+
+            // No se puede copiar ni asignar.
+            OctaveBands(const OctaveBands&);
+            OctaveBands& operator=(const OctaveBands&);
+      };
+
+}
+
+#endif // THDANALYZER_OCTAVE_BANDS_H_
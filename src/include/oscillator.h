@@ -0,0 +1,80 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_OSCILLATOR_H_
+#define THDANALYZER_OSCILLATOR_H_
+
+#include <stdint.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Oscilador numérico (NCO) de acumulador de fase: A * cos(2 * pi * fase), con la fase en un entero de 64 bits
+       * sin signo que da una vuelta completa cada 2^64. Cada muestra suma el incremento a la fase y el
+       * desbordamiento del entero es el paso de 2 * pi a 0, así que la fase no pierde precisión por muchas horas que
+       * funcione (la resolución en frecuencia es Fs / 2^64) y una frecuencia mayor que Fs se pliega igual que en un
+       * muestreo real.
+       *
+       * El coseno sale de una tabla de senos de kTableSize puntos por vuelta: los 10 bits altos de la fase eligen el
+       * punto más cercano y el resto, menos de media celda, se corrige con el desarrollo de Taylor de sin(a + b). El
+       * error es del orden de 1e-11 (-220 dB), por debajo de la cuantificación de cualquier convertidor, y la tabla
+       * (10 KB, compartida por todos los osciladores) cabe en la caché de nivel 1.
+       *
+       * Cada objeto tiene su propia fase. Cambiar la frecuencia solo cambia el incremento: la señal sigue sin saltos
+       * desde la fase en la que estaba.
+       */
+      class Oscillator {
+      public:
+
+            /**
+             * Puntos de la tabla de senos por vuelta.
+             */
+            static const int kTableBits = 10;
+            static const int kTableSize = 1 << kTableBits;
+
+            /**
+             * Constructor. Frecuencia 0 y fase 0.
+             */
+            Oscillator();
+
+            /**
+             * Frecuencia en ciclos por muestra (frecuencia / frecuencia de muestreo). Se puede cambiar entre dos
+             * llamadas a Generate() sin discontinuidad de fase.
+             */
+            void SetFrequency(double frequency);
+            double Frequency() const;
+
+            /**
+             * Fase en radianes de la siguiente muestra.
+             */
+            void SetPhase(double phase);
+            double Phase() const;
+
+            /**
+             * Escribe en |out| las |n| muestras siguientes, multiplicadas por |amplitude|, y avanza la fase.
+             */
+            void Generate(double amplitude, int n, double* out);
+
+            /**
+             * Como Generate(), con una forma de onda de banda limitada: diente de sierra que sube de -1 a 1 y vuelve
+             * a -1 en la fase 0, o cuadrada que vale 1 entre las fases -pi / 2 y pi / 2 (su fundamental está en fase
+             * con el coseno) y -1 en el resto.
+             *
+             * Muestrear la onda ideal pliega todos los armónicos por encima de Nyquist sobre la banda, en frecuencias
+             * que no son múltiplos de la fundamental. Aquí cada salto se suaviza con PolyBLEP: a las dos muestras
+             * más cercanas se les resta el error de un escalón ideal muestreado, aproximado con un polinomio de
+             * segundo grado. Fuera de los saltos solo cuesta una comparación por muestra. A 192 kHz (la frecuencia
+             * del generador) lo que se pliega por debajo de 20 kHz queda entre 70 y 80 dB por debajo de la
+             * fundamental, unos 40 dB menos que sin corregir; a 48 kHz los armónicos plegados están mucho más cerca
+             * de Nyquist y la mejora es de 10 a 35 dB.
+             */
+            void GenerateSawTooth(double amplitude, int n, double* out);
+            void GenerateSquare(double amplitude, int n, double* out);
+
+      private:
+
+            uint64_t phase_;
+            uint64_t increment_;
+      };
+
+}
+
+#endif // THDANALYZER_OSCILLATOR_H_
@@ -0,0 +1,214 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_SPECTRUM_FILE_H_
+#define THDANALYZER_SPECTRUM_FILE_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <pthread.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Formato binario de fichero de espectros.
+       *
+       * El fichero empieza por una cabecera SpectrumFileHeader de 64 bytes seguida de registros de tamaño fijo
+       * (record_size bytes), uno por bloque. Cada registro es un SpectrumFileRecord seguido de channel_count * bins
+       * valores float con la densidad espectral de potencia de las frecuencias positivas, canal tras canal. Todo en el
+       * orden de bytes de la máquina que lo escribe (little endian en x86 y ARM).
+       *
+       * Como los registros son de tamaño fijo el registro i está en header_size + i * record_size, así que el fichero
+       * se puede leer directamente con mmap() (ver SpectrumFileReader), incluso mientras se está escribiendo.
+       */
+      struct SpectrumFileHeader {
+
+            // "THDSPEC" + '\0'
+            char     magic[8];
+            uint32_t version;
+            uint32_t header_size;
+            uint32_t record_size;
+            uint32_t sample_rate;
+            uint32_t fft_size;
+
+            // Puntos por canal en cada registro, fft_size / 2.
+            uint32_t bins;
+            uint32_t channel_count;
+
+            // Unidades de los valores, de momento solo kSpectrumFileScalingPower.
+            uint32_t scaling;
+
+            // Resolución en frecuencia, sample_rate / fft_size, en Hz.
+            double   resolution;
+
+            uint8_t  reserved[16];
+      };
+
+      struct SpectrumFileRecord {
+            int64_t  block;
+
+            // Instante de captura del bloque, en microsegundos (reloj monotónico).
+            uint64_t timestamp_us;
+      };
+
+      // |X(k)|^2 en unidades lineales, lo mismo que devuelve ThdAnalyzer::PowerSpectralDensity().
+      const uint32_t kSpectrumFileScalingPower = 0;
+      const uint32_t kSpectrumFileVersion = 1;
+
+
+      /**
+       * Escritor continuo de ficheros de espectros.
+       *
+       * Write() copia el espectro en una cola de tamaño fijo y vuelve enseguida, sin esperar al disco. Un hilo propio
+       * va escribiendo la cola en el fichero. Si el disco no da abasto y la cola se llena los bloques se descartan y
+       * se cuentan en DroppedCount(), el hilo que llama a Write() nunca se bloquea esperando al disco.
+       */
+      class SpectrumFileWriter {
+      public:
+
+            /**
+             * Constructor.
+             *
+             * @param queue_length Número de registros que caben en la cola.
+             */
+            SpectrumFileWriter(int queue_length = 64);
+
+            /**
+             * Destructor. Cierra el fichero si está abierto.
+             */
+            ~SpectrumFileWriter();
+
+            /**
+             * Crea el fichero, escribe la cabecera y pone en marcha el hilo de escritura.
+             *
+             * @return 0 si todo va bien, 1 si hay algún error, descrito en ErrorDescription().
+             */
+            int Open(const std::string& file_name, int sample_rate, int fft_size, int channel_count);
+
+            /**
+             * Encola el espectro del bloque |block|. |psd| es un array de ChannelCount() punteros, cada uno a
+             * fft_size / 2 valores. No pide memoria.
+             *
+             * @return 0 si se ha encolado, 1 si la cola estaba llena y el bloque se ha descartado.
+             */
+            int Write(int64_t block, uint64_t timestamp_us, const double* const* psd);
+
+            /**
+             * Escribe lo que quede en la cola, termina el hilo de escritura y cierra el fichero.
+             *
+             * @return 0 si todo va bien, 1 si ha fallado alguna escritura (descrita en ErrorDescription()). En ese caso
+             * el fichero se recorta al último registro completo y los que faltan están en DroppedCount().
+             */
+            int Close();
+
+            int ChannelCount() const { return channel_count_; }
+
+            /**
+             * Registros escritos en el fichero y registros descartados por tener la cola llena o por un error de
+             * escritura.
+             */
+            int64_t RecordCount();
+            int64_t DroppedCount();
+
+            /**
+             * Descripción del último error, también de los de escritura del hilo de escritura.
+             */
+            const std::string& ErrorDescription();
+
+      private:
+
+            FILE* fd_;
+            std::string error_description_;
+
+            // errno del último fwrite() fallido del hilo de escritura, 0 si no hay ninguno pendiente. Se protege con
+            // lock_ y ErrorDescription() lo pasa a error_description_ en el hilo de la aplicación.
+            int write_errno_;
+
+            int channel_count_;
+            int bins_;
+            size_t record_size_;
+
+            // Cola circular de queue_length_ registros ya con el formato del fichero.
+            int queue_length_;
+            uint8_t* queue_;
+            int head_;
+            int tail_;
+            int count_;
+            bool closing_;
+            bool open_;
+
+            int64_t record_count_;
+            int64_t dropped_count_;
+
+            pthread_mutex_t lock_;
+            pthread_cond_t  not_empty_;
+            pthread_t thread_;
+
+            static void* ThreadFuncHelper(void* p);
+            void* ThreadFunc();
+
+            // No se puede copiar ni asignar.
+            SpectrumFileWriter(const SpectrumFileWriter&);
+            SpectrumFileWriter& operator=(const SpectrumFileWriter&);
+      };
+
+
+      /**
+       * Lector de ficheros de espectros con mmap().
+       */
+      class SpectrumFileReader {
+      public:
+
+            SpectrumFileReader();
+            ~SpectrumFileReader();
+
+            /**
+             * Abre el fichero y lo proyecta en memoria.
+             *
+             * @return 0 si todo va bien, 1 si hay algún error, descrito en ErrorDescription().
+             */
+            int Open(const std::string& file_name);
+
+            /**
+             * Vuelve a proyectar el fichero si ha crecido, para ver los registros que se han añadido desde Open().
+             */
+            int Refresh();
+
+            void Close();
+
+            const SpectrumFileHeader& Header() const { return *header_; }
+
+            /**
+             * Número de registros completos en el fichero.
+             */
+            int64_t RecordCount() const { return record_count_; }
+
+            int64_t Block(int64_t record) const { return Record(record)->block; }
+            uint64_t Timestamp(int64_t record) const { return Record(record)->timestamp_us; }
+
+            /**
+             * Los Header().bins valores del canal |channel| en el registro |record|.
+             */
+            const float* Data(int64_t record, int channel) const;
+
+            const std::string& ErrorDescription() const { return error_description_; }
+
+      private:
+
+            std::string file_name_;
+            std::string error_description_;
+            int fd_;
+            uint8_t* map_;
+            size_t map_size_;
+            const SpectrumFileHeader* header_;
+            int64_t record_count_;
+
+            const SpectrumFileRecord* Record(int64_t record) const;
+
+            // No se puede copiar ni asignar.
+            SpectrumFileReader(const SpectrumFileReader&);
+            SpectrumFileReader& operator=(const SpectrumFileReader&);
+      };
+
+}
+
+#endif // THDANALYZER_SPECTRUM_FILE_H_
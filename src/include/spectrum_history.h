@@ -0,0 +1,135 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_SPECTRUM_HISTORY_H_
+#define THDANALYZER_SPECTRUM_HISTORY_H_
+
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Historial de espectros (espectrograma, "waterfall") de un canal.
+       *
+       * Es un búfer circular de capacidad fija con los últimos K espectros, solo frecuencias positivas. Para acotar la
+       * memoria cada punto se guarda en dB cuantificado con 8 o 16 bits dentro del intervalo [min_db, max_db], los
+       * valores fuera del intervalo se saturan. Con 2^12 puntos de FFT y 8 bits una fila ocupa 2 kB, diez minutos de
+       * historial a 44,1 kHz son unos 13 MB por canal.
+       *
+       * Lo escribe el hilo de procesado, un espectro por bloque, y se puede leer desde cualquier hilo.
+       */
+      class SpectrumHistory {
+      public:
+
+            enum Encoding {
+                  kEncodingU8,
+                  kEncodingU16
+            };
+
+            /**
+             * Constructor. Toda la memoria se reserva aquí.
+             *
+             * @param capacity Número máximo de espectros, al llegar a él se sobreescribe el más antiguo.
+             * @param bins Número de puntos de cada espectro.
+             */
+            SpectrumHistory(int capacity, int bins, Encoding encoding, double min_db, double max_db);
+
+            /**
+             * Destructor.
+             */
+            ~SpectrumHistory();
+
+            int Capacity() const { return capacity_; }
+            int Bins() const { return bins_; }
+            Encoding GetEncoding() const { return encoding_; }
+
+            /**
+             * Resolución de la cuantificación, en dB.
+             */
+            double Step() const { return step_; }
+
+            /**
+             * Añade el espectro |psd| (densidad espectral de potencia en unidades lineales, Bins() puntos) del bloque
+             * número |block|, capturado en el instante |timestamp_us| (microsegundos, reloj monotónico).
+             *
+             * Los números de bloque deben ser crecientes. No pide memoria.
+             */
+            void Append(int block, uint64_t timestamp_us, const double* psd);
+
+            /**
+             * Número de espectros guardados.
+             */
+            int Size();
+
+            /**
+             * Números de bloque del espectro más antiguo y del más reciente, -1 si el historial está vacío.
+             */
+            int OldestBlock();
+            int NewestBlock();
+
+            /**
+             * Número del primer bloque guardado capturado en el instante |timestamp_us| o después, -1 si no hay
+             * ninguno.
+             */
+            int FindBlock(uint64_t timestamp_us);
+
+            /**
+             * Copia los espectros de los bloques [first_block, last_block] que aún estén en el historial, del más
+             * antiguo al más reciente. |decibels| recibe Bins() valores en dB por fila, |blocks| y |timestamps| (si no
+             * son NULL) el número de bloque y el instante de cada fila.
+             *
+             * @return El número de filas copiadas.
+             */
+            int Read(int first_block, int last_block, std::vector<double>* decibels, std::vector<int>* blocks,
+                     std::vector<uint64_t>* timestamps);
+
+            /**
+             * Igual que Read() pero sin decuantificar. |codes| recibe Bins() códigos por fila, el valor en dB de un
+             * código q es MinDecibels() + q * Step().
+             */
+            int ReadRaw(int first_block, int last_block, std::vector<uint16_t>* codes, std::vector<int>* blocks,
+                        std::vector<uint64_t>* timestamps);
+
+            double MinDecibels() const { return min_db_; }
+            double MaxDecibels() const { return max_db_; }
+
+      private:
+
+            int capacity_;
+            int bins_;
+            Encoding encoding_;
+            double min_db_;
+            double max_db_;
+            double step_;
+            int max_code_;
+
+            // Filas de datos cuantificados, capacity_ * bins_ elementos de 1 o 2 bytes según encoding_.
+            uint8_t*  data8_;
+            uint16_t* data16_;
+
+            // Número de bloque e instante de cada fila.
+            int*      block_;
+            uint64_t* timestamp_;
+
+            // Fila donde se escribirá el siguiente espectro y número de filas ocupadas.
+            int head_;
+            int size_;
+
+            // Fila de trabajo, se cuantifica aquí fuera del bloqueo y luego se copia a su sitio.
+            uint16_t* scratch_;
+
+            pthread_mutex_t lock_;
+
+            int FindRow(int block);
+            int Row(int i) const { return (head_ - size_ + i + capacity_) % capacity_; }
+            int Collect(int first_block, int last_block, std::vector<uint16_t>* codes, std::vector<int>* blocks,
+                        std::vector<uint64_t>* timestamps);
+
+            // No se puede copiar ni asignar.
+            SpectrumHistory(const SpectrumHistory&);
+            SpectrumHistory& operator=(const SpectrumHistory&);
+      };
+
+}
+
+#endif // THDANALYZER_SPECTRUM_HISTORY_H_
@@ -4,11 +4,39 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace thd_analyzer {
 
       class ThdAnalyzer;   
 
+      /**
+       * Intervalo de frecuencias consecutivas que traspasan la máscara. Los índices son puntos de la FFT, ambos
+       * inclusive, para obtener la frecuencia analógica use ThdAnalyzer::AnalogFrequency().
+       */
+      struct MaskViolation {
+            int    first_bin;
+            int    last_bin;
+
+            // Máximo exceso sobre la máscara dentro del intervalo, en dB. Siempre es > 0.
+            double max_excess;
+      };
+
+      /**
+       * Resultado de comparar el espectro de un bloque con la máscara. Es la lista completa de intervalos que
+       * traspasan la máscara codificada por tramos (run-length), ordenada de menor a mayor frecuencia.
+       */
+      struct MaskReport {
+
+            // Número del bloque (ver ThdAnalyzer::BlockCount()) al que corresponde este informe.
+            int block;
+
+            // Número total de frecuencias que traspasan la máscara, es la suma de las longitudes de los intervalos.
+            int error_count;
+
+            std::vector<MaskViolation> violations;
+      };
+
       /**
        * Máscara espectral.  
        *
@@ -23,8 +51,22 @@ namespace thd_analyzer {
              *
              * @param sampling_rate Frecuencia de muestreo (Fs), la maxima frecuencia analogica fmax es Fs/2
              * @param dft_size Numero de puntos de que consta la grafica m(x).
+             * @param name Nombre de la máscara, por ejemplo "warning" o "failure", sirve para identificarla cuando un
+             * canal tiene varias.
              */
-            SpectrumMask(int sampling_rate, int fft_size);
+            SpectrumMask(int sampling_rate, int fft_size, const std::string& name = "default");
+
+            /**
+             * Constructor de copia. Copia la forma de la máscara pero no los contadores.
+             */
+            SpectrumMask(const SpectrumMask& other);
+
+            /**
+             * Copia |other| en otra rejilla de frecuencias, |fft_size| puntos a |sampling_rate| Hz: cada punto toma
+             * el valor del punto de |other| más cercano en frecuencia, y por encima de la frecuencia máxima de
+             * |other| el de su último punto. No copia los contadores.
+             */
+            SpectrumMask(const SpectrumMask& other, int sampling_rate, int fft_size);
 
             /**
              * Destructor.
@@ -32,6 +74,11 @@ namespace thd_analyzer {
              */
             ~SpectrumMask();
 
+            /**
+             * Nombre de la máscara.
+             */
+            const std::string& Name() const { return name; }
+
             /**
              * Establece una banda de paso desde f1 a f2. Dentro de esta banda la atenuacion minima exigida sera 0 dB
              */
@@ -48,6 +95,16 @@ namespace thd_analyzer {
              */
             void Reset(double attenuation);
 
+            /**
+             * Compara los puntos [k1, k2) de la densidad espectral de potencia |psd| con la máscara y añade al
+             * informe los intervalos que la traspasan. Un intervalo que empieza en k1 continúa el último intervalo
+             * del informe si éste terminaba en k1 - 1, así se puede evaluar el espectro por trozos.
+             */
+            void Evaluate(const double* psd, int k1, int k2, MaskReport* report) const;
+
+
+            // Contadores antiguos, obsoletos: los copia ThdAnalyzer::Mask() del último bloque publicado y no cambian
+            // después. ThdAnalyzer::GetMaskReport() da lo mismo y la lista completa de intervalos.
 
             // Número de frecuencias f en el espectro X(f) actual que TRASPASAN la máscara m(x).
             int    error_count;
@@ -73,8 +130,16 @@ namespace thd_analyzer {
 
             // Valores de la máscara, es una array de [size] elementos
             double* value;
+
+            // Los mismos valores en unidades lineales, 10^(value/10), para comparar directamente con la densidad
+            // espectral de potencia sin calcular un logaritmo por cada punto.
+            double* limit;
             int size;
             int fs;
+            std::string name;
+
+            // No se puede asignar, solo copiar.
+            SpectrumMask& operator=(const SpectrumMask&);
       };
 
 }
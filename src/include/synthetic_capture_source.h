@@ -0,0 +1,144 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_SYNTHETIC_CAPTURE_SOURCE_H_
+#define THDANALYZER_SYNTHETIC_CAPTURE_SOURCE_H_
+
+#include <vector>
+
+#include "capture_source.h"
+
+namespace thd_analyzer {
+
+      /**
+       * Fuente de captura sintética para pruebas de precisión y medidas de rendimiento sin tarjeta de sonido.
+       *
+       * Cada canal es la suma de varios tonos (con sus armónicos a niveles exactos), ruido blanco gaussiano y una
+       * componente continua. El resultado se recorta (clipping) al nivel SetClipLevel() y se le pueden inyectar
+       * glitches periódicos. Todo en unidades de fondo de escala: 1.0 es la muestra máxima del ADC.
+       *
+       * El ruido sale de un generador pseudoaleatorio con semilla, así que la misma configuración y la misma semilla
+       * producen exactamente las mismas muestras en cualquier máquina, cada vez que se llama a Open().
+       *
+       * Por defecto entrega los bloques tan rápido como se le pidan; con SetPaced(true) lleva el ritmo de la
+       * frecuencia de muestreo, como un ADC.
+       */
+      class SyntheticCaptureSource : public CaptureSource {
+      public:
+
+            // Valor de |channel| para aplicar un ajuste a todos los canales.
+            static const int kAllChannels = -1;
+
+            /**
+             * Constructor. Inicialmente todos los canales son silencio.
+             *
+             * @param seed Semilla del generador de ruido.
+             */
+            SyntheticCaptureSource(int sampling_rate, int channel_count, uint32_t seed = 1);
+
+            virtual int Open();
+            virtual bool IsOpen() const { return open_; }
+            virtual void Close() { open_ = false; }
+            virtual int Read(int32_t* buffer, int frames);
+            virtual int SampleRate() const { return sample_rate_; }
+            virtual int Reconfigure(int sample_rate, int period_frames);
+            virtual int ChannelCount() const { return channel_count_; }
+            virtual bool IsRealTime() const { return paced_; }
+
+            /**
+             * Añade un tono A * cos(2 * pi * f * t + phase).
+             *
+             * @param amplitude Amplitud de pico, en fondo de escala.
+             * @param phase Fase inicial en radianes.
+             */
+            void AddTone(int channel, double frequency, double amplitude, double phase = 0.0);
+
+            /**
+             * Añade un tono de frecuencia |fundamental| y sus armónicos. El armónico k-ésimo (k = 2, 3...) tiene el
+             * nivel harmonic_db[k - 2] dB respecto a la fundamental, así que la THD de la señal es exactamente
+             * conocida. Los armónicos por encima de Fs / 2 no se generan.
+             */
+            void AddHarmonics(int channel, double fundamental, double amplitude, const std::vector<double>& harmonic_db);
+
+            /**
+             * Ruido blanco gaussiano de valor eficaz |rms|, en fondo de escala.
+             */
+            void SetNoise(int channel, double rms);
+
+            /**
+             * Componente continua, en fondo de escala.
+             */
+            void SetDcOffset(int channel, double dc);
+
+            /**
+             * Nivel de recorte simétrico de la señal, por defecto 1.0 (fondo de escala).
+             */
+            void SetClipLevel(double level);
+
+            /**
+             * Cada |period| frames sustituye |length| muestras seguidas por el valor |value|: con length = 1 es un
+             * impulso, con value = 0 una pérdida de muestras. period = 0 los desactiva.
+             */
+            void SetGlitches(int channel, int64_t period, int length, double value);
+
+            /**
+             * Número total de frames que se entregan, después Read() devuelve menos frames de los pedidos y el
+             * analizador termina (kFinished). Por defecto -1, sin límite.
+             */
+            void SetFrameLimit(int64_t frames) { frame_limit_ = frames; }
+
+            /**
+             * Lleva el ritmo de la frecuencia de muestreo (true) o entrega las muestras tan rápido como se le pidan
+             * (false, por defecto).
+             */
+            void SetPaced(bool paced) { paced_ = paced; }
+
+            /**
+             * Número de frames entregados desde Open().
+             */
+            int64_t Position() const { return position_; }
+
+      private:
+
+            struct Tone {
+                  double frequency;
+                  double amplitude;
+                  double phase;
+            };
+
+            struct ChannelSignal {
+                  std::vector<Tone> tones;
+                  double noise_rms;
+                  double dc;
+                  int64_t glitch_period;
+                  int glitch_length;
+                  double glitch_value;
+
+                  // Estado del generador de ruido (xorshift64*) y segunda muestra gaussiana de Box-Muller.
+                  uint64_t rng;
+                  bool have_spare;
+                  double spare;
+            };
+
+            int sample_rate_;
+            int channel_count_;
+            uint32_t seed_;
+            double clip_level_;
+            int64_t frame_limit_;
+            bool paced_;
+            bool open_;
+
+            int64_t position_;
+
+            // Instante (reloj monotónico, en ns) en que debería entregarse el frame 0, para SetPaced().
+            uint64_t start_ns_;
+
+            std::vector<ChannelSignal> channel_;
+
+            // Muestras de un canal en coma flotante antes de convertirlas.
+            std::vector<double> scratch_;
+
+            double Gaussian(ChannelSignal* s);
+      };
+
+}
+
+#endif // THDANALYZER_SYNTHETIC_CAPTURE_SOURCE_H_
@@ -4,14 +4,100 @@
 
 #include <stdint.h>
 #include <string>
-#include <alsa/asoundlib.h>
+#include <vector>
 #include <pthread.h>
 
+#include "capture_source.h"
 #include "spectrum_mask.h"
+#include "analyzer_config.h"
+#include "spectrum_history.h"
+#include "spectrum_file.h"
+#include "latency_histogram.h"
+#include "xrun_journal.h"
+#include "decimator.h"
+#include "octave_bands.h"
+#include "measurement.h"
+#include "buffer_arena.h"
 
 
 namespace thd_analyzer {
 
+      /**
+       * Estadísticas de funcionamiento del hilo de procesado (ver ThdAnalyzer::Stats()): histogramas de latencia de
+       * cada etapa del procesado de un bloque, en nanosegundos, y contadores de bloques, overruns y descartes desde
+       * la última puesta a cero.
+       */
+      struct AnalyzerStats {
+
+            enum Stage {
+                  // Espera a la fuente de captura (snd_pcm_readi() en ALSA). Con ALSA es casi todo el periodo de bloque.
+                  kStageCapture,
+
+                  // Conversión de formato con las estadísticas de nivel, decimación (ver
+                  // ThdAnalyzer::SetDecimation()), ventana y banco de filtros de las bandas de octava
+                  // (OctaveBands::kMethodFilterBank).
+                  kStageConvert,
+
+                  // FFT, densidad espectral de potencia, promediado, sumas acumuladas e instantánea compacta
+                  // (ThdAnalyzer::SetSnapshotEncoding()).
+                  kStageSpectrum,
+
+                  // Búsqueda del máximo, máscaras y bandas de octava a partir del espectro.
+                  kStageMasks,
+
+                  // Publicación del bloque, historial y grabación.
+                  kStagePublish,
+
+                  // Todo el procesado del bloque, de kStageConvert a kStagePublish. Si supera el periodo de bloque
+                  // (DftSize() / SamplingFrequency()) la captura acabará perdiendo muestras (overrun).
+                  kStageProcess,
+
+                  kStageCount
+            };
+
+            /**
+             * Nombre de la etapa, "capture", "convert", etc.
+             */
+            static const char* StageName(int stage);
+
+            LatencyHistogram latency[kStageCount];
+
+            // Bloques procesados, overruns de la fuente de captura y bloques no grabados por tener la cola de
+            // grabación llena.
+            int64_t block_count;
+            int64_t overrun_count;
+            int64_t dropped_count;
+
+            // Instante de la última puesta a cero, en microsegundos (reloj monotónico).
+            uint64_t reset_timestamp_us;
+      };
+
+      /**
+       * Estadísticas de nivel en el dominio del tiempo de un canal en un bloque (ver ThdAnalyzer::GetLevelStats()).
+       * Se calculan sobre las muestras de la fuente, antes de la decimación y de la ventana, normalizadas en el
+       * intervalo [-1.0, 1.0).
+       */
+      struct LevelStats {
+
+            // Muestras de la fuente del bloque, DftSize() por el factor de decimación. 0 antes del primer bloque.
+            int sample_count;
+
+            // Valor eficaz (con la continua), componente continua (media) y valores mínimo y máximo.
+            double rms;
+            double dc;
+            double min;
+            double max;
+
+            // Valor de pico, el mayor de |min| y |max|, y factor de cresta, pico / rms (0 si rms es 0). Un tono
+            // tiene un factor de cresta de sqrt(2).
+            double peak;
+            double crest_factor;
+
+            // Muestras recortadas o casi en el fondo de escala, ver AnalyzerConfig::SetClipLevel().
+            int clip_count;
+      };
+
+
       /**
        * Analizador de espectro en tiempo real para señales de audio.
        *
@@ -52,7 +138,28 @@ namespace thd_analyzer {
 
                   // Error fatal, el analizador esta parado, el hilo ha terminado, destruya el objeto (con delete) y 
                   // vuelva a instanciarlo.
-                  kCrashed
+                  kCrashed,
+
+                  // La fuente de captura se ha quedado sin datos (fin de fichero). El hilo ha terminado y las medidas
+                  // se mantienen en el último bloque completo procesado.
+                  kFinished
+            };
+
+            /**
+             * Copia compacta del espectro que el hilo de procesado publica con cada bloque, ver SetSnapshotEncoding().
+             */
+            enum SnapshotEncoding {
+
+                  // Ninguna, solo el espectro en double.
+                  kSnapshotNone,
+
+                  // Coma flotante de 32 bits, la mitad de bytes. GetSpectrum() con un vector de float la copia tal
+                  // cual.
+                  kSnapshotFloat32,
+
+                  // dB cuantificados con 16 bits, una cuarta parte de los bytes, como SpectrumHistory. Se lee con
+                  // GetSpectrumCodes().
+                  kSnapshotDecibels16
             };
 
 
@@ -78,6 +185,16 @@ namespace thd_analyzer {
              */
             ThdAnalyzer(const char* capture_device, int sampling_rate, int log2_block_size);
 
+            /**
+             * Constructor con una fuente de captura cualquiera (ver capture_source.h), por ejemplo un fichero WAV para
+             * analizarlo sin tarjeta de sonido. La frecuencia de muestreo y el número de canales se toman de la
+             * fuente, así que una fuente de fichero tiene que estar ya abierta con Open(), si no lo está la abre
+             * Init(). La fuente no pasa a ser del analizador, tiene que existir mientras exista éste.
+             *
+             * Con un número impar de canales el último canal se procesa emparejado con una señal nula.
+             */
+            ThdAnalyzer(CaptureSource* source, int log2_block_size);
+
 
             /**
              * Destructor. 
@@ -86,10 +203,33 @@ namespace thd_analyzer {
             ~ThdAnalyzer();
 
 
+            /**
+             * Cambia la frecuencia de muestreo y el tamaño de bloque sin destruir el analizador ni detener la captura
+             * más de un bloque. Los búferes del nuevo tamaño se preparan antes de detener el hilo de procesado (se
+             * reutilizan los de un tamaño usado antes), el cambio se hace entre dos bloques y el hardware solo se
+             * reconfigura si cambia la frecuencia de muestreo. La configuración (ventana, promediado y máscaras) se
+             * conserva, las máscaras se remuestrean a las nuevas frecuencias de los bins.
+             *
+             * Las medidas, los promedios y el historial empiezan de nuevo. Los punteros devueltos por History() y
+             * Mask() dejan de ser válidos y no se puede consultar el analizador desde otros hilos durante la llamada.
+             * La grabación tiene que estar detenida (StopRecording()).
+             *
+             * @param sampling_rate Nueva frecuencia de muestreo, <= 0 para conservar la actual. Si el hardware no la
+             * admite se elige la más próxima, consulte SamplingFrequency() después.
+             *
+             * @param log2_block_size Logaritmo en base 2 del nuevo tamaño de bloque, de 4 a 20.
+             *
+             * @return 0 si todo va bien, 1 si no se ha podido cambiar (ver ErrorDescription()), en cuyo caso el
+             * analizador sigue como estaba.
+             */
+            int Reconfigure(int sampling_rate, int log2_block_size);
+
+
             /**
              * Inicialización.
              *
-             * Configura el dispositivo ADC de captura y pone en marcha el hilo de procesado de señal.
+             * Abre la fuente de captura (configura el dispositivo ADC) si no estaba abierta y pone en marcha el hilo de
+             * procesado de señal.
              */
             int Init();
 
@@ -124,10 +264,28 @@ namespace thd_analyzer {
 
 
             /**
-             * Frecuencia de muestreo en hercios (Hz) que está usando el analizador.
+             * Frecuencia de muestreo en hercios (Hz) que está usando el analizador. Con decimación (ver
+             * SetDecimation()) es la de la fuente de captura dividida por el factor de decimación, y es la que
+             * determina la resolución en frecuencia (AnalogResolution()) y la frecuencia de cada bin
+             * (AnalogFrequency()).
              */
             int SamplingFrequency() const;
 
+            /**
+             * Frecuencia de muestreo de la fuente de captura, en Hz. Sin decimación es igual a SamplingFrequency().
+             */
+            int CaptureSamplingFrequency() const;
+
+            /**
+             * Factor de decimación, 1 si no se decima.
+             */
+            int DecimationFactor() const { return decimation_; }
+
+            /**
+             * Número de canales que se analizan, los de la fuente de captura.
+             */
+            int ChannelCount() const { return channel_count_; }
+
             /**
              * Número de puntos de la DFT, que será siempre una potencia de 2. 
              */
@@ -151,22 +309,331 @@ namespace thd_analyzer {
              */
             double AnalogFrequency(int frequency_index);
 
+            /**
+             * Activa el historial de espectros (espectrograma) de todos los canales: los últimos |capacity|
+             * espectros, cuantificados en dB con la codificación |encoding| entre |min_db| y |max_db|. Hay que
+             * llamarlo antes de Init(), toda la memoria se reserva aquí.
+             *
+             * @return 0 si se ha activado, 1 si ya estaba activado.
+             */
+            int EnableHistory(int capacity, SpectrumHistory::Encoding encoding, double min_db = -160.0,
+                              double max_db = 0.0);
+
+            /**
+             * Historial de espectros del canal |channel|, NULL si no se ha activado con EnableHistory(). Se puede
+             * consultar desde cualquier hilo con el analizador en marcha.
+             */
+            SpectrumHistory* History(int channel) const { return channel_[channel].history; }
+
+            /**
+             * Planificación en tiempo real del hilo de procesado: |policy| es SCHED_FIFO o SCHED_RR con |priority|
+             * entre sched_get_priority_min() y sched_get_priority_max(), o SCHED_OTHER (con prioridad 0) para volver
+             * a la planificación normal, que es la que se usa por defecto. Hay que llamarlo antes de Init(); si el
+             * proceso no tiene permiso (CAP_SYS_NICE o RLIMIT_RTPRIO) falla Init().
+             *
+             * @return 0 si los parámetros son válidos, 1 si no, ver ErrorDescription().
+             */
+            int SetRealTimeScheduling(int policy, int priority);
+
+            /**
+             * Afinidad del hilo de procesado: solo se ejecutará en las CPU de |cpus|. Vacío (por defecto) es
+             * cualquier CPU. Hay que llamarlo antes de Init().
+             *
+             * @return 0 si todas las CPU existen, 1 si no, ver ErrorDescription().
+             */
+            int SetCpuAffinity(const std::vector<int>& cpus);
+
+            /**
+             * Si |lock| es true Init() bloquea en memoria todas las páginas del proceso, las actuales y las futuras,
+             * con mlockall(), para que el hilo de procesado no espere nunca a un fallo de página. Afecta a todo el
+             * proceso, no solo al analizador. Hay que llamarlo antes de Init(); sin permiso (CAP_IPC_LOCK o
+             * RLIMIT_MEMLOCK) falla Init().
+             */
+            void SetMemoryLocking(bool lock);
+
+            /**
+             * Si |prefault| es true (por defecto) Init() escribe en todos los búferes de los canales, y el hilo de
+             * procesado en su pila, antes del primer bloque, para que los fallos de página ocurran ahí y no durante
+             * la captura. Hay que llamarlo antes de Init().
+             */
+            void SetPrefaulting(bool prefault);
+
+            /**
+             * Si |huge_pages| es true los búferes de los canales y de las vistas se reservan en páginas grandes (ver
+             * BufferArena): MAP_HUGETLB si el administrador las ha reservado, si no páginas grandes transparentes.
+             * Con bloques grandes reduce los fallos de TLB de la FFT y del espectro. Si no se consiguen se usan
+             * páginas normales, HugePages() dice cuáles. Hay que llamarlo antes de Init().
+             */
+            void SetHugePages(bool huge_pages);
+
+            /**
+             * Páginas en las que están los búferes de los canales.
+             */
+            BufferArena::Pages HugePages() const { return buffers_->arena->GetPages(); }
+
+            /**
+             * Analiza solo la parte baja del espectro con más resolución: las muestras de la fuente pasan por un
+             * filtro antialiasing y se diezman por |factor| (ver Decimator) antes de la FFT. Con Fs = 192 kHz y factor
+             * 16 se analiza de 0 a 6 kHz (SamplingFrequency() es 12 kHz) con 16 veces más resolución que sin decimar
+             * con el mismo DftSize(); cada bloque son DftSize() * factor muestras de la fuente.
+             *
+             * Por encima de Decimator::kPassband * SamplingFrequency() (el 20 % superior de la banda) el filtro ya
+             * no atenúa lo que se pliega y esos bins no son fiables.
+             *
+             * Hay que llamarlo antes de Init() y antes de cambiar la configuración (máscaras, ventana...), que se
+             * rehace para la nueva frecuencia. La frecuencia de la fuente tiene que ser múltiplo de |factor|, si no
+             * falla Init().
+             *
+             * @param factor Potencia de 2 entre 1 (sin decimación, por defecto) y Decimator::kMaxFactor.
+             * @return 0 si el factor es válido, 1 si no, ver ErrorDescription().
+             */
+            int SetDecimation(int factor);
+
+            /**
+             * Añade una vista: otro análisis de la misma captura con su propio tamaño de FFT, salto entre espectros,
+             * ventana y decimación, por ejemplo un espectro rápido y grueso para vigilar las máscaras (el análisis
+             * principal) y otro lento y fino para medir los armónicos. Las vistas comparten la lectura de la fuente,
+             * la conversión de formato y la decimación del análisis principal, que se hacen una sola vez; cada vista
+             * solo añade las etapas de decimación que le faltan y su FFT.
+             *
+             * Cada vista guarda las últimas muestras que recibe y calcula un espectro cada |hop| muestras con las
+             * 2^|log2_block_size| más recientes, así que puede solapar bloques (hop menor que el tamaño de la FFT).
+             * El espectro se calcula como mucho una vez por bloque del análisis principal: si en un bloque se
+             * completan varios saltos solo se calcula el último. Se publica de forma atómica, igual que el
+             * principal, y se consulta con las funciones View...().
+             *
+             * Hay que llamarlo antes de Init(). Reconfigure() vuelve a crear las vistas, que empiezan de nuevo.
+             *
+             * @param log2_block_size Logaritmo en base 2 del tamaño de la FFT de la vista, de 4 a 20.
+             * @param hop Muestras (a la frecuencia de la vista) entre dos espectros; 0 es el tamaño de la FFT, sin
+             * solapamiento.
+             * @param decimation Factor de decimación respecto a la fuente, potencia de 2. Tiene que ser múltiplo del
+             * del análisis principal (SetDecimation()), si no falla Init().
+             * @return El número de la vista, de 0 a ViewCount() - 1, o -1 si los parámetros no son válidos (ver
+             * ErrorDescription()).
+             */
+            int AddView(int log2_block_size, int hop, AnalyzerConfig::Window window, int decimation = 1);
+
+            /**
+             * Número de vistas añadidas con AddView().
+             */
+            int ViewCount() const { return (int) view_specs_.size(); }
+
+            /**
+             * Tamaño de la FFT, frecuencia de muestreo (la de la fuente dividida por su factor de decimación) y
+             * resolución en Hz de la vista |view|.
+             */
+            int ViewDftSize(int view) const;
+            int ViewSamplingFrequency(int view) const;
+            double ViewAnalogResolution(int view) const;
+
+            /**
+             * Número de espectros publicados por la vista |view|.
+             */
+            int ViewBlockCount(int view);
+
+            /**
+             * Densidad espectral de potencia de la vista |view| en el canal |channel| y la frecuencia
+             * |frequency_index|, como PowerSpectralDensity().
+             */
+            double ViewPowerSpectralDensity(int view, int channel, int frequency_index);
+
+            /**
+             * Copia en |psd| el último espectro de la vista |view| del canal |channel|, solo las frecuencias positivas
+             * (ViewDftSize() / 2 puntos), con un solo bloqueo.
+             *
+             * @return El número de espectros publicados por la vista, el mismo que ViewBlockCount().
+             */
+            int GetViewSpectrum(int view, int channel, std::vector<double>* psd);
+
+            /**
+             * Frecuencia (Hz) y amplitud del máximo del espectro de la vista |view|, como PeakFrequency() y
+             * PeakAmplitude().
+             */
+            double ViewPeakFrequency(int view, int channel);
+            double ViewPeakAmplitude(int view, int channel);
+
+            /**
+             * Activa el análisis en bandas de fracción de octava de todos los canales (ver OctaveBands): bandas de
+             * IEC 61260 de 1 / |bands_per_octave| de octava entre |min_frequency| y |max_frequency| Hz. La potencia
+             * de cada banda se calcula en cada bloque y se publica junto con el espectro, de forma atómica.
+             *
+             * Con OctaveBands::kMethodSpectrum se suman los bins del espectro de cada banda, que cuesta poco más que
+             * recorrer el espectro una vez pero necesita varios bins por banda: para tercios de octava desde 20 Hz
+             * hacen falta del orden de 1 Hz de AnalogResolution() (DftSize() o SetDecimation()). Con
+             * OctaveBands::kMethodFilterBank cada banda pasa por un filtro IIR a la frecuencia decimada que le
+             * corresponde, con cualquier tamaño de bloque.
+             *
+             * Hay que llamarlo antes de Init(). Reconfigure() vuelve a crear las bandas para la nueva frecuencia.
+             *
+             * @param bands_per_octave 1 para octavas, 3 para tercios de octava, 12, 24...
+             * @return 0 si los parámetros son válidos, 1 si no, ver ErrorDescription(). Si ninguna banda queda por
+             * debajo de Nyquist falla Init().
+             */
+            int EnableOctaveBands(int bands_per_octave, double min_frequency, double max_frequency,
+                                  OctaveBands::Method method = OctaveBands::kMethodSpectrum);
+
+            /**
+             * Número de bandas, 0 si no se ha llamado a EnableOctaveBands().
+             */
+            int BandCount() const;
+
+            /**
+             * Frecuencia central exacta y bordes, en Hz, de la banda |band|, de 0 a BandCount() - 1 en orden de
+             * frecuencia creciente.
+             */
+            double BandCenterFrequency(int band) const;
+            double BandLowerFrequency(int band) const;
+            double BandUpperFrequency(int band) const;
+
+            /**
+             * Potencia (valor cuadrático medio) de la banda |band| del canal |channel| en el último bloque. Un tono
+             * A cos(wn) en la banda da A^2 / 2.
+             */
+            double BandPower(int channel, int band);
+
+            /**
+             * Copia en |levels| el nivel de todas las bandas del canal |channel| en el último bloque, en dB
+             * respecto a un tono de fondo de escala (10 log10(2 BandPower())), con un solo bloqueo.
+             *
+             * @return El número de bloques procesados, el mismo que BlockCount().
+             */
+            int GetBandLevels(int channel, std::vector<double>* levels);
+
             /**
              * Escribe en disco un fichero de texto con los puntos del espectro listo para visualizar con gnuplot,
-             * octave, matlab, etc. Tiene DftSize() filas y N+1 columnas, siendo N el número de canales. La primera
-             * columna es la frecuencia analógica y las demás los valores del espectro.
+             * octave, matlab, etc. Tiene DftSize() / 2 filas y N+1 columnas, siendo N el número de canales. La
+             * primera columna es la frecuencia analógica y las demás los valores del espectro.
+             *
+             * El espectro se copia al principio, el formateo y la escritura no retienen al hilo de procesado, así que
+             * no hace falta parar el analizador. Para guardar todos los bloques use StartRecording().
              */
             int GnuplotFileDump(std::string file_name);
 
+            /**
+             * Empieza a grabar el espectro de todos los bloques en el fichero binario |file_name| (ver
+             * spectrum_file.h). La escritura la hace un hilo aparte, si el disco no da abasto se descartan bloques y
+             * se cuentan en RecordingDroppedCount(). Se convierte a texto con la herramienta spectrum2gnuplot.
+             *
+             * @return 0 si todo va bien, 1 si ya se estaba grabando o no se puede crear el fichero, en cuyo caso el
+             * error se describe en ErrorDescription().
+             */
+            int StartRecording(const std::string& file_name);
+
+            /**
+             * Termina la grabación, escribe los bloques pendientes y cierra el fichero.
+             */
+            int StopRecording();
+
+            /**
+             * Número de bloques descartados en la grabación en curso por no poder escribirlos a tiempo.
+             */
+            int64_t RecordingDroppedCount();
+
 
             // ----- MEDIDAS -------------------------------------------------------------------------------------------
 
             /**
-             * Devuelve la máscara espectral que se está usando y los contadores de errores asociados.
+             * Devuelve una copia de la configuración más reciente (máscaras, ventana), la que se está usando o la
+             * última entregada con SetConfiguration() si el hilo de procesado aún no la ha recogido. La copia
+             * pertenece a la aplicación, que puede modificarla y entregarla con SetConfiguration() o destruirla con
+             * delete.
+             */
+            AnalyzerConfig* Configuration();
+
+            /**
+             * Entrega una configuración nueva al analizador, que pasa a ser su propietario. El hilo de procesado la
+             * recoge al empezar el siguiente bloque, de forma atómica, sin detener la captura: todas las máscaras y la
+             * ventana cambian a la vez y ningún bloque se procesa con una mezcla de la configuración vieja y la nueva.
+             *
+             * Si se llama otra vez antes de que el hilo la haya recogido, la configuración anterior se descarta.
+             *
+             * @return 0 si se acepta, 1 si no corresponde a este analizador (número de canales, frecuencia de
+             * muestreo o tamaño de la DFT distintos), en cuyo caso se destruye y se describe el error en
+             * ErrorDescription().
+             */
+            int SetConfiguration(AnalyzerConfig* config);
+
+            /**
+             * Devuelve la máscara espectral que se está usando y los contadores de errores asociados. Si el canal
+             * tiene varias máscaras es la primera de ellas, inicialmente la que se llama "default".
+             *
+             * Los contadores (error_count y first_/last_trespassing_*) se copian del último bloque publicado al
+             * llamar a Mask(), no se actualizan después: vuelva a llamarla para leer los de un bloque nuevo, o use
+             * mejor GetMaskReport(), que además da todos los intervalos.
+             *
+             * Modificar la máscara devuelta con el analizador en marcha no es seguro, el hilo de procesado la puede
+             * estar leyendo, use Configuration() y SetConfiguration(). El puntero deja de ser válido en cuanto se
+             * cambia la configuración (SetConfiguration(), AddMask() o RemoveMask()), se cambia la frecuencia o el
+             * tamaño de bloque (Reconfigure() o Init(), si la fuente cambia la frecuencia) o el factor de decimación
+             * (SetDecimation()).
              */
-            SpectrumMask* Mask(int channel) const { return channel_[channel].mask; }
+            SpectrumMask* Mask(int channel);
+
+            /**
+             * Devuelve la máscara de nombre |name| del canal |channel| o NULL si no existe. Igual que Mask(channel).
+             */
+            SpectrumMask* Mask(int channel, const std::string& name);
+
+            /**
+             * Añade al canal |channel| una máscara nueva de nombre |name|, inicialmente a 0 dB. Todas las máscaras de
+             * un canal se evalúan en una sola pasada sobre el espectro de cada bloque y cada una tiene sus propios
+             * contadores e informe. Equivale a modificar una copia de Configuration() y entregarla con
+             * SetConfiguration().
+             *
+             * No devuelve la máscara: la nueva configuración pasa al hilo de procesado y no se puede modificar. Para
+             * darle forma, añádala con AnalyzerConfig::AddMask() en una copia de Configuration() y entréguela con
+             * SetConfiguration().
+             *
+             * @return 0 si se ha añadido, 1 si ya existe una con ese nombre en el canal o si Reconfigure() ha cambiado
+             * el tamaño de bloque mientras tanto (ErrorDescription()).
+             */
+            int AddMask(int channel, const std::string& name);
+
+            /**
+             * Quita y destruye la máscara de nombre |name| del canal |channel|. Equivale a modificar una copia de
+             * Configuration() y entregarla con SetConfiguration().
+             *
+             * @return 0 si se ha quitado, 1 si no existe o si Reconfigure() ha cambiado el tamaño de bloque mientras
+             * tanto (ErrorDescription()).
+             */
+            int RemoveMask(int channel, const std::string& name);
+
+            /**
+             * Número de máscaras que tiene el canal |channel|.
+             */
+            int MaskCount(int channel);
+
+            /**
+             * Copia en |report| la lista completa de intervalos de frecuencia que traspasaron la máscara en el último
+             * bloque procesado. El informe se publica a la vez que el espectro, así que corresponde exactamente al
+             * bloque cuya densidad espectral devuelven PowerSpectralDensity() y FindPeak() en ese momento.
+             *
+             * Sin |name| se refiere a la primera máscara del canal, la misma que devuelve Mask(channel).
+             *
+             * @return 0 si hay informe, 1 si el canal no tiene esa máscara.
+             */
+            int GetMaskReport(int channel, MaskReport* report);
+            int GetMaskReport(int channel, const std::string& name, MaskReport* report);
 
             int OverrunCount() const { return overrun_count_; }
+
+            /**
+             * Copia en |xruns| los últimos overruns de la captura (hasta kXrunJournalCapacity), del más antiguo al
+             * más reciente, con el instante del dispositivo, los frames perdidos, el retardo del búfer y la duración
+             * del procesado del bloque anterior. Se puede llamar desde cualquier hilo.
+             *
+             * @return El número total de overruns registrados desde Init(), incluidos los que ya no caben.
+             */
+            int64_t GetXrunJournal(std::vector<XrunRecord>* xruns) const { return xrun_journal_->Get(xruns); }
+
+            /**
+             * Borra los overruns guardados en el diario, OverrunCount() no cambia.
+             */
+            void ClearXrunJournal() { xrun_journal_->Clear(); }
+
+            static const int kXrunJournalCapacity = 256;
+
             /**
              * Devuelve el índice de frecuencia, es decir, el punto de la FFT cuyo módulo es el máximo absoluto. Los
              * índices empiezan en 0, van desde 0 hasta (BlockSize() - 1). Para obtener la frecuencia analógica que
@@ -176,27 +643,124 @@ namespace thd_analyzer {
              * el canal derecho.
              */
             int FindPeak(int channel);
+
+            /**
+             * Frecuencia en hercios (Hz) del máximo de FindPeak() con resolución menor que un bin: se interpola con
+             * los dos bins vecinos y la respuesta en frecuencia de la ventana. Para un tono solo el error es de unas
+             * milésimas de bin con la ventana rectangular, por la fuga del tono de frecuencia negativa, y despreciable
+             * con las demás: menos de 0,001 Hz con 4096 puntos a 48 kHz y ventana Hann. Se calcula una vez por
+             * bloque.
+             */
+            double PeakFrequency(int channel);
+
+            /**
+             * Amplitud de pico del tono del máximo de FindPeak(), corregida la pérdida por festoneado (scalloping) de
+             * la ventana cuando el tono no cae en el centro de un bin. Un tono 0.5 * cos(wn) da 0.5 sea cual sea su
+             * frecuencia.
+             */
+            double PeakAmplitude(int channel);
                       
 
             /**
-             * Estimación de la relación señal a ruido más interferente (SNRI).
+             * Copia en |stats| las estadísticas de nivel en el dominio del tiempo del canal |channel| en el último
+             * bloque: valor eficaz, continua, extremos, factor de cresta y muestras recortadas (ver LevelStats). Se
+             * calculan en la misma pasada que la conversión de formato y se publican junto con el espectro.
+             *
+             * @return El número de bloques procesados, el mismo que BlockCount().
+             */
+            int GetLevelStats(int channel, LevelStats* stats);
+
+            /**
+             * Valor eficaz del canal |channel| en el último bloque, LevelStats::rms.
+             */
+            double RmsAmplitude(int channel);
+
+            /**
+             * Estimación de la relación señal a ruido más interferente (SNRI), en dB.
              *
              * Esta estimación es bastante simplista, considera que la banda de frecuencia en la que está la señal (y
              * solo está ella, ahí no hay ruido ni inteferencia) es (f1, f2) Hz, lo cual no tiene porqué ser cierto.
+             * El ruido es el resto de las frecuencias positivas del espectro.
+             *
+             * Se calcula con las sumas acumuladas del espectro que publica el hilo de procesado, así que el coste no
+             * depende del tamaño de la FFT ni del ancho de la banda (ver SpectrumBandPower()).
              */
             double SNRI(int channel, double f1, double f2);
+
+            /**
+             * Potencia (valor cuadrático medio) del espectro del último bloque entre |f1| y |f2| Hz: suma de los bins
+             * de floor(f1 / AnalogResolution()) a ceil(f2 / AnalogResolution()), ambos incluidos, como SNRI(),
+             * corregida por el ancho de banda equivalente de ruido de la ventana. Un tono A cos(wn) dentro de la
+             * banda, lejos de los bordes, da A^2 / 2.
+             *
+             * Es una resta de dos sumas acumuladas, O(1). El error absoluto es del orden de 1e-16 veces la potencia
+             * total del espectro, así que bandas unos 150 dB por debajo del total pierden precisión.
+             */
+            double SpectrumBandPower(int channel, double f1, double f2);
+
+            /**
+             * Evalúa todas las medidas de |list| (máximos, potencia en bandas, SNRI, armónicos y máscaras, ver
+             * MeasurementList) sobre el último bloque publicado, con un solo bloqueo. Las funciones de consulta
+             * sueltas pueden leer cada una un bloque distinto; aquí todos los resultados son del bloque
+             * report->block, y el coste por medida es mucho menor.
+             *
+             * Las medidas de potencia y SNRI son O(1) (ver SpectrumBandPower()) y las de armónicos solo leen unos
+             * pocos bins alrededor de cada uno, así que el hilo de procesado apenas espera. Reutilizar |report| de
+             * una llamada a otra evita pedir memoria.
+             *
+             * @return 0. Cada resultado dice si es válido (MeasurementResult::valid).
+             */
+            int Measure(const MeasurementList& list, MeasurementReport* report);
  
 
             /**
              * Densidad espectral de potencia correspondiente a la frecuencia |frequency_index|. 
              * La unidad es vatios / (radian / muestra)
              *
+             * Solo se guardan las frecuencias de 0 a DftSize() / 2, las demás son su imagen: el índice k mayor que
+             * DftSize() / 2 devuelve el valor de DftSize() - k.
+             *
              * @param channel El número de canal, es un dispositivo estéreo 0 es el izquierdo y 1 el derecho.
              * @param frequency_index Índice de la frecuencia en la que se evaluará la densidad espectral de potencia.
              *
              */
             double PowerSpectralDensity(int channel, int frequency_index);
 
+            /**
+             * Copia en |psd| el espectro del último bloque del canal |channel|, de 0 a Nyquist (DftSize() / 2 + 1
+             * puntos), con un solo bloqueo. La versión con float copia la instantánea kSnapshotFloat32 si está
+             * activada (ver SetSnapshotEncoding()), la mitad de bytes con el bloqueo adquirido; si no, convierte el
+             * espectro al copiarlo.
+             *
+             * @return El número de bloques procesados, el mismo que BlockCount().
+             */
+            int GetSpectrum(int channel, std::vector<double>* psd);
+            int GetSpectrum(int channel, std::vector<float>* psd);
+
+            /**
+             * Copia en |codes| la instantánea kSnapshotDecibels16 del espectro del último bloque del canal
+             * |channel|, DftSize() / 2 + 1 códigos. El código q son SnapshotMinDecibels() + q * SnapshotStep() dB.
+             *
+             * @return El número de bloques procesados, o -1 (y |codes| vacío) si la instantánea no es
+             * kSnapshotDecibels16.
+             */
+            int GetSpectrumCodes(int channel, std::vector<uint16_t>* codes);
+
+            /**
+             * Activa la copia compacta del espectro que se publica con cada bloque. La codifica el hilo de procesado,
+             * una vez por bloque, y las lecturas (GetSpectrum(), GetSpectrumCodes()) solo copian 4 o 2 bytes por
+             * punto en lugar de 8. Con kSnapshotDecibels16 cada punto se cuantifica entre |min_db| y |max_db|, con
+             * un logaritmo por punto en el hilo de procesado; los valores fuera del intervalo se saturan.
+             *
+             * Hay que llamarlo antes de Init().
+             *
+             * @return 0 si los parámetros son válidos, 1 si no, ver ErrorDescription().
+             */
+            int SetSnapshotEncoding(SnapshotEncoding encoding, double min_db = -200.0, double max_db = 0.0);
+            SnapshotEncoding GetSnapshotEncoding() const { return snapshot_encoding_; }
+            double SnapshotMinDecibels() const { return snapshot_min_db_; }
+            double SnapshotStep() const { return snapshot_step_; }
+
             /**
              * Lo mismo que PowerSpectralDensity() pero expresado en decibelios, es decir, aplicando
              * 10*log10(x). Expresado en dB la cantidad siempre será negativa, el máximo valor posible es 0 dB.
@@ -206,6 +770,42 @@ namespace thd_analyzer {
             double PowerSpectralDensityDecibels(int channel, int frequency_index);
 
 
+            /**
+             * Densidad espectral de potencia promediada según el modo de promediado del canal (ver
+             * AnalyzerConfig::SetAveraging()). Sin promediado es igual que PowerSpectralDensity().
+             *
+             * @param frequency_index Índice de la frecuencia, solo frecuencias positivas: de 0 a DftSize() / 2 - 1.
+             */
+            double AveragedPowerSpectralDensity(int channel, int frequency_index);
+
+            /**
+             * Lo mismo que AveragedPowerSpectralDensity() pero expresado en decibelios.
+             */
+            double AveragedPowerSpectralDensityDecibels(int channel, int frequency_index);
+
+            /**
+             * Número de bloques que han contribuido al promedio publicado del canal |channel| desde que se reinició.
+             */
+            int AveragedBlockCount(int channel);
+
+            /**
+             * Reinicia el promedio del canal |channel| en el siguiente bloque, por ejemplo para borrar el máximo
+             * retenido en kAveragingPeakHold.
+             */
+            void ResetAveraging(int channel);
+
+            /**
+             * Copia en |stats| las estadísticas del hilo de procesado desde la última puesta a cero. Si |reset| es true
+             * además las pone a cero, en la misma operación, así que no se pierde ni se cuenta dos veces ningún
+             * bloque entre dos llamadas consecutivas.
+             */
+            void Stats(AnalyzerStats* stats, bool reset = false);
+
+            /**
+             * Pone a cero las estadísticas.
+             */
+            void ResetStats();
+
             /**
              * Número de bloques de DftSize() muestras procesados en cada canal desde que el hilo interno de procesado
              * se puso en marcha mediante Init(). Sirve por ejemplo para comprobar que el hilo interno de procesado 
@@ -226,35 +826,167 @@ namespace thd_analyzer {
                   //Channel(int dft_size);
                   //~Channel();
                   
-                  // Longitud de los vectores data y time
+                  // Longitud de los vectores data y pwsd
                   int size;
 
-                  // señal en el dominio del tiempo, muestras convertidas a coma flotante y normalizadas 
-                  // en el intevalo real [-1.0, 1.0)
-                  double* xval;
-
-                  // tmp
+                  // Señal del bloque en el dominio del tiempo, muestras convertidas a coma flotante, normalizadas en
+                  // el intervalo real [-1.0, 1.0) y con la ventana aplicada. La FFT la sobreescribe: es la parte real
+                  // o la imaginaria de la FFT compleja de cada pareja de canales.
                   double* data;
 
-                  // coeficientes de la DFT, modulo al cuadrado, |X(k)|^2
+                  // coeficientes de la DFT, modulo al cuadrado, |X(k)|^2. Es el espectro publicado, el que leen las
+                  // funciones de consulta, protegido por channel_lock_. Solo las frecuencias de 0 a Nyquist,
+                  // size / 2 + 1 elementos, las demás son simétricas.
                   double* pwsd;
 
+                  // Espectro que está calculando el hilo de procesado. Al terminar el bloque se intercambia con pwsd.
+                  double* pwsd_next;
+
+                  // Sumas acumuladas de las frecuencias positivas de pwsd, size / 2 + 1 elementos: psd_sum[k] es
+                  // pwsd[0] + ... + pwsd[k - 1]. La potencia de cualquier banda es una resta. Publicada y en cálculo,
+                  // como pwsd.
+                  double* psd_sum;
+                  double* psd_sum_next;
 
                   // Valor del máximo del espectro
                   double peakv;
+                  double peakv_next;
 
                   // Frecuencia en la que se produce ese máximo espectral.
                   int peakf;
+                  int peakf_next;
+
+                  // Copia compacta de pwsd, publicada y en cálculo: size / 2 + 1 float o uint16_t según
+                  // snapshot_encoding_, NULL con kSnapshotNone.
+                  void* snapshot;
+                  void* snapshot_next;
+
+                  // Estadísticas de nivel del bloque, publicadas y en cálculo.
+                  LevelStats level;
+                  LevelStats level_next;
+
+                  // Posición interpolada del máximo, en bins, y amplitud corregida del tono.
+                  double peak_bin;
+                  double peak_bin_next;
+                  double peak_amplitude;
+                  double peak_amplitude_next;
+
+                  // Espectro promediado, solo frecuencias positivas (size / 2 elementos). avg es el publicado y
+                  // avg_next el que se está calculando, igual que pwsd. avg_sum es el acumulador del promedio lineal.
+                  double* avg;
+                  double* avg_next;
+                  double* avg_sum;
 
-                  // Valor RSM (Root Mean Square) del bloque de muestras capturado
-                  SpectrumMask* mask;
+                  // Número de bloques en el promedio publicado y en el que se está calculando.
+                  int avg_count;
+                  int avg_count_next;
+
+                  // Modo y parámetro con los que se ha calculado el promedio actual, si la configuración los cambia
+                  // se reinicia.
+                  AnalyzerConfig::Averaging avg_mode;
+                  double avg_parameter;
+
+                  // La aplicación pide reiniciar el promedio (ResetAveraging()). Se borra al publicar el bloque que
+                  // la ha atendido (avg_reset_done).
+                  bool avg_reset;
+                  bool avg_reset_done;
+
+                  // Sin promediado (kAveragingNone) avg no se calcula y el promedio es pwsd.
+                  bool avg_none;
+                  bool avg_none_next;
+
+                  // Historial de espectros, NULL si no está activado.
+                  SpectrumHistory* history;
+
+                  // Filtro antialiasing y decimación de las muestras de la fuente, NULL sin decimación.
+                  Decimator* decimator;
+
+            };
+
+            // Parámetros de una vista (AddView()).
+            struct ViewSpec {
+                  int block_size_log2;
+                  int hop;
+                  AnalyzerConfig::Window window;
+                  int decimation;
+            };
+
+            // Canal de una vista. Las muestras que recibe en cada bloque se añaden al final de samples, que guarda
+            // las block_size más recientes entre bloque y bloque.
+            struct ViewChannel {
+                  Decimator* decimator;
+                  double* samples;
+                  double* data;
+                  double* pwsd;
+                  double* pwsd_next;
+                  double peak_bin;
+                  double peak_bin_next;
+                  double peak_amplitude;
+                  double peak_amplitude_next;
+            };
+
+            struct View {
+                  int block_size_log2;
+                  int block_size;
+                  int hop;
+                  int decimation;
+                  int sample_rate;
+
+                  // Solo para la ventana (coeficientes y términos)
+                  AnalyzerConfig* config;
+
+                  // Muestras que recibe por cada bloque del análisis principal, muestras guardadas en samples y
+                  // muestras recibidas desde el último espectro.
+                  int chunk;
+                  int count;
+                  int since;
+
+                  // Espectros publicados, protegido por channel_lock_.
+                  int block_count;
+
+                  // channel_storage_count_ elementos, el de relleno solo usa data.
+                  ViewChannel* channel;
+
+                  // Memoria de los vectores de los canales.
+                  BufferArena* arena;
+            };
+
+            // Búferes que dependen del tamaño de bloque: las muestras de la fuente y los canales.
+            // Todos los vectores están en arena, ver AllocateBuffers().
+            struct BlockBuffers {
+                  int block_size_log2;
+                  int32_t* frames;
+                  Channel* channel;
+                  BufferArena* arena;
             };
 
             // Número de canales del dispositivo ADC, lo normal es que sea estéreo: 2 canales.
             int channel_count_;
 
+            // Número de elementos de channel_, channel_count_ redondeado al siguiente par. Los canales se procesan de
+            // dos en dos y con un número impar de canales el último va emparejado con un canal nulo.
+            int channel_storage_count_;
+
             pthread_mutex_t channel_lock_;
 
+            // Configuración en uso por el hilo de procesado. Solo la cambia el hilo de procesado, al empezar un
+            // bloque, y mientras tanto no se modifica, así que el hilo la lee sin bloqueos.
+            AnalyzerConfig* config_;
+
+            // Configuración a la que pertenecen los informes de máscara publicados, protegida por channel_lock_. Va
+            // un bloque por detrás de config_ cuando ésta cambia.
+            AnalyzerConfig* config_published_;
+
+            // Configuración entregada por la aplicación que el hilo de procesado aún no ha recogido y lista de
+            // configuraciones retiradas pendientes de destruir. Protegidas por config_lock_.
+            AnalyzerConfig* config_pending_;
+            AnalyzerConfig* config_retired_;
+            pthread_mutex_t config_lock_;
+
+            // Serializa las llamadas de la aplicación que cambian la configuración, que son las únicas que destruyen
+            // configuraciones. Se adquiere antes que config_lock_.
+            pthread_mutex_t config_writer_lock_;
+
             // Tamaño de bloque en muestras. El procesamiento de señal
             // se hace por bloques de muestras, no muestra a muestra, que seria muy ineficiente.
             int block_size_;
@@ -262,13 +994,68 @@ namespace thd_analyzer {
             // log2(tamaño del bloque)
             int block_size_log2_;
 
-            // Frecuencia de muestreo
+            // Frecuencia de muestreo del análisis, la de la fuente (capture_rate_) dividida por el factor de
+            // decimación (decimation_, 1 sin decimación).
             int sample_rate_;
+            int capture_rate_;
+            int decimation_;
 
             // Numero de bloques procesados
             int block_count_;
 
+            // Grabación continua del espectro, NULL si no se está grabando. Protegido por recorder_lock_.
+            SpectrumFileWriter* recorder_;
+            pthread_mutex_t recorder_lock_;
+
+            // Punteros al espectro publicado de cada canal, para SpectrumFileWriter::Write().
+            std::vector<const double*> recorder_psd_;
+
+            // Instante en que terminó la captura del bloque que se está procesando, en microsegundos (reloj
+            // monotónico).
+            uint64_t block_timestamp_;
+
+            // Estadísticas, protegidas por stats_lock_. El hilo de procesado mide las etapas del bloque en stage_ns_
+            // y las pasa a stats_ con un solo bloqueo al terminar el bloque.
+            AnalyzerStats stats_;
+            pthread_mutex_t stats_lock_;
+            uint64_t stage_ns_[AnalyzerStats::kStageCount];
+            int stats_overrun_count_;
+            bool block_dropped_;
+
             Channel* channel_;
+
+            // Búferes en uso (channel_ y buf_data_ son los de buffers_) y los de tamaños usados antes, para volver a
+            // ellos sin reservar memoria. buffer_pool_ está protegido por config_writer_lock_.
+            BlockBuffers* buffers_;
+            std::vector<BlockBuffers*> buffer_pool_;
+
+            // Parámetros de EnableHistory(), para crear los historiales de los búferes de otro tamaño. Sin historial
+            // history_capacity_ es 0.
+            int history_capacity_;
+            SpectrumHistory::Encoding history_encoding_;
+            double history_min_db_;
+            double history_max_db_;
+
+            // Vistas pedidas con AddView() y vistas en uso, que se crean en Init() y las vuelve a crear Reconfigure().
+            std::vector<ViewSpec> view_specs_;
+            std::vector<View*> views_;
+
+            // Parámetros de EnableOctaveBands(), band_fraction_ es 0 sin bandas. bands_ se crea en Init() y lo
+            // vuelve a crear Reconfigure(). band_power_ es la potencia publicada, protegida por channel_lock_, y
+            // band_power_next_ la del bloque en cálculo: channel_count_ * BandCount() valores, canal a canal.
+            int band_fraction_;
+            double band_min_frequency_;
+            double band_max_frequency_;
+            OctaveBands::Method band_method_;
+            OctaveBands* bands_;
+            std::vector<double> band_power_;
+            std::vector<double> band_power_next_;
+
+            // Reconfigure() pide al hilo de procesado que se detenga entre dos bloques (park_request_) y espera en
+            // idle_cond_ a que lo esté (idle_). Protegidos por lock_.
+            bool park_request_;
+            bool idle_;
+            pthread_cond_t idle_cond_;
             
             pthread_mutex_t lock_;
             pthread_cond_t  can_continue_;  
@@ -277,28 +1064,71 @@ namespace thd_analyzer {
             pthread_t thread_;
             pthread_attr_t thread_attr_;
 
+            // Opciones de tiempo real del hilo, se aplican en Init(). sched_policy_ < 0 es la planificación
+            // heredada del hilo que llama a Init().
+            int sched_policy_;
+            int sched_priority_;
+            std::vector<int> cpu_affinity_;
+            bool lock_memory_;
+            bool prefault_;
+            bool huge_pages_;
+
+            // SetSnapshotEncoding()
+            SnapshotEncoding snapshot_encoding_;
+            double snapshot_min_db_;
+            double snapshot_step_;
+
             InternalState internal_state_;
             std::string error_description_;
             bool exit_thread_;
 
-            // Dispositivo ALSA de captura
-            std::string device_;
+            // Fuente de las muestras de audio. Si la crea el propio analizador (constructor con dispositivo ALSA)
+            // own_source_ es true y la destruye el destructor.
+            CaptureSource* source_;
+            bool own_source_;
 
-            // Representa el dispositivo ALSA de captura de audio.
-            snd_pcm_t* capture_handle_;
-
-            // Búfer en el se reciben las muestras en el formato en que las entrega el ADC, que normalmente será int16_t
-            // las muestras podrán pertenecer a un solo canal o a varios intercalados. Si por ejemplo hay dos canales
+            // Búfer en el se reciben las muestras tal como las entrega la fuente, S32 justificadas a la izquierda, las
+            // muestras podrán pertenecer a un solo canal o a varios intercalados. Si por ejemplo hay dos canales
             // (estereo) entonces las muestras estarán dispuestas de la forma L R L R L R L R L R...)
-            //int16_t* buf_data_;
             int32_t* buf_data_;
             
             int overrun_count_;
 
+            // Overruns de la fuente, con la duración del procesado previo. Lo escribe el hilo de procesado.
+            XrunJournal* xrun_journal_;
+
             static void* ThreadFuncHelper(void* p);
             void* ThreadFunc();
-            int AdcSetup();
+            void Construct(int log2_block_size);
+            void PrefaultBuffers(BlockBuffers* b);
+            BlockBuffers* AllocateBuffers(int log2_block_size);
+            void ResetBuffers(BlockBuffers* b);
+            void FreeBuffers(BlockBuffers* b);
+            int Park();
+            void Resume();
+            int AllocateViews(int log2_block_size, int capture_rate, std::vector<View*>* views);
+            void FreeView(View* v);
+            void FreeViewsAndBands();
+            void PushViews(int channel, const double* x);
+            void ProcessViews();
+            OctaveBands* CreateBands(int sampling_rate, int block_size);
+            void FrequencyBins(double f1, double f2, int* k1, int* k2) const;
+            void FillMaskCounters(int channel, SpectrumMask* m);
+            double EvaluateSnri(int channel, double f1, double f2) const;
+            double EvaluateBandPower(int channel, double f1, double f2) const;
+            int EvaluateHarmonics(int channel, double fundamental, std::vector<double>* amplitude,
+                                  double* frequency) const;
+            void ConvertSamples(int channel, const double* window, int n, double* out);
             int Process();
+            void Average(int channel);
+            void EncodeSnapshot(int channel);
+            void EvaluateMasks(int channel);
+            void Publish();
+            void UpdateConfiguration();
+            AnalyzerConfig* LatestConfiguration();
+            void DestroyRetiredConfigurations();
+            void RecordStats();
+            void ClearStats();
       };
 }
 
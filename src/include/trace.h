@@ -0,0 +1,88 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_TRACE_H_
+#define THDANALYZER_TRACE_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace thd_analyzer {
+
+      /**
+       * Trazas de ejecución de bajo coste.
+       *
+       * Cada TraceSpan mide un intervalo (su vida, de constructor a destructor) con el reloj CLOCK_MONOTONIC_RAW y lo
+       * guarda en un búfer circular propio del hilo que lo crea, sin bloqueos ni reservas de memoria: escribir un
+       * intervalo son dos lecturas del reloj (vDSO, sin llamada al sistema) y una escritura en memoria. Con las trazas
+       * desactivadas (por defecto) un TraceSpan solo comprueba un indicador.
+       *
+       * WriteChromeTrace() vuelca los búferes de todos los hilos en el formato JSON "trace event" que abren
+       * chrome://tracing y https://ui.perfetto.dev, con un carril por hilo. El búfer de cada hilo guarda los últimos
+       * |events_per_thread| intervalos, los anteriores se sobreescriben, así que se puede dejar activado y volcar
+       * justo después de un problema (un overrun, por ejemplo) para ver qué etapa se retrasó.
+       *
+       * Uso:
+       *
+       *       void Foo() {
+       *             TraceSpan span("foo");
+       *             ...
+       *       }
+       */
+      class TraceSpan {
+      public:
+
+            /**
+             * |name| tiene que ser una cadena constante (se guarda el puntero, no se copia).
+             */
+            explicit TraceSpan(const char* name);
+            ~TraceSpan();
+
+      private:
+
+            const char* name_;
+            uint64_t begin_;
+
+            // No se puede copiar ni asignar.
+            TraceSpan(const TraceSpan&);
+            TraceSpan& operator=(const TraceSpan&);
+      };
+
+      /**
+       * Activa las trazas. Registra el hilo que llama y reserva un búfer de |events_per_thread| intervalos para él y
+       * para cada hilo registrado antes con SetTraceThreadName(); los que se registren después lo reservan al
+       * registrarse. Un TraceSpan nunca reserva memoria, así que los intervalos de un hilo sin registrar no se
+       * guardan.
+       */
+      void EnableTracing(int events_per_thread = 16384);
+
+      /**
+       * Desactiva las trazas, lo registrado se conserva hasta ClearTracing().
+       */
+      void DisableTracing();
+
+      bool TracingEnabled();
+
+      /**
+       * Borra los intervalos registrados en todos los hilos.
+       */
+      void ClearTracing();
+
+      /**
+       * Registra el hilo que llama con el nombre |name| en la traza, por ejemplo "analyzer". |name| tiene que ser una
+       * cadena constante. Conviene llamarla al empezar el hilo, antes de que haga trabajo de tiempo real: puede
+       * reservar memoria. El búfer de un hilo que termina se reutiliza para el siguiente que se registre (su traza se
+       * puede volcar hasta entonces).
+       */
+      void SetTraceThreadName(const char* name);
+
+      /**
+       * Escribe los intervalos registrados en todos los hilos en |file_name| en formato JSON de Chrome. Se puede
+       * llamar con las trazas activadas, los hilos siguen registrando mientras tanto.
+       *
+       * @return 0 si todo va bien, 1 si no se puede escribir el fichero, en cuyo caso |error| (si no es NULL)
+       * describe el error.
+       */
+      int WriteChromeTrace(const std::string& file_name, std::string* error = NULL);
+
+}
+
+#endif // THDANALYZER_TRACE_H_
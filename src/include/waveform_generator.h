@@ -6,6 +6,7 @@
 #include <string>
 #include <pthread.h>
 #include <alsa/asoundlib.h>
+#include "oscillator.h"
 
 namespace thd_analyzer {
 
@@ -77,6 +78,8 @@ namespace thd_analyzer {
 
 
             /**
+             * Forma de onda de salida: coseno, diente de sierra o cuadrada, estas dos de banda limitada (ver
+             * Oscillator::GenerateSawTooth()). El cambio se aplica en el siguiente bloque sin saltos de fase.
              */
             void SetWaveType(Waveform type);
 
@@ -135,16 +138,25 @@ namespace thd_analyzer {
             // Indica si el objeto se ha inicializado mediante Init()
             bool initialized_;
             bool run_;
+
+            // El destructor lo pone a 1 para que termine el hilo de envío.
+            int quit_;
             int sample_rate_;
             int block_size_;
             double frequency_;
             double amplitude_;
+            Waveform waveform_;
 
             std::string device_;
 
             snd_pcm_t* playback_handle_;
             int16_t* buf_data_;
 
+            // Oscilador de la forma de onda y bloque en coma flotante que genera, antes de pasarlo a 16 bits. Solo
+            // los usa el hilo de envío.
+            Oscillator oscillator_;
+            double* wave_;
+
             int SendSamples(snd_pcm_sframes_t nframes);
 
             static void* ThreadFuncHelper(void* p);
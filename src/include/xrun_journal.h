@@ -0,0 +1,93 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#ifndef THDANALYZER_XRUN_JOURNAL_H_
+#define THDANALYZER_XRUN_JOURNAL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+
+namespace thd_analyzer {
+
+      /**
+       * Un overrun (xrun) de la fuente de captura: cuándo ocurrió, cuántas muestras se perdieron y cuánto tardó el
+       * procesado del bloque anterior, para poder relacionar los overruns con picos de carga.
+       *
+       * Los campos del dispositivo los rellena la fuente (ver CaptureSource::PopXrun()), los del analizador
+       * ThdAnalyzer. Los que no se conocen valen 0.
+       */
+      struct XrunRecord {
+
+            // Número de orden del xrun desde que se creó el diario, el primero es el 1.
+            int64_t sequence;
+
+            // Número de bloques publicados (ThdAnalyzer::BlockCount()) cuando se detectó.
+            int64_t block;
+
+            // Instante en que se detectó, en microsegundos del reloj monotónico, la misma base que los instantes de
+            // los bloques en SpectrumHistory y en las grabaciones.
+            uint64_t timestamp_us;
+
+            // Instante de la consulta del estado al dispositivo (htstamp de snd_pcm_status) y en el que se detuvo la
+            // captura por el xrun (trigger htstamp), en nanosegundos del reloj monotónico.
+            uint64_t device_timestamp_ns;
+            uint64_t trigger_timestamp_ns;
+
+            // Estimación de los frames perdidos: los que había en el búfer del dispositivo, que se descartan al
+            // recuperarlo, más los que llegaron con la captura detenida.
+            int64_t frames_lost;
+
+            // Retardo del búfer del dispositivo (frames) en el momento del xrun.
+            int64_t delay_frames;
+
+            // Duración del procesado del bloque anterior al xrun (conversión + Process()) en nanosegundos.
+            uint64_t previous_process_ns;
+      };
+
+      /**
+       * Diario de xruns de tamaño fijo: guarda los |capacity| últimos, los más antiguos se descartan.
+       *
+       * Thread-safe: Append() desde el hilo de procesado, Get() y Clear() desde cualquier hilo. No pide memoria
+       * después del constructor.
+       */
+      class XrunJournal {
+      public:
+
+            explicit XrunJournal(int capacity);
+            ~XrunJournal();
+
+            /**
+             * Añade |record| al diario, con el siguiente número de orden.
+             */
+            void Append(const XrunRecord& record);
+
+            /**
+             * Copia en |records| los xruns guardados, del más antiguo al más reciente.
+             *
+             * @return El número total de xruns añadidos desde el constructor, incluidos los ya descartados o
+             * borrados.
+             */
+            int64_t Get(std::vector<XrunRecord>* records) const;
+
+            /**
+             * Borra los xruns guardados. La numeración continúa.
+             */
+            void Clear();
+
+            int Capacity() const { return (int) records_.size(); }
+
+      private:
+
+            std::vector<XrunRecord> records_;
+            int first_;
+            int count_;
+            int64_t total_;
+            mutable pthread_mutex_t lock_;
+
+            // No se puede copiar ni asignar.
+            XrunJournal(const XrunJournal&);
+            XrunJournal& operator=(const XrunJournal&);
+      };
+
+}
+
+#endif // THDANALYZER_XRUN_JOURNAL_H_
@@ -0,0 +1,96 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include "latency_histogram.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+LatencyHistogram::LatencyHistogram() {
+      Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LatencyHistogram::Reset() {
+      memset(counts_, 0, sizeof(counts_));
+      count_ = 0;
+      sum_ = 0;
+      min_ = ~0ULL;
+      max_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int LatencyHistogram::BucketIndex(uint64_t value) {
+
+      // Los 16 primeros valores tienen un intervalo cada uno
+      if (value < (uint64_t) kSubBuckets) {
+            return (int) value;
+      }
+
+      // e = posición del bit más significativo. El último intervalo es el más alto de [2^39, 2^40), desde 2^40 todo
+      // va a él.
+      int e = 63 - __builtin_clzll(value);
+      if (e >= kMaxExponent) {
+            return kBucketCount - 1;
+      }
+
+      // Los kSubBucketBits bits siguientes al más significativo eligen el intervalo dentro de [2^e, 2^(e+1))
+      int sub = (int) (value >> (e - kSubBucketBits)) - kSubBuckets;
+      int index = (e - kSubBucketBits + 1) * kSubBuckets + sub;
+      assert(index < kBucketCount);
+      return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+      if (index < kSubBuckets) {
+            return index;
+      }
+
+      int e = index / kSubBuckets - 1 + kSubBucketBits;
+      int sub = index % kSubBuckets;
+      uint64_t width = 1ULL << (e - kSubBucketBits);
+      return ((uint64_t) (kSubBuckets + sub) << (e - kSubBucketBits)) + width - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void LatencyHistogram::Record(uint64_t value) {
+      counts_[BucketIndex(value)]++;
+      count_++;
+      sum_ += value;
+      if (value < min_) {
+            min_ = value;
+      }
+      if (value > max_) {
+            max_ = value;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+      if (count_ == 0) {
+            return 0;
+      }
+
+      // Número de medidas que tienen que quedar por debajo, al menos una
+      uint64_t rank = (uint64_t) ceil(percentile / 100.0 * count_);
+      if (rank < 1) {
+            rank = 1;
+      }
+      if (rank > count_) {
+            rank = count_;
+      }
+
+      uint64_t acc = 0;
+      int i;
+      for (i = 0; i < kBucketCount; i++) {
+            acc += counts_[i];
+            if (acc >= rank) {
+                  uint64_t v = BucketUpperBound(i);
+                  return (v < max_) ? v : max_;
+            }
+      }
+      return max_;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,51 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include "measurement.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::Add(Measurement::Type type, int channel, double f1, double f2) {
+      assert(channel >= 0);
+
+      Measurement m;
+      m.type = type;
+      m.channel = channel;
+      m.f1 = f1;
+      m.f2 = f2;
+      m.harmonic_count = 0;
+      measurements_.push_back(m);
+      return (int) measurements_.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::AddPeak(int channel) {
+      return Add(Measurement::kPeak, channel, 0.0, 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::AddBandPower(int channel, double f1, double f2) {
+      return Add(Measurement::kBandPower, channel, f1, f2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::AddSnri(int channel, double f1, double f2) {
+      return Add(Measurement::kSnri, channel, f1, f2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::AddHarmonics(int channel, double fundamental, int count) {
+      assert(count >= 1);
+
+      int i = Add(Measurement::kHarmonics, channel, fundamental, 0.0);
+      measurements_[i].harmonic_count = count;
+      return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MeasurementList::AddMask(int channel, const std::string& name) {
+      int i = Add(Measurement::kMask, channel, 0.0, 0.0);
+      measurements_[i].mask_name = name;
+      return i;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,57 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cstring>
+#include <cassert>
+#include "memory_capture_source.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryCaptureSource::MemoryCaptureSource(const int32_t* frames, int64_t frame_count, int sampling_rate,
+                                         int channel_count, bool loop) {
+      assert(frames != NULL || frame_count == 0);
+      assert(channel_count > 0);
+
+      frames_ = frames;
+      frame_count_ = frame_count;
+      sample_rate_ = sampling_rate;
+      channel_count_ = channel_count;
+      loop_ = loop;
+      open_ = false;
+      position_ = 0;
+      error_description_ = "no error";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MemoryCaptureSource::Open() {
+      open_ = true;
+      position_ = 0;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int MemoryCaptureSource::Read(int32_t* buffer, int frames) {
+      assert(open_ == true);
+
+      int done = 0;
+
+      while (done < frames) {
+            if (position_ == frame_count_) {
+                  if (loop_ == false || frame_count_ == 0) {
+                        break;
+                  }
+                  position_ = 0;
+            }
+
+            int64_t n = frame_count_ - position_;
+            if (n > frames - done) {
+                  n = frames - done;
+            }
+            memcpy(buffer + (size_t) done * channel_count_, frames_ + position_ * channel_count_,
+                   (size_t) n * channel_count_ * sizeof(int32_t));
+            position_ += n;
+            done += (int) n;
+      }
+
+      return done;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
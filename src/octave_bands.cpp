@@ -0,0 +1,338 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <complex>
+#include "octave_bands.h"
+
+using namespace thd_analyzer;
+
+const double OctaveBands::kMaxRelativeFrequency = 0.1;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+OctaveBands::OctaveBands(int bands_per_octave, double min_frequency, double max_frequency, Method method,
+                         int channel_count, int sampling_rate, int block_size) {
+      assert(bands_per_octave > 0);
+      assert(min_frequency > 0.0 && min_frequency <= max_frequency);
+      assert(block_size >= 16 && (block_size & (block_size - 1)) == 0);
+
+      bands_per_octave_ = bands_per_octave;
+      method_ = method;
+      channel_count_ = channel_count;
+      sample_rate_ = sampling_rate;
+      block_size_ = block_size;
+      level_count_ = 0;
+
+      // Bandas de IEC 61260-1, ordenadas de menor a mayor frecuencia. x es el número de banda respecto a la de
+      // 1000 Hz; el intervalo se amplía una banda por cada lado y luego se filtra por los bordes exactos.
+      double b = (double) bands_per_octave;
+      double log_g = 0.3 * log(10.0);
+      int first = (int) floor(b * log(min_frequency / 1000.0) / log_g) - 1;
+      int last = (int) ceil(b * log(max_frequency / 1000.0) / log_g) + 1;
+      int x;
+      for (x = first; x <= last; x++) {
+            double exponent = (bands_per_octave % 2 == 1) ? x / b : (2 * x + 1) / (2 * b);
+            Band band;
+            band.center = 1000.0 * exp(exponent * log_g);
+            band.lower = band.center * exp(-log_g / (2 * b));
+            band.upper = band.center * exp(log_g / (2 * b));
+            if (band.upper <= min_frequency || band.lower >= max_frequency || band.upper >= 0.5 * sample_rate_) {
+                  continue;
+            }
+            band.first_bin = 0;
+            band.last_bin = 0;
+            band.first_weight = 0.0;
+            band.last_weight = 0.0;
+            band.level = 0;
+            band_.push_back(band);
+      }
+
+      size_t i;
+      if (method_ == kMethodSpectrum) {
+            for (i = 0; i < band_.size(); i++) {
+                  MapBins(&band_[i]);
+            }
+            return;
+      }
+
+      // Nivel de cada banda: la menor frecuencia de muestreo con el borde superior por debajo de
+      // kMaxRelativeFrequency, sin bajar de 16 muestras por bloque.
+      int max_level = 0;
+      while ((block_size_ >> (max_level + 1)) >= 16) {
+            max_level++;
+      }
+      for (i = 0; i < band_.size(); i++) {
+            Band* band = &band_[i];
+            while (band->level < max_level &&
+                   band->upper <= kMaxRelativeFrequency * sample_rate_ / (1 << (band->level + 1))) {
+                  band->level++;
+            }
+            Design(band);
+            if (band->level + 1 > level_count_) {
+                  level_count_ = band->level + 1;
+            }
+      }
+
+      int c;
+      int l;
+      for (c = 0; c < channel_count_; c++) {
+            for (l = 1; l < level_count_; l++) {
+                  decimator_.push_back(new Decimator(2, block_size_ >> l));
+            }
+      }
+      level_signal_.assign(level_count_, (double*) NULL);
+      for (l = 1; l < level_count_; l++) {
+            level_signal_[l] = new double[block_size_ >> l];
+            memset(level_signal_[l], 0, (block_size_ >> l) * sizeof(double));
+      }
+      state_.assign(channel_count_ * band_.size() * 6, 0.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+OctaveBands::~OctaveBands() {
+      size_t i;
+      for (i = 0; i < decimator_.size(); i++) {
+            delete decimator_[i];
+      }
+      for (i = 0; i < level_signal_.size(); i++) {
+            delete[] level_signal_[i];
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::MapBins(Band* band) const {
+
+      // El bin k cubre de (k - 1/2) a (k + 1/2) bins; los de los bordes pesan la fracción que cae dentro de la banda.
+      // Los bins 0 y N/2 no tienen pareja de frecuencia negativa y pesan la mitad.
+      double resolution = (double) sample_rate_ / (double) block_size_;
+      double lower = band->lower / resolution;
+      double upper = band->upper / resolution;
+      int half = block_size_ / 2;
+
+      band->first_bin = (int) floor(lower + 0.5);
+      band->last_bin = (int) floor(upper + 0.5);
+      if (band->last_bin > half) {
+            band->last_bin = half;
+      }
+
+      if (band->first_bin == band->last_bin) {
+            band->first_weight = upper - lower;
+            band->last_weight = 0.0;
+      } else {
+            band->first_weight = band->first_bin + 0.5 - lower;
+            band->last_weight = upper - (band->last_bin - 0.5);
+            if (band->last_weight > 1.0) {
+                  band->last_weight = 1.0;
+            }
+      }
+      if (band->first_bin == 0 || band->first_bin == half) {
+            band->first_weight *= 0.5;
+      }
+      if (band->last_bin == half) {
+            band->last_weight *= 0.5;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::Design(Band* band) const {
+
+      typedef std::complex<double> Complex;
+
+      // Bordes predistorsionados para la transformación bilineal s = 2 fs (z - 1) / (z + 1).
+      double fs = (double) sample_rate_ / (1 << band->level);
+      double w1 = 2.0 * fs * tan(M_PI * band->lower / fs);
+      double w2 = 2.0 * fs * tan(M_PI * band->upper / fs);
+      double bandwidth = w2 - w1;
+      double w0_squared = w1 * w2;
+
+      // Polos del prototipo paso bajo de Butterworth de orden 3, exp(j pi (2k + 4) / 6), y transformación a paso
+      // banda: cada polo p da las dos raíces de s^2 - p B s + w0^2. Se aparean los polos complejos con su conjugado
+      // y, si la banda es muy ancha por la predistorsión (cerca de Nyquist), los reales entre sí.
+      std::vector<Complex> complex_poles;
+      std::vector<double> real_poles;
+      int k;
+      int r;
+      for (k = 0; k < 3; k++) {
+            Complex pb = std::polar(1.0, M_PI * (2 * k + 4) / 6.0) * bandwidth;
+            Complex d = std::sqrt(pb * pb - 4.0 * w0_squared);
+            for (r = -1; r <= 1; r += 2) {
+                  Complex s = (pb + (double) r * d) / 2.0;
+                  Complex z = (1.0 + s / (2.0 * fs)) / (1.0 - s / (2.0 * fs));
+                  if (fabs(z.imag()) < 1e-9) {
+                        real_poles.push_back(z.real());
+                  } else if (z.imag() > 0.0) {
+                        complex_poles.push_back(z);
+                  }
+            }
+      }
+      assert(complex_poles.size() + real_poles.size() / 2 == 3);
+
+      size_t i;
+      int n = 0;
+      for (i = 0; i < complex_poles.size(); i++, n++) {
+            band->section[n].a1 = -2.0 * complex_poles[i].real();
+            band->section[n].a2 = std::norm(complex_poles[i]);
+      }
+      for (i = 0; i + 1 < real_poles.size(); i += 2, n++) {
+            band->section[n].a1 = -(real_poles[i] + real_poles[i + 1]);
+            band->section[n].a2 = real_poles[i] * real_poles[i + 1];
+      }
+
+      // Ganancia 1 de cada sección en la frecuencia central, la imagen de sqrt(w1 w2).
+      double wc = 2.0 * atan(sqrt(w0_squared) / (2.0 * fs));
+      Complex e1 = std::polar(1.0, -wc);
+      Complex e2 = e1 * e1;
+      for (n = 0; n < 3; n++) {
+            Section* s = &band->section[n];
+            Complex h = (1.0 - e2) / (1.0 + s->a1 * e1 + s->a2 * e2);
+            s->g = 1.0 / std::abs(h);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::SumBins(const double* psd, double scale, double* power) const {
+      assert(method_ == kMethodSpectrum);
+
+      size_t i;
+      int k;
+      for (i = 0; i < band_.size(); i++) {
+            const Band& b = band_[i];
+            double sum = b.first_weight * psd[b.first_bin];
+            if (b.last_bin > b.first_bin) {
+                  for (k = b.first_bin + 1; k < b.last_bin; k++) {
+                        sum += psd[k];
+                  }
+                  sum += b.last_weight * psd[b.last_bin];
+            }
+            power[i] = scale * sum;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::Filter(int channel, const double* x, double* power) {
+      assert(method_ == kMethodFilterBank);
+      assert(channel < channel_count_);
+
+      // Señal de cada nivel, decimada del anterior.
+      int l;
+      for (l = 1; l < level_count_; l++) {
+            Decimator* d = decimator_[channel * (level_count_ - 1) + l - 1];
+            memcpy(d->Input(), (l == 1) ? x : level_signal_[l - 1], d->InputSize() * sizeof(double));
+            d->Process(level_signal_[l]);
+      }
+
+      // Las bandas del mismo nivel se filtran de dos en dos (las contiguas de band_ comparten casi siempre nivel):
+      // las secciones son recursivas y una sola banda deja al procesador esperando a la muestra anterior, con dos
+      // cadenas independientes en el mismo bucle se ejecutan a la vez.
+      size_t i = 0;
+      while (i < band_.size()) {
+            const Band& b = band_[i];
+            const double* in = (b.level == 0) ? x : level_signal_[b.level];
+            int n = block_size_ >> b.level;
+            double* state = &state_[(channel * band_.size() + i) * 6];
+
+            if (i + 1 < band_.size() && band_[i + 1].level == b.level) {
+                  double* state2 = &state_[(channel * band_.size() + i + 1) * 6];
+                  FilterPair(b, band_[i + 1], in, n, state, state2, &power[i], &power[i + 1]);
+                  i += 2;
+            } else {
+                  FilterPair(b, b, in, n, state, NULL, &power[i], NULL);
+                  i++;
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::FilterPair(const Band& a, const Band& b, const double* in, int n, double* state_a, double* state_b,
+                             double* power_a, double* power_b) {
+
+      // Si |state_b| es NULL solo se filtra |a|: la segunda cadena repite la primera con un estado desechable.
+      double scratch[6];
+      if (state_b == NULL) {
+            memcpy(scratch, state_a, sizeof(scratch));
+            state_b = scratch;
+      }
+
+      // Forma directa II transpuesta, las tres secciones de cada banda en el mismo bucle.
+      const Section& a0 = a.section[0];
+      const Section& a1 = a.section[1];
+      const Section& a2 = a.section[2];
+      const Section& b0 = b.section[0];
+      const Section& b1 = b.section[1];
+      const Section& b2 = b.section[2];
+      double au0 = state_a[0], av0 = state_a[1], au1 = state_a[2], av1 = state_a[3], au2 = state_a[4], av2 = state_a[5];
+      double bu0 = state_b[0], bv0 = state_b[1], bu1 = state_b[2], bv1 = state_b[3], bu2 = state_b[4], bv2 = state_b[5];
+      double sum_a = 0.0;
+      double sum_b = 0.0;
+      int m;
+      for (m = 0; m < n; m++) {
+            double ax0 = in[m] * a0.g;
+            double bx0 = in[m] * b0.g;
+            double ay0 = ax0 + au0;
+            double by0 = bx0 + bu0;
+            au0 = av0 - a0.a1 * ay0;
+            bu0 = bv0 - b0.a1 * by0;
+            av0 = -ax0 - a0.a2 * ay0;
+            bv0 = -bx0 - b0.a2 * by0;
+
+            double ax1 = ay0 * a1.g;
+            double bx1 = by0 * b1.g;
+            double ay1 = ax1 + au1;
+            double by1 = bx1 + bu1;
+            au1 = av1 - a1.a1 * ay1;
+            bu1 = bv1 - b1.a1 * by1;
+            av1 = -ax1 - a1.a2 * ay1;
+            bv1 = -bx1 - b1.a2 * by1;
+
+            double ax2 = ay1 * a2.g;
+            double bx2 = by1 * b2.g;
+            double ay2 = ax2 + au2;
+            double by2 = bx2 + bu2;
+            au2 = av2 - a2.a1 * ay2;
+            bu2 = bv2 - b2.a1 * by2;
+            av2 = -ax2 - a2.a2 * ay2;
+            bv2 = -bx2 - b2.a2 * by2;
+
+            sum_a += ay2 * ay2;
+            sum_b += by2 * by2;
+      }
+
+      state_a[0] = au0;
+      state_a[1] = av0;
+      state_a[2] = au1;
+      state_a[3] = av1;
+      state_a[4] = au2;
+      state_a[5] = av2;
+      state_b[0] = bu0;
+      state_b[1] = bv0;
+      state_b[2] = bu1;
+      state_b[3] = bv1;
+      state_b[4] = bu2;
+      state_b[5] = bv2;
+
+      // Con silencio a la entrada el estado decae hacia números desnormalizados, que son muy lentos.
+      int j;
+      for (j = 0; j < 6; j++) {
+            if (fabs(state_a[j]) < 1e-30) {
+                  state_a[j] = 0.0;
+            }
+            if (fabs(state_b[j]) < 1e-30) {
+                  state_b[j] = 0.0;
+            }
+      }
+
+      *power_a = sum_a / n;
+      if (power_b != NULL) {
+            *power_b = sum_b / n;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void OctaveBands::Reset() {
+      size_t i;
+      for (i = 0; i < decimator_.size(); i++) {
+            decimator_[i]->Reset();
+      }
+      state_.assign(state_.size(), 0.0);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
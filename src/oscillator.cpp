@@ -0,0 +1,145 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cmath>
+#include "oscillator.h"
+
+using namespace thd_analyzer;
+
+namespace {
+
+      // 2^64, una vuelta completa de la fase.
+      const double kTurn = 18446744073709551616.0;
+
+      // Radianes por unidad de fase.
+      const double kRadiansPerUnit = 2.0 * M_PI / kTurn;
+
+      // Bits de la fase por debajo del índice de la tabla.
+      const int kFractionBits = 64 - Oscillator::kTableBits;
+
+      // Un cuarto de vuelta en puntos de la tabla: cos(a) = sin(a + pi / 2).
+      const int kQuarter = Oscillator::kTableSize / 4;
+
+      // Tabla de senos con un cuarto de vuelta más al final, para leer el coseno sin dar la vuelta al índice. Se
+      // rellena al cargar la biblioteca, antes de que exista ningún oscilador.
+      class SineTable {
+      public:
+            SineTable() {
+                  int k;
+                  for (k = 0; k < Oscillator::kTableSize + kQuarter; k++) {
+                        value[k] = sin(2.0 * M_PI * k / Oscillator::kTableSize);
+                  }
+            }
+
+            double value[Oscillator::kTableSize + kQuarter];
+      };
+
+      const SineTable sine_table;
+
+      // 2^-53: los 53 bits altos de la fase, que caben exactos en un double, a fracción de vuelta.
+      const double kTurnsPerUnit53 = 1.0 / 9007199254740992.0;
+
+      // Corrección PolyBLEP de un escalón de altura 2 en t = 0, para la fase |t| en [0, 1) y el incremento por
+      // muestra |dt|: la diferencia entre un escalón de banda limitada y el ideal, distinta de 0 solo en la muestra
+      // anterior y en la posterior al salto.
+      inline double PolyBlep(double t, double dt) {
+            double x;
+            if (t < dt) {
+                  x = t / dt;
+                  return x + x - x * x - 1.0;
+            }
+            if (t > 1.0 - dt) {
+                  x = (t - 1.0) / dt;
+                  return x * x + x + x + 1.0;
+            }
+            return 0.0;
+      }
+
+      // Fracción de vuelta (cualquier número real) a unidades de fase, módulo 2^64.
+      uint64_t TurnsToPhase(double turns) {
+            double x = (turns - floor(turns)) * kTurn;
+            return (x >= kTurn) ? 0 : (uint64_t) x;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Oscillator::Oscillator() {
+      phase_ = 0;
+      increment_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Oscillator::SetFrequency(double frequency) {
+      increment_ = TurnsToPhase(frequency);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double Oscillator::Frequency() const {
+      return ((double) increment_) / kTurn;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Oscillator::SetPhase(double phase) {
+      phase_ = TurnsToPhase(phase / (2.0 * M_PI));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double Oscillator::Phase() const {
+      return ((double) phase_) * kRadiansPerUnit;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Oscillator::Generate(double amplitude, int n, double* out) {
+      const double* table = sine_table.value;
+      const uint64_t half_step = ((uint64_t) 1) << (kFractionBits - 1);
+      uint64_t phase = phase_;
+      int i;
+
+      for (i = 0; i < n; i++) {
+            // Punto de la tabla más cercano (el último redondea al 0) y resto b en [-pi / N, pi / N)
+            int k = (int) ((phase + half_step) >> kFractionBits);
+            double b = ((double) (int64_t) (phase - ((uint64_t) k << kFractionBits))) * kRadiansPerUnit;
+            double b2 = b * b;
+
+            // cos(a + b) = cos(a) cos(b) - sin(a) sin(b), con cos(b) y sin(b) hasta el término en b^3
+            out[i] = amplitude * (table[k + kQuarter] * (1.0 - 0.5 * b2) - table[k] * b * (1.0 - b2 / 6.0));
+            phase += increment_;
+      }
+
+      phase_ = phase;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Oscillator::GenerateSawTooth(double amplitude, int n, double* out) {
+      double dt = Frequency();
+      uint64_t phase = phase_;
+      int i;
+
+      for (i = 0; i < n; i++) {
+            double t = ((double) (phase >> 11)) * kTurnsPerUnit53;
+            out[i] = amplitude * (2.0 * t - 1.0 - PolyBlep(t, dt));
+            phase += increment_;
+      }
+
+      phase_ = phase;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Oscillator::GenerateSquare(double amplitude, int n, double* out) {
+      const uint64_t quarter = ((uint64_t) 1) << 62;
+      const uint64_t half = ((uint64_t) 1) << 63;
+      double dt = Frequency();
+      uint64_t phase = phase_;
+      int i;
+
+      for (i = 0; i < n; i++) {
+            // Subida en la fase -1/4 (t = 0) y bajada en la fase 1/4 (t = 1/2)
+            uint64_t rise = phase + quarter;
+            double t = ((double) (rise >> 11)) * kTurnsPerUnit53;
+            double t_fall = ((double) ((rise + half) >> 11)) * kTurnsPerUnit53;
+            double naive = (t < 0.5) ? 1.0 : -1.0;
+            out[i] = amplitude * (naive + PolyBlep(t, dt) - PolyBlep(t_fall, dt));
+            phase += increment_;
+      }
+
+      phase_ = phase;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
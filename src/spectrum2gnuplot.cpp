@@ -0,0 +1,144 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+/**
+ * Conversor de ficheros binarios de espectros (ver spectrum_file.h) a texto para gnuplot, octave, matlab, etc.
+ *
+ * Escribe en la salida estándar el mismo formato que ThdAnalyzer::GnuplotFileDump(): una fila por frecuencia, la
+ * primera columna es la frecuencia analógica y las demás el valor de cada canal. Con --all escribe todos los registros
+ * separados por dos líneas en blanco, que gnuplot interpreta como conjuntos de datos distintos (index).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <getopt.h>
+#include "spectrum_file.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// tabla de opciones para getopt_long
+struct option long_options[] = {
+      { "record",   required_argument, 0, 'r' },
+      { "all",      no_argument,       0, 'a' },
+      { "info",     no_argument,       0, 'i' },
+      { "help",     no_argument,       0, 'h' },
+      { 0,          0,                 0,  0  }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Usage();
+void PrintRecord(const SpectrumFileReader& reader, int64_t record);
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv) {
+
+      int64_t record = -1;  // -1 = el último
+      bool all = false;
+      bool info = false;
+
+      while (1) {
+
+            int c;
+            int option_index = 0;
+
+            c = getopt_long(argc, argv, "r:aih", long_options, &option_index);
+            if (c == -1) {
+                  break;
+            }
+
+            switch (c) {
+            case 'h':
+                  Usage();
+                  exit(0);
+                  break;
+            case 'r':
+                  record = strtoll(optarg, NULL, 0);
+                  break;
+            case 'a':
+                  all = true;
+                  break;
+            case 'i':
+                  info = true;
+                  break;
+            case '?':
+                  // getopt_long already printed an error message
+                  exit(1);
+                  break;
+            }
+      }
+
+      if (optind >= argc) {
+            Usage();
+            return 1;
+      }
+
+      SpectrumFileReader reader;
+      if (reader.Open(argv[optind]) != 0) {
+            fprintf(stderr, "Error: %s: %s\n", argv[optind], reader.ErrorDescription().c_str());
+            return 1;
+      }
+
+      const SpectrumFileHeader& h = reader.Header();
+
+      if (info == true) {
+            printf("Fs=%u Hz, N=%u, channels=%u, resolution=%.4f Hz, records=%lld\n", h.sample_rate, h.fft_size,
+                   h.channel_count, h.resolution, (long long) reader.RecordCount());
+            if (reader.RecordCount() > 0) {
+                  printf("blocks %lld to %lld\n", (long long) reader.Block(0),
+                         (long long) reader.Block(reader.RecordCount() - 1));
+            }
+            return 0;
+      }
+
+      if (reader.RecordCount() == 0) {
+            fprintf(stderr, "Error: %s has no records\n", argv[optind]);
+            return 1;
+      }
+
+      if (all == true) {
+            int64_t i;
+            for (i = 0; i < reader.RecordCount(); i++) {
+                  printf("# block %lld\n", (long long) reader.Block(i));
+                  PrintRecord(reader, i);
+                  printf("\n\n");
+            }
+            return 0;
+      }
+
+      if (record < 0) {
+            record = reader.RecordCount() - 1;
+      }
+      if (record >= reader.RecordCount()) {
+            fprintf(stderr, "Error: record %lld out of range (%lld records)\n", (long long) record,
+                    (long long) reader.RecordCount());
+            return 1;
+      }
+
+      PrintRecord(reader, record);
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void PrintRecord(const SpectrumFileReader& reader, int64_t record) {
+      const SpectrumFileHeader& h = reader.Header();
+
+      uint32_t i;
+      uint32_t c;
+      for (i = 0; i < h.bins; i++) {
+            // Columna 1 - Frecuencia analógica
+            printf("%09.2f ", i * h.resolution);
+            for (c = 0; c < h.channel_count; c++) {
+                  printf("%010.8f ", reader.Data(record, c)[i]);
+            }
+            printf("\n");
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Usage() {
+      printf("Usage: ./spectrum2gnuplot [--record N | --all | --info] <spectrum-file>\n");
+      printf("Defaults to the last record\n");
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
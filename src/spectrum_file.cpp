@@ -0,0 +1,379 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include "spectrum_file.h"
+#include "trace.h"
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace thd_analyzer;
+
+static const char kMagic[8] = { 'T', 'H', 'D', 'S', 'P', 'E', 'C', '\0' };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumFileWriter::SpectrumFileWriter(int queue_length) {
+      assert(queue_length > 0);
+
+      fd_ = NULL;
+      error_description_ = "no error";
+      write_errno_ = 0;
+      channel_count_ = 0;
+      bins_ = 0;
+      record_size_ = 0;
+      queue_length_ = queue_length;
+      queue_ = NULL;
+      head_ = 0;
+      tail_ = 0;
+      count_ = 0;
+      closing_ = false;
+      open_ = false;
+      record_count_ = 0;
+      dropped_count_ = 0;
+
+      memset(&thread_, 0, sizeof(pthread_t));
+      pthread_mutex_init(&lock_, NULL);
+      pthread_cond_init(&not_empty_, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumFileWriter::~SpectrumFileWriter() {
+      Close();
+      delete[] queue_;
+      pthread_cond_destroy(&not_empty_);
+      pthread_mutex_destroy(&lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumFileWriter::Open(const std::string& file_name, int sample_rate, int fft_size, int channel_count) {
+      assert(open_ == false);
+
+      channel_count_ = channel_count;
+      bins_ = fft_size / 2;
+      record_size_ = sizeof(SpectrumFileRecord) + (size_t) channel_count_ * bins_ * sizeof(float);
+
+      SpectrumFileHeader h;
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, kMagic, sizeof(kMagic));
+      h.version = kSpectrumFileVersion;
+      h.header_size = sizeof(SpectrumFileHeader);
+      h.record_size = (uint32_t) record_size_;
+      h.sample_rate = sample_rate;
+      h.fft_size = fft_size;
+      h.bins = bins_;
+      h.channel_count = channel_count_;
+      h.scaling = kSpectrumFileScalingPower;
+      h.resolution = (double) sample_rate / (double) fft_size;
+
+      fd_ = fopen(file_name.c_str(), "wb");
+      if (fd_ == NULL) {
+            error_description_ = strerror(errno);
+            return 1;
+      }
+
+      // Sin búfer de stdio: el hilo de escritura ya junta los registros pendientes en un solo fwrite() y así lo que
+      // devuelve es lo que ha llegado al fichero, sin fallos que aparezcan después al vaciar el búfer.
+      setvbuf(fd_, NULL, _IONBF, 0);
+      if (fwrite(&h, sizeof(h), 1, fd_) != 1) {
+            error_description_ = strerror(errno);
+            fclose(fd_);
+            fd_ = NULL;
+            return 1;
+      }
+
+      delete[] queue_;
+      queue_ = new uint8_t[queue_length_ * record_size_];
+      head_ = 0;
+      tail_ = 0;
+      count_ = 0;
+      closing_ = false;
+      record_count_ = 0;
+      dropped_count_ = 0;
+      write_errno_ = 0;
+
+      if (pthread_create(&thread_, NULL, SpectrumFileWriter::ThreadFuncHelper, this) != 0) {
+            error_description_ = "cannot create writer thread";
+            fclose(fd_);
+            fd_ = NULL;
+            return 1;
+      }
+
+      open_ = true;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumFileWriter::Write(int64_t block, uint64_t timestamp_us, const double* const* psd) {
+      assert(open_ == true);
+
+      // Solo hay un productor, así que el hueco en head_ sigue libre después de soltar el bloqueo. El registro se
+      // rellena fuera del bloqueo para no retener al hilo de escritura.
+      int slot;
+
+      pthread_mutex_lock(&lock_);
+      if (count_ == queue_length_) {
+            dropped_count_++;
+            pthread_mutex_unlock(&lock_);
+            return 1;
+      }
+      slot = head_;
+      pthread_mutex_unlock(&lock_);
+
+      uint8_t* p = queue_ + slot * record_size_;
+      SpectrumFileRecord* r = (SpectrumFileRecord*) p;
+      r->block = block;
+      r->timestamp_us = timestamp_us;
+
+      float* data = (float*) (p + sizeof(SpectrumFileRecord));
+      int c;
+      int k;
+      for (c = 0; c < channel_count_; c++) {
+            const double* x = psd[c];
+            for (k = 0; k < bins_; k++) {
+                  data[k] = (float) x[k];
+            }
+            data += bins_;
+      }
+
+      pthread_mutex_lock(&lock_);
+      head_ = (head_ + 1) % queue_length_;
+      count_++;
+      pthread_cond_signal(&not_empty_);
+      pthread_mutex_unlock(&lock_);
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumFileWriter::Close() {
+      if (open_ == false) {
+            return 0;
+      }
+
+      pthread_mutex_lock(&lock_);
+      closing_ = true;
+      pthread_cond_signal(&not_empty_);
+      pthread_mutex_unlock(&lock_);
+
+      pthread_join(thread_, NULL);
+
+      // Si ha fallado alguna escritura el último registro puede estar a medias, se recorta el fichero al último
+      // completo.
+      int r = 0;
+      if (write_errno_ != 0) {
+            error_description_ = strerror(write_errno_);
+            write_errno_ = 0;
+            r = 1;
+            if (ftruncate(fileno(fd_), sizeof(SpectrumFileHeader) + record_count_ * record_size_) != 0) {
+                  error_description_ += std::string(", ") + strerror(errno);
+            }
+      }
+      if (fclose(fd_) != 0) {
+            error_description_ = strerror(errno);
+            r = 1;
+      }
+      fd_ = NULL;
+      open_ = false;
+      return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int64_t SpectrumFileWriter::RecordCount() {
+      int64_t n;
+      pthread_mutex_lock(&lock_);
+      n = record_count_;
+      pthread_mutex_unlock(&lock_);
+      return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int64_t SpectrumFileWriter::DroppedCount() {
+      int64_t n;
+      pthread_mutex_lock(&lock_);
+      n = dropped_count_;
+      pthread_mutex_unlock(&lock_);
+      return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const std::string& SpectrumFileWriter::ErrorDescription() {
+      pthread_mutex_lock(&lock_);
+      if (write_errno_ != 0) {
+            error_description_ = strerror(write_errno_);
+            write_errno_ = 0;
+      }
+      pthread_mutex_unlock(&lock_);
+      return error_description_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void* SpectrumFileWriter::ThreadFuncHelper(void* p) {
+      SpectrumFileWriter* o = (SpectrumFileWriter*) p;
+      return o->ThreadFunc();
+}
+
+void* SpectrumFileWriter::ThreadFunc() {
+
+      SetTraceThreadName("spectrum writer");
+
+      while (1) {
+
+            pthread_mutex_lock(&lock_);
+            while (count_ == 0 && closing_ == false) {
+                  pthread_cond_wait(&not_empty_, &lock_);
+            }
+            if (count_ == 0 && closing_ == true) {
+                  pthread_mutex_unlock(&lock_);
+                  break;
+            }
+
+            // Registros consecutivos en la cola, hasta el final del búfer circular
+            int first = tail_;
+            int n = count_;
+            if (first + n > queue_length_) {
+                  n = queue_length_ - first;
+            }
+            pthread_mutex_unlock(&lock_);
+
+            // Una sola llamada a fwrite() para todos los registros pendientes
+            size_t written;
+            int error = 0;
+            {
+                  TraceSpan span("write");
+                  written = fwrite(queue_ + first * record_size_, record_size_, n, fd_);
+                  if ((int) written != n) {
+                        error = errno;
+                  }
+            }
+
+            // Los registros que no se han podido escribir se cuentan como descartados.
+            pthread_mutex_lock(&lock_);
+            tail_ = (tail_ + n) % queue_length_;
+            count_ -= n;
+            record_count_ += written;
+            dropped_count_ += n - (int) written;
+            if (error != 0) {
+                  write_errno_ = error;
+            }
+            pthread_mutex_unlock(&lock_);
+      }
+
+      if (fflush(fd_) != 0) {
+            pthread_mutex_lock(&lock_);
+            write_errno_ = errno;
+            pthread_mutex_unlock(&lock_);
+      }
+      return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumFileReader::SpectrumFileReader() {
+      fd_ = -1;
+      map_ = NULL;
+      map_size_ = 0;
+      header_ = NULL;
+      record_count_ = 0;
+      error_description_ = "no error";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumFileReader::~SpectrumFileReader() {
+      Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumFileReader::Open(const std::string& file_name) {
+      Close();
+
+      file_name_ = file_name;
+      fd_ = open(file_name.c_str(), O_RDONLY);
+      if (fd_ < 0) {
+            error_description_ = strerror(errno);
+            return 1;
+      }
+
+      if (Refresh() != 0) {
+            Close();
+            return 1;
+      }
+
+      if (memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 || header_->version != kSpectrumFileVersion ||
+          header_->header_size < sizeof(SpectrumFileHeader) || header_->record_size == 0) {
+            error_description_ = "not a spectrum file";
+            Close();
+            return 1;
+      }
+
+      record_count_ = (map_size_ - header_->header_size) / header_->record_size;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumFileReader::Refresh() {
+      assert(fd_ >= 0);
+
+      struct stat st;
+      if (fstat(fd_, &st) != 0) {
+            error_description_ = strerror(errno);
+            return 1;
+      }
+      if ((size_t) st.st_size < sizeof(SpectrumFileHeader)) {
+            error_description_ = "file too short";
+            return 1;
+      }
+      if ((size_t) st.st_size == map_size_) {
+            return 0;
+      }
+
+      if (map_ != NULL) {
+            munmap(map_, map_size_);
+            map_ = NULL;
+      }
+
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+      if (p == MAP_FAILED) {
+            error_description_ = strerror(errno);
+            map_size_ = 0;
+            header_ = NULL;
+            return 1;
+      }
+
+      map_ = (uint8_t*) p;
+      map_size_ = st.st_size;
+      header_ = (const SpectrumFileHeader*) map_;
+      if (header_->record_size != 0 && map_size_ >= header_->header_size) {
+            record_count_ = (map_size_ - header_->header_size) / header_->record_size;
+      }
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SpectrumFileReader::Close() {
+      if (map_ != NULL) {
+            munmap(map_, map_size_);
+      }
+      if (fd_ >= 0) {
+            close(fd_);
+      }
+      fd_ = -1;
+      map_ = NULL;
+      map_size_ = 0;
+      header_ = NULL;
+      record_count_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const float* SpectrumFileReader::Data(int64_t record, int channel) const {
+      assert(channel < (int) header_->channel_count);
+      const uint8_t* p = (const uint8_t*) Record(record) + sizeof(SpectrumFileRecord);
+      return (const float*) p + (size_t) channel * header_->bins;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const SpectrumFileRecord* SpectrumFileReader::Record(int64_t record) const {
+      assert(record >= 0 && record < record_count_);
+      return (const SpectrumFileRecord*) (map_ + header_->header_size + record * header_->record_size);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,229 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include "spectrum_history.h"
+#include "dsp_kernels.h"
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <climits>
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumHistory::SpectrumHistory(int capacity, int bins, Encoding encoding, double min_db, double max_db) {
+      assert(capacity > 0);
+      assert(bins > 0);
+      assert(max_db > min_db);
+
+      capacity_ = capacity;
+      bins_ = bins;
+      encoding_ = encoding;
+      min_db_ = min_db;
+      max_db_ = max_db;
+      max_code_ = (encoding_ == kEncodingU8) ? 255 : 65535;
+      step_ = (max_db_ - min_db_) / max_code_;
+
+      data8_ = NULL;
+      data16_ = NULL;
+      if (encoding_ == kEncodingU8) {
+            data8_ = new uint8_t[(size_t) capacity_ * bins_];
+      } else {
+            data16_ = new uint16_t[(size_t) capacity_ * bins_];
+      }
+
+      block_ = new int[capacity_];
+      timestamp_ = new uint64_t[capacity_];
+      scratch_ = new uint16_t[bins_];
+
+      head_ = 0;
+      size_ = 0;
+
+      pthread_mutex_init(&lock_, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumHistory::~SpectrumHistory() {
+      delete[] data8_;
+      delete[] data16_;
+      delete[] block_;
+      delete[] timestamp_;
+      delete[] scratch_;
+      pthread_mutex_destroy(&lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SpectrumHistory::Append(int block, uint64_t timestamp_us, const double* psd) {
+
+      // Cuantificación fuera del bloqueo, los lectores solo esperan a la copia de la fila.
+      QuantizeDecibels(psd, bins_, min_db_, step_, max_code_, scratch_);
+      int k;
+
+      pthread_mutex_lock(&lock_);
+
+      size_t offset = (size_t) head_ * bins_;
+      if (encoding_ == kEncodingU8) {
+            for (k = 0; k < bins_; k++) {
+                  data8_[offset + k] = (uint8_t) scratch_[k];
+            }
+      } else {
+            memcpy(data16_ + offset, scratch_, bins_ * sizeof(uint16_t));
+      }
+      block_[head_] = block;
+      timestamp_[head_] = timestamp_us;
+
+      head_ = (head_ + 1) % capacity_;
+      if (size_ < capacity_) {
+            size_++;
+      }
+
+      pthread_mutex_unlock(&lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::Size() {
+      int n;
+      pthread_mutex_lock(&lock_);
+      n = size_;
+      pthread_mutex_unlock(&lock_);
+      return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::OldestBlock() {
+      int b = -1;
+      pthread_mutex_lock(&lock_);
+      if (size_ > 0) {
+            b = block_[Row(0)];
+      }
+      pthread_mutex_unlock(&lock_);
+      return b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::NewestBlock() {
+      int b = -1;
+      pthread_mutex_lock(&lock_);
+      if (size_ > 0) {
+            b = block_[Row(size_ - 1)];
+      }
+      pthread_mutex_unlock(&lock_);
+      return b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::FindBlock(uint64_t timestamp_us) {
+
+      int b = -1;
+
+      pthread_mutex_lock(&lock_);
+
+      // Búsqueda binaria, los instantes son crecientes
+      int lo = 0;
+      int hi = size_;
+      while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (timestamp_[Row(mid)] < timestamp_us) {
+                  lo = mid + 1;
+            } else {
+                  hi = mid;
+            }
+      }
+      if (lo < size_) {
+            b = block_[Row(lo)];
+      }
+
+      pthread_mutex_unlock(&lock_);
+      return b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::Read(int first_block, int last_block, std::vector<double>* decibels, std::vector<int>* blocks,
+                          std::vector<uint64_t>* timestamps) {
+      assert(decibels != NULL);
+
+      std::vector<uint16_t> codes;
+      int rows = ReadRaw(first_block, last_block, &codes, blocks, timestamps);
+
+      decibels->resize(codes.size());
+      size_t i;
+      for (i = 0; i < codes.size(); i++) {
+            (*decibels)[i] = min_db_ + codes[i] * step_;
+      }
+
+      return rows;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::ReadRaw(int first_block, int last_block, std::vector<uint16_t>* codes, std::vector<int>* blocks,
+                             std::vector<uint64_t>* timestamps) {
+      assert(codes != NULL);
+
+      int rows;
+
+      pthread_mutex_lock(&lock_);
+      rows = Collect(first_block, last_block, codes, blocks, timestamps);
+      pthread_mutex_unlock(&lock_);
+
+      return rows;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::Collect(int first_block, int last_block, std::vector<uint16_t>* codes, std::vector<int>* blocks,
+                             std::vector<uint64_t>* timestamps) {
+      // Con lock_ adquirido
+      int i1 = FindRow(first_block);
+      int i2 = (last_block == INT_MAX) ? size_ : FindRow(last_block + 1);
+      int rows = i2 - i1;
+      if (rows < 0) {
+            rows = 0;
+      }
+
+      codes->resize((size_t) rows * bins_);
+      if (blocks != NULL) {
+            blocks->resize(rows);
+      }
+      if (timestamps != NULL) {
+            timestamps->resize(rows);
+      }
+
+      int i;
+      int k;
+      for (i = 0; i < rows; i++) {
+            int r = Row(i1 + i);
+            size_t offset = (size_t) r * bins_;
+            uint16_t* dst = &(*codes)[(size_t) i * bins_];
+
+            if (encoding_ == kEncodingU8) {
+                  for (k = 0; k < bins_; k++) {
+                        dst[k] = data8_[offset + k];
+                  }
+            } else {
+                  memcpy(dst, data16_ + offset, bins_ * sizeof(uint16_t));
+            }
+
+            if (blocks != NULL) {
+                  (*blocks)[i] = block_[r];
+            }
+            if (timestamps != NULL) {
+                  (*timestamps)[i] = timestamp_[r];
+            }
+      }
+
+      return rows;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SpectrumHistory::FindRow(int block) {
+      // Con lock_ adquirido. Posición (0 = la más antigua) de la primera fila con número de bloque >= |block|.
+      int lo = 0;
+      int hi = size_;
+      while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (block_[Row(mid)] < block) {
+                  lo = mid + 1;
+            } else {
+                  hi = mid;
+            }
+      }
+      return lo;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,15 +1,20 @@
 // Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
 #include "spectrum_mask.h"
+#include "buffer_arena.h"
 #include <cmath>
+#include <cstring>
 
 using namespace thd_analyzer;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-SpectrumMask::SpectrumMask(int sampling_rate, int fft_size) {
+SpectrumMask::SpectrumMask(int sampling_rate, int fft_size, const std::string& name) {
 
+      this->name = name;
       fs   = sampling_rate;
       size = fft_size;
-      value = new double[size];
+      vertical_offset = 0.0;
+      value = AllocateAlignedDoubles(size);
+      limit = AllocateAlignedDoubles(size);
 
       Reset(0);
 
@@ -20,9 +25,59 @@ SpectrumMask::SpectrumMask(int sampling_rate, int fft_size) {
       last_trespassing_value = nan("");
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask::SpectrumMask(const SpectrumMask& other) {
+
+      name = other.name;
+      fs   = other.fs;
+      size = other.size;
+      vertical_offset = other.vertical_offset;
+      value = AllocateAlignedDoubles(size);
+      limit = AllocateAlignedDoubles(size);
+      memcpy(value, other.value, size * sizeof(double));
+      memcpy(limit, other.limit, size * sizeof(double));
+
+      // Los contadores no se copian, los escribe el hilo de procesado en la máscara original mientras se copia.
+      error_count = 0;
+      first_trespassing_frequency = nan("");
+      first_trespassing_value = nan("");
+      last_trespassing_frequency = nan("");
+      last_trespassing_value = nan("");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask::SpectrumMask(const SpectrumMask& other, int sampling_rate, int fft_size) {
+
+      name = other.name;
+      fs   = sampling_rate;
+      size = fft_size;
+      vertical_offset = other.vertical_offset;
+      value = AllocateAlignedDoubles(size);
+      limit = AllocateAlignedDoubles(size);
+
+      // Punto de |other| a la misma frecuencia: i * fs / size = j * other.fs / other.size
+      double scale = ((double) fs * other.size) / ((double) size * other.fs);
+      int i;
+      for (i = 0; i < size; i++) {
+            int j = (int) floor(i * scale + 0.5);
+            if (j > other.size - 1) {
+                  j = other.size - 1;
+            }
+            value[i] = other.value[j];
+            limit[i] = other.limit[j];
+      }
+
+      error_count = 0;
+      first_trespassing_frequency = nan("");
+      first_trespassing_value = nan("");
+      last_trespassing_frequency = nan("");
+      last_trespassing_value = nan("");
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 SpectrumMask::~SpectrumMask() {
-      delete[] value;
+      FreeAligned(value);
+      FreeAligned(limit);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -32,19 +87,69 @@ void SpectrumMask::SetBandAttenuation(double f1, double f2, double attenuation)
       double analog_resolution = (double) fs / (double) size; 
       int d1 = (int) floor(f1 / analog_resolution);
       int d2 = (int) ceil (f2 / analog_resolution);
+      if (d1 < 0) {
+            d1 = 0;
+      }
+      if (d2 > size - 1) {
+            d2 = size - 1;
+      }
+
+      double l = pow(10.0, -attenuation / 10.0);
       int i;
       for (i = d1; i <= d2; i++) {
             value[i] = -attenuation; // dB
+            limit[i] = l;
       }
       
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void SpectrumMask::Reset(double attenuation) {
+      double l = pow(10.0, -attenuation / 10.0);
       int i;
       for (i = 0; i < size; i++) {
             value[i] = -attenuation; // dB
+            limit[i] = l;
       }
       
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SpectrumMask::Evaluate(const double* psd, int k1, int k2, MaskReport* report) const {
+
+      // En lugar del exceso en dB de cada punto se guarda el cociente psd / limit máximo de cada intervalo y se pasa a
+      // dB al cerrarlo, así solo se calcula un logaritmo por intervalo y no uno por punto.
+      MaskViolation* v = NULL;
+      double worst = 0.0;
+
+      if (report->violations.empty() == false && report->violations.back().last_bin == k1 - 1) {
+            v = &report->violations.back();
+            worst = pow(10.0, v->max_excess / 10.0);
+      }
+
+      int k;
+      for (k = k1; k < k2; k++) {
+            if (psd[k] > limit[k]) {
+                  double ratio = psd[k] / limit[k];
+                  if (v == NULL) {
+                        report->violations.push_back(MaskViolation());
+                        v = &report->violations.back();
+                        v->first_bin = k;
+                        worst = ratio;
+                  } else if (ratio > worst) {
+                        worst = ratio;
+                  }
+                  v->last_bin = k;
+                  report->error_count++;
+
+            } else if (v != NULL) {
+                  v->max_excess = 10.0 * log10(worst);
+                  v = NULL;
+            }
+      }
+
+      if (v != NULL) {
+            v->max_excess = 10.0 * log10(worst);
+      }
+}
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,260 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cmath>
+#include <ctime>
+#include <climits>
+#include <cassert>
+#include "synthetic_capture_source.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SyntheticCaptureSource::SyntheticCaptureSource(int sampling_rate, int channel_count, uint32_t seed) {
+      assert(sampling_rate > 0);
+      assert(channel_count > 0);
+
+      sample_rate_ = sampling_rate;
+      channel_count_ = channel_count;
+      seed_ = seed;
+      clip_level_ = 1.0;
+      frame_limit_ = -1;
+      paced_ = false;
+      open_ = false;
+      position_ = 0;
+      start_ns_ = 0;
+      error_description_ = "no error";
+
+      channel_.resize(channel_count_);
+      for (int c = 0; c < channel_count_; c++) {
+            channel_[c].noise_rms = 0.0;
+            channel_[c].dc = 0.0;
+            channel_[c].glitch_period = 0;
+            channel_[c].glitch_length = 0;
+            channel_[c].glitch_value = 0.0;
+            channel_[c].rng = 0;
+            channel_[c].have_spare = false;
+            channel_[c].spare = 0.0;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SyntheticCaptureSource::Open() {
+
+      // Cada canal tiene su propia secuencia de ruido, que no depende de cuántos canales haya.
+      for (int c = 0; c < channel_count_; c++) {
+            uint64_t x = ((uint64_t) seed_ << 32) ^ (0x9E3779B97F4A7C15ULL * (uint64_t) (c + 1));
+            channel_[c].rng = (x != 0) ? x : 1;
+            channel_[c].have_spare = false;
+      }
+
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      start_ns_ = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+      position_ = 0;
+      open_ = true;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SyntheticCaptureSource::Reconfigure(int sample_rate, int /*period_frames*/) {
+      assert(sample_rate > 0);
+
+      if (sample_rate == sample_rate_) {
+            return 0;
+      }
+
+      // Como un ADC al que se le cambia la frecuencia: la señal sigue (con un salto de fase) y, con SetPaced(), el
+      // ritmo de entrega pasa a ser el nuevo desde el frame actual.
+      sample_rate_ = sample_rate;
+
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      start_ns_ = ts.tv_sec * 1000000000ULL + ts.tv_nsec - (uint64_t) ((double) position_ * 1e9 / sample_rate_);
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::AddTone(int channel, double frequency, double amplitude, double phase) {
+      assert(channel == kAllChannels || (channel >= 0 && channel < channel_count_));
+
+      Tone t;
+      t.frequency = frequency;
+      t.amplitude = amplitude;
+      t.phase = phase;
+
+      for (int c = 0; c < channel_count_; c++) {
+            if (channel == kAllChannels || channel == c) {
+                  channel_[c].tones.push_back(t);
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::AddHarmonics(int channel, double fundamental, double amplitude,
+                                          const std::vector<double>& harmonic_db) {
+      AddTone(channel, fundamental, amplitude);
+
+      size_t i;
+      for (i = 0; i < harmonic_db.size(); i++) {
+            double f = fundamental * (i + 2);
+            if (f >= sample_rate_ / 2.0) {
+                  break;
+            }
+            AddTone(channel, f, amplitude * pow(10.0, harmonic_db[i] / 20.0));
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::SetNoise(int channel, double rms) {
+      assert(channel == kAllChannels || (channel >= 0 && channel < channel_count_));
+
+      for (int c = 0; c < channel_count_; c++) {
+            if (channel == kAllChannels || channel == c) {
+                  channel_[c].noise_rms = rms;
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::SetDcOffset(int channel, double dc) {
+      assert(channel == kAllChannels || (channel >= 0 && channel < channel_count_));
+
+      for (int c = 0; c < channel_count_; c++) {
+            if (channel == kAllChannels || channel == c) {
+                  channel_[c].dc = dc;
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::SetClipLevel(double level) {
+      assert(level > 0.0);
+      clip_level_ = level;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void SyntheticCaptureSource::SetGlitches(int channel, int64_t period, int length, double value) {
+      assert(channel == kAllChannels || (channel >= 0 && channel < channel_count_));
+      assert(period >= 0 && length >= 0);
+
+      for (int c = 0; c < channel_count_; c++) {
+            if (channel == kAllChannels || channel == c) {
+                  channel_[c].glitch_period = period;
+                  channel_[c].glitch_length = length;
+                  channel_[c].glitch_value = value;
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double SyntheticCaptureSource::Gaussian(ChannelSignal* s) {
+
+      // Box-Muller, genera dos muestras de cada vez
+      if (s->have_spare == true) {
+            s->have_spare = false;
+            return s->spare;
+      }
+
+      double u[2];
+      for (int j = 0; j < 2; j++) {
+            // xorshift64*
+            s->rng ^= s->rng >> 12;
+            s->rng ^= s->rng << 25;
+            s->rng ^= s->rng >> 27;
+            uint64_t x = s->rng * 0x2545F4914F6CDD1DULL;
+
+            // Uniforme en (0, 1]
+            u[j] = ((x >> 11) + 1) * (1.0 / 9007199254740992.0);
+      }
+
+      double r = sqrt(-2.0 * log(u[0]));
+      s->spare = r * sin(2.0 * M_PI * u[1]);
+      s->have_spare = true;
+      return r * cos(2.0 * M_PI * u[1]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int SyntheticCaptureSource::Read(int32_t* buffer, int frames) {
+      assert(open_ == true);
+
+      if (frame_limit_ >= 0 && position_ + frames > frame_limit_) {
+            frames = (int) (frame_limit_ - position_);
+      }
+
+      if (paced_ == true) {
+            // Espera hasta el instante en que un ADC tendría la última muestra del bloque
+            uint64_t t = start_ns_ + (uint64_t) ((double) (position_ + frames) * 1e9 / sample_rate_);
+            struct timespec ts;
+            ts.tv_sec = t / 1000000000ULL;
+            ts.tv_nsec = t % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      }
+
+      scratch_.resize(frames);
+      double* x = frames > 0 ? &scratch_[0] : NULL;
+
+      int c;
+      int i;
+      size_t t;
+
+      for (c = 0; c < channel_count_; c++) {
+            ChannelSignal* s = &channel_[c];
+
+            for (i = 0; i < frames; i++) {
+                  x[i] = s->dc;
+            }
+
+            for (t = 0; t < s->tones.size(); t++) {
+                  const Tone& tone = s->tones[t];
+                  double w = 2.0 * M_PI * tone.frequency / sample_rate_;
+
+                  // Fase al principio del bloque calculada a partir del número de frame, sin acumular errores de
+                  // redondeo de un bloque a otro.
+                  double cycles = tone.frequency * (double) position_ / sample_rate_;
+                  double phase = 2.0 * M_PI * (cycles - floor(cycles)) + tone.phase;
+                  for (i = 0; i < frames; i++) {
+                        x[i] += tone.amplitude * cos(w * i + phase);
+                  }
+            }
+
+            if (s->noise_rms > 0.0) {
+                  for (i = 0; i < frames; i++) {
+                        x[i] += s->noise_rms * Gaussian(s);
+                  }
+            }
+
+            // Recorte
+            for (i = 0; i < frames; i++) {
+                  if (x[i] > clip_level_) {
+                        x[i] = clip_level_;
+                  } else if (x[i] < -clip_level_) {
+                        x[i] = -clip_level_;
+                  }
+            }
+
+            if (s->glitch_period > 0) {
+                  for (i = 0; i < frames; i++) {
+                        if ((position_ + i) % s->glitch_period < s->glitch_length) {
+                              x[i] = s->glitch_value;
+                        }
+                  }
+            }
+
+            // Conversión a S32 con saturación, como un ADC
+            int32_t* y = buffer + c;
+            for (i = 0; i < frames; i++) {
+                  double v = x[i] * 2147483648.0;
+                  if (v >= 2147483647.0) {
+                        y[i * channel_count_] = INT_MAX;
+                  } else if (v <= -2147483648.0) {
+                        y[i * channel_count_] = INT_MIN;
+                  } else {
+                        y[i * channel_count_] = (int32_t) lrint(v);
+                  }
+            }
+      }
+
+      position_ += frames;
+      return frames;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -10,8 +10,14 @@
 #include <cassert>
 #include <cstdlib>
 #include <string>
+#include <vector>
+#include <sched.h>
 #include <getopt.h>
+#include <unistd.h>
 #include "thd_analyzer.h"
+#include "file_capture_source.h"
+#include "synthetic_capture_source.h"
+#include "trace.h"
 
 using namespace thd_analyzer;
 
@@ -20,16 +26,34 @@ using namespace thd_analyzer;
 // tabla de opciones para getopt_long
 struct option long_options[] = {
       { "device",   required_argument, 0, 'd' },
+      { "wav",      required_argument, 0, 'w' },
+      { "synthetic",no_argument,       0, 's' },
+      { "trace",    required_argument, 0, 't' },
+      { "realtime", required_argument, 0, 'r' },
+      { "cpu",      required_argument, 0, 'c' },
+      { "mlock",    no_argument,       0, 'm' },
+      { "hugepages",no_argument,       0, 'H' },
+      { "decimate", required_argument, 0, 'D' },
       { "help",     no_argument,       0, 'h' },   
       { 0,          0,                 0,  0  }
 };
 
 std::string device_;
+std::string wav_file_;
+bool synthetic_ = false;
+std::string trace_file_;
+int realtime_priority_ = 0;
+std::vector<int> cpus_;
+bool mlock_ = false;
+bool huge_pages_ = false;
+int decimation_ = 1;
 ThdAnalyzer* analyzer = NULL;
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void MilliSleep(int milliseconds);
+void PrintStats(ThdAnalyzer* analyzer);
+void WriteTrace();
 void Usage();
 
 
@@ -46,7 +70,7 @@ int main(int argc, char** argv) {
             int c;
             int option_index = 0;
             
-            c = getopt_long(argc, argv, "dh", long_options, &option_index);
+            c = getopt_long(argc, argv, "d:w:st:r:c:mHD:h", long_options, &option_index);
             if (c == -1) {
                   break;
             }
@@ -59,6 +83,30 @@ int main(int argc, char** argv) {
             case 'd':
                   device_ = std::string(optarg);
                   break;
+            case 'w':
+                  wav_file_ = std::string(optarg);
+                  break;
+            case 's':
+                  synthetic_ = true;
+                  break;
+            case 't':
+                  trace_file_ = std::string(optarg);
+                  break;
+            case 'r':
+                  realtime_priority_ = atoi(optarg);
+                  break;
+            case 'c':
+                  cpus_.push_back(atoi(optarg));
+                  break;
+            case 'm':
+                  mlock_ = true;
+                  break;
+            case 'H':
+                  huge_pages_ = true;
+                  break;
+            case 'D':
+                  decimation_ = atoi(optarg);
+                  break;
             case '?':
                   // getopt_long already printed an error message
                   exit(1);
@@ -67,8 +115,37 @@ int main(int argc, char** argv) {
       }
 
 
-      printf("Using device %s\n", device_.c_str());
-      
+      // Con --trace se registran las etapas de todos los hilos y se vuelcan junto con las estadísticas.
+      if (trace_file_.empty() == false) {
+            SetTraceThreadName("main");
+            EnableTracing();
+      }
+
+      // Análisis de un fichero grabado o de una señal sintética, sin tarjeta de sonido. Va tan rápido como permita
+      // la CPU.
+      CaptureSource* source = NULL;
+      if (synthetic_ == true) {
+            // 1 kHz con el segundo y tercer armónico a -60 y -70 dB y ruido a -100 dB, 10 segundos
+            printf("Using synthetic signal\n");
+            SyntheticCaptureSource* synthetic = new SyntheticCaptureSource(48000, 2);
+            std::vector<double> harmonics;
+            harmonics.push_back(-60.0);
+            harmonics.push_back(-70.0);
+            synthetic->AddHarmonics(SyntheticCaptureSource::kAllChannels, 1000.0, 0.5, harmonics);
+            synthetic->SetNoise(SyntheticCaptureSource::kAllChannels, 1e-5);
+            synthetic->SetFrameLimit(10 * 48000);
+            synthetic->Open();
+            source = synthetic;
+      } else if (wav_file_.empty() == false) {
+            printf("Using file %s\n", wav_file_.c_str());
+            source = new WavFileCaptureSource(wav_file_);
+            if (source->Open() != 0) {
+                  printf("Error: %s: %s\n", wav_file_.c_str(), source->ErrorDescription().c_str());
+                  return 1;
+            }
+      } else {
+            printf("Using device %s\n", device_.c_str());
+      }
 
       // Curioso: en mi PC, son sistema de audio IDT 92HD81, al usar
       // la llamada snd_pcm_hw_params_set_rate_min() si pongo la Fs
@@ -77,36 +154,67 @@ int main(int argc, char** argv) {
       // configura a 48000.  Si queremos 44100 hay que poner una
       // cantidad ligeramente inferior, por ejemplo 44099
 
-      analyzer = new ThdAnalyzer(device_.c_str(), 44099, 12);  // 44,1 kHz, FFT-8192
+      if (source != NULL) {
+            analyzer = new ThdAnalyzer(source, 12);
+      } else {
+            analyzer = new ThdAnalyzer(device_.c_str(), 44099, 12);  // 44,1 kHz, FFT-8192
+      }
       //analyzer = new ThdAnalyzer(device_.c_str(), 47999, 12);    // 48   kHz, FFT-8192
       //analyzer = new ThdAnalyzer(device_.c_str(), 191999, 12); // 192  kHz, FFT-8192
 
+      // Hilo de procesado en tiempo real y sin fallos de página, contra los overruns en máquinas cargadas.
+      if (realtime_priority_ > 0 && analyzer->SetRealTimeScheduling(SCHED_FIFO, realtime_priority_) != 0) {
+            printf("Error: --realtime: %s\n", analyzer->ErrorDescription().c_str());
+            return 1;
+      }
+      if (cpus_.empty() == false && analyzer->SetCpuAffinity(cpus_) != 0) {
+            printf("Error: --cpu: %s\n", analyzer->ErrorDescription().c_str());
+            return 1;
+      }
+      analyzer->SetMemoryLocking(mlock_);
+      analyzer->SetHugePages(huge_pages_);
+
+      // Más resolución en la parte baja del espectro
+      if (analyzer->SetDecimation(decimation_) != 0) {
+            printf("Error: --decimate: %s\n", analyzer->ErrorDescription().c_str());
+            return 1;
+      }
+
       if (analyzer->Init() != 0) {
-            printf("Error: During ALSA device initialization.\n");
+            printf("Error: During analyzer initialization: %s\n", analyzer->ErrorDescription().c_str());
             return 1;
       } 
 
       printf("Actual sampling rate is %d\n", analyzer->SamplingFrequency());
-      
-      analyzer->Start();
 
       int fbin;
       
       const thd_analyzer::SpectrumMask* mask;
       int c;
 
-      for (c = 0; c < 2; c++) {
-            analyzer->Mask(c)->Reset(20.0);
-            analyzer->Mask(c)->SetBandAttenuation(0000.0, 00100.0, 15.0);
-            analyzer->Mask(c)->SetBandAttenuation(0430.0, 00450.0, -5.0);
+      // Las máscaras se preparan en una copia de la configuración y se entregan de una vez, el analizador las empieza
+      // a usar en el siguiente bloque sin detener la captura.
+      AnalyzerConfig* config = analyzer->Configuration();
+      for (c = 0; c < analyzer->ChannelCount(); c++) {
+            config->Mask(c, "default")->Reset(20.0);
+            config->Mask(c, "default")->SetBandAttenuation(0000.0, 00100.0, 15.0);
+            config->Mask(c, "default")->SetBandAttenuation(0430.0, 00450.0, -5.0);
+
+            // Segunda línea límite, más estricta, evaluada en la misma pasada que la anterior.
+            SpectrumMask* warning = config->AddMask(c, "warning");
+            warning->Reset(30.0);
+            warning->SetBandAttenuation(0430.0, 00450.0, 0.0);
       }
+      analyzer->SetConfiguration(config);
+
+      analyzer->Start();
 
       int count = 0;
       printf("\n");
 
       while (1) {
 
-            for (c = 0; c < 2; c++) {
+            for (c = 0; c < analyzer->ChannelCount(); c++) {
                   fbin = analyzer->FindPeak(c);
                   mask = analyzer->Mask(c);                  
 
@@ -127,14 +235,31 @@ int main(int argc, char** argv) {
 */
             }
 
+            // Fin del fichero: se vuelca el espectro del último bloque y se termina.
+            if (analyzer->State() == ThdAnalyzer::kFinished) {
+                  printf("%d blocks analyzed\n", analyzer->BlockCount());
+                  for (c = 0; c < analyzer->ChannelCount(); c++) {
+                        printf("CH%d peak %.4f Hz amplitude %.6f\n", c, analyzer->PeakFrequency(c),
+                               analyzer->PeakAmplitude(c));
+                        LevelStats level;
+                        analyzer->GetLevelStats(c, &level);
+                        printf("CH%d rms %.6f dc %.6f peak %.6f crest %.3f clipped %d\n", c, level.rms, level.dc,
+                               level.peak, level.crest_factor, level.clip_count);
+                  }
+                  PrintStats(analyzer);
+                  analyzer->GnuplotFileDump("dump.plot");
+                  WriteTrace();
+                  break;
+            }
+
             count++;            
             usleep(100000); // 0,05 segundos
             
+            // El volcado copia el espectro publicado, no hace falta parar el analizador.
             if ((count % 50) == 0) {
-                  analyzer->Stop();
-                  usleep(500000); // 0,5 segundos
                   analyzer->GnuplotFileDump("dump.plot");
-                  analyzer->Start();
+                  PrintStats(analyzer);
+                  WriteTrace();
             }
             
             // Retrocedo dos líneas y vuelvo a imprimir
@@ -145,6 +270,8 @@ int main(int argc, char** argv) {
 */
       }
 
+      delete analyzer;
+      delete source;
       return 0;
 }
 
@@ -158,9 +285,54 @@ void MilliSleep(int milliseconds) {
       nanosleep(&t0, NULL);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void PrintStats(ThdAnalyzer* analyzer) {
+
+      // Las estadísticas se ponen a cero en cada consulta, cada línea corresponde al intervalo desde la anterior.
+      AnalyzerStats stats;
+      analyzer->Stats(&stats, true);
+
+      printf("blocks=%lld overruns=%lld dropped=%lld\n", (long long) stats.block_count,
+             (long long) stats.overrun_count, (long long) stats.dropped_count);
+      for (int i = 0; i < AnalyzerStats::kStageCount; i++) {
+            const LatencyHistogram& h = stats.latency[i];
+            printf("  %-8s p50=%8.1f us p99=%8.1f us p99.9=%8.1f us max=%8.1f us\n", AnalyzerStats::StageName(i),
+                   h.Percentile(50.0) / 1000.0, h.Percentile(99.0) / 1000.0, h.Percentile(99.9) / 1000.0,
+                   h.Max() / 1000.0);
+      }
+
+      // Overruns desde la consulta anterior
+      std::vector<XrunRecord> xruns;
+      analyzer->GetXrunJournal(&xruns);
+      analyzer->ClearXrunJournal();
+      for (size_t i = 0; i < xruns.size(); i++) {
+            const XrunRecord& x = xruns[i];
+            printf("  xrun #%lld block=%lld t=%llu us lost=%lld frames delay=%lld frames previous process=%.1f us\n",
+                   (long long) x.sequence, (long long) x.block, (unsigned long long) x.timestamp_us,
+                   (long long) x.frames_lost, (long long) x.delay_frames, x.previous_process_ns / 1000.0);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WriteTrace() {
+
+      // Se abre con chrome://tracing o https://ui.perfetto.dev
+      if (trace_file_.empty() == true) {
+            return;
+      }
+
+      std::string error;
+      if (WriteChromeTrace(trace_file_, &error) != 0) {
+            printf("Error: %s: %s\n", trace_file_.c_str(), error.c_str());
+      }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void Usage() {
-      printf("Usage: ./test_thd_analyzer <alsa-capture-device-name>\n");
+      printf("Usage: ./test_thd_analyzer [--device <alsa-capture-device-name> | --wav <file.wav> | --synthetic]\n");
+      printf("                           [--trace <file.json>]\n");
+      printf("                           [--realtime <fifo-priority>] [--cpu <n>]... [--mlock] [--hugepages]\n");
+      printf("                           [--decimate <factor>]\n");
       printf("Defaults to L channel\n");
 }
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
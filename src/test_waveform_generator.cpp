@@ -17,6 +17,7 @@ struct option long_options[] = {
       { "device",    required_argument, 0, 'd' },
       { "frequency", required_argument, 0, 'f' },
       { "sweep",     no_argument,       0, 's' },
+      { "wave",      required_argument, 0, 'w' },
       { "help",      no_argument,       0, 'h' },   
       { 0,           0,                 0,  0  }
 };
@@ -25,6 +26,7 @@ std::string device_;
 WaveformGenerator* obj = NULL;
 int frequency = 440;
 bool sweep = false;
+WaveformGenerator::Waveform waveform = WaveformGenerator::kWaveformSine;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void Usage();
@@ -41,7 +43,7 @@ int main(int argc, char** argv) {
             int c;
             int option_index = 0;
             
-            c = getopt_long(argc, argv, "dfh", long_options, &option_index);
+            c = getopt_long(argc, argv, "d:f:sw:h", long_options, &option_index);
             if (c == -1) {
                   break;
             }
@@ -60,6 +62,18 @@ int main(int argc, char** argv) {
             case 'f':
                   frequency = strtoul(optarg, NULL, 0);
                   break;
+            case 'w':
+                  if (std::string(optarg) == "sine") {
+                        waveform = WaveformGenerator::kWaveformSine;
+                  } else if (std::string(optarg) == "saw") {
+                        waveform = WaveformGenerator::kWaveformSawTooth;
+                  } else if (std::string(optarg) == "square") {
+                        waveform = WaveformGenerator::kWaveformSquare;
+                  } else {
+                        printf("Error: Unknown waveform %s.\n", optarg);
+                        exit(1);
+                  }
+                  break;
             case '?':
                   // getopt_long already printed an error message
                   exit(1);
@@ -74,6 +88,7 @@ int main(int argc, char** argv) {
       } 
 
       printf("Playing a %d Hz tone on %s for 30 seconds...\n", frequency, device_.c_str());
+      obj->SetWaveType(waveform);
       obj->SetFrequency(frequency);
 
       int count = 30;
@@ -94,5 +109,6 @@ int main(int argc, char** argv) {
 void Usage() {
       printf("Usage: ./test_waveform_generator <alsa-playback-device-name>\n");
       printf("Defaults to L and R channels\n");
+      printf("  --wave <sine|saw|square>  Waveform, saw and square are band-limited (default sine)\n");
 }
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
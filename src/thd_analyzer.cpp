@@ -5,35 +5,86 @@
 #include <cmath>
 #include <limits>
 #include <cassert>
-#include <alsa/asoundlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "thd_analyzer.h"
+#include "alsa_capture_source.h"
 #include "fft.h"
-#include "stopwatch.h"
+#include "dsp_kernels.h"
+#include "trace.h"
 
 
 using namespace thd_analyzer;
 
+// Escribe en 64 kB de pila del hilo que llama, una vez por página, para que ya estén cargadas cuando las necesite.
+static void PrefaultStack() __attribute__((noinline));
+static void PrefaultStack() {
+      volatile char stack[64 * 1024];
+      for (size_t i = 0; i < sizeof(stack); i += 4096) {
+            stack[i] = 0;
+      }
+}
+
+// Reloj monotónico en nanosegundos, para medir las etapas del procesado.
+static uint64_t MonotonicNanoseconds() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ThdAnalyzer::ThdAnalyzer(const char* pcm_capture_device, int sampling_rate, int log2_block_size) {
 
+      // TODO: Hacer esto configurable. De momento no ha conseguido configurar este parámetro
+      channel_count_ = 2;
+      capture_rate_ = sampling_rate; //192000;
+      sample_rate_ = capture_rate_;
+
+      source_ = new AlsaCaptureSource(pcm_capture_device, capture_rate_, channel_count_, 1 << log2_block_size);
+      own_source_ = true;
+
+      Construct(log2_block_size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ThdAnalyzer::ThdAnalyzer(CaptureSource* source, int log2_block_size) {
+      assert(source != NULL);
+      assert(source->ChannelCount() > 0);
+
+      source_ = source;
+      own_source_ = false;
+      channel_count_ = source->ChannelCount();
+      capture_rate_ = source->SampleRate();
+      sample_rate_ = capture_rate_;
+
+      Construct(log2_block_size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::Construct(int log2_block_size) {
+
       pthread_mutex_init(&lock_, NULL);
       pthread_mutex_init(&channel_lock_, NULL);
+      pthread_mutex_init(&config_lock_, NULL);
+      pthread_mutex_init(&config_writer_lock_, NULL);
+      pthread_mutex_init(&recorder_lock_, NULL);
+      pthread_mutex_init(&stats_lock_, NULL);
 
       pthread_cond_init(&can_continue_, NULL);  
 
-      device_ = pcm_capture_device;
-      channel_count_ = 2;
       internal_state_ = kNotInitialized;
       error_description_ = "no error";
 
       exit_thread_ = false;
-      capture_handle_ = NULL;
      
-      // TODO: Hacer esto configurable. De momento no ha conseguido configurar este parámetro
-      sample_rate_ = sampling_rate; //192000;
       block_size_log2_ = log2_block_size;
       block_count_ = 0;
+      block_timestamp_ = 0;
+      recorder_ = NULL;
+      recorder_psd_.resize(channel_count_);
+      channel_storage_count_ = (channel_count_ + 1) & ~1;
 
       
       block_size_  = 1;
@@ -41,56 +92,96 @@ ThdAnalyzer::ThdAnalyzer(const char* pcm_capture_device, int sampling_rate, int
             block_size_ *= 2;
       }
 
-      printf("block_size=%d\n", block_size_);
+      stats_overrun_count_ = 0;
+      block_dropped_ = false;
+      memset(stage_ns_, 0, sizeof(stage_ns_));
+      ResetStats();
 
       memset(&thread_, 0, sizeof(pthread_t));
 
+      sched_policy_ = -1;
+      sched_priority_ = 0;
+      lock_memory_ = false;
+      prefault_ = true;
+      huge_pages_ = false;
+      snapshot_encoding_ = kSnapshotNone;
+      snapshot_min_db_ = -200.0;
+      snapshot_step_ = 200.0 / 65535;
+
       pthread_attr_init(&thread_attr_);
       pthread_attr_setdetachstate(&thread_attr_, PTHREAD_CREATE_JOINABLE);
       //pthread_attr_getstacksize(&thread_attr_, &stacksize);
 
-      // Formato nativo de las muestras, tal cual vienen el propio hardware.
-      // 16 bits LE = 4 bytes por frame, un frame es una muestra del canal L y otra del canal R
-      //buf_data_ = new int16_t[channel_count_ * block_size_];
-      buf_data_ = new int32_t[channel_count_ * block_size_];
-      
       overrun_count_ = 0;
-
-      channel_ = new Channel[channel_count_]; // TODO, en el constructor.
+      xrun_journal_ = new XrunJournal(kXrunJournalCapacity);
+
+      history_capacity_ = 0;
+      decimation_ = 1;
+      band_fraction_ = 0;
+      band_min_frequency_ = 0.0;
+      band_max_frequency_ = 0.0;
+      band_method_ = OctaveBands::kMethodSpectrum;
+      bands_ = NULL;
+      park_request_ = false;
+      idle_ = false;
+      pthread_cond_init(&idle_cond_, NULL);
+
+      buffers_ = AllocateBuffers(block_size_log2_);
+      channel_ = buffers_->channel;
+      buf_data_ = buffers_->frames;
+
+      // Configuración inicial: ventana rectangular y una máscara "default" a 0 dB en cada canal.
+      config_ = new AnalyzerConfig(channel_count_, sample_rate_, block_size_);
       for (int c = 0; c < channel_count_; c++) {
-            channel_[c].size = block_size_;
-            channel_[c].data = new double[block_size_];
-            channel_[c].pwsd = new double[block_size_]; // es real, |X(k)|^2
-            channel_[c].peakf = 0;
-            channel_[c].peakv = 0.0;
-            channel_[c].mask = new SpectrumMask(sample_rate_, block_size_);
+            config_->AddMask(c, "default");
       }
+      config_published_ = config_;
+      config_pending_ = NULL;
+      config_retired_ = NULL;
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ThdAnalyzer::~ThdAnalyzer() {
       
+      // El hilo puede estar esperando a Start(), se le despierta para que termine.
+      pthread_mutex_lock(&lock_);
       exit_thread_ = true;
+      pthread_cond_signal(&can_continue_);
+      pthread_mutex_unlock(&lock_);
+
       //pthread_cancel(thread_);  
-      pthread_join(thread_, NULL);
+      if (internal_state_ != kNotInitialized) {
+            pthread_join(thread_, NULL);
+      }
       
-      if (capture_handle_ != NULL) {
-            snd_pcm_close(capture_handle_);
+      source_->Close();
+      if (own_source_ == true) {
+            delete source_;
       }
 
-      int c;
-      for (c = 0; c < channel_count_; c++) {
-            delete[] channel_[c].data;
-            delete[] channel_[c].pwsd;
+      FreeBuffers(buffers_);
+      FreeViewsAndBands();
+      size_t i;
+      for (i = 0; i < buffer_pool_.size(); i++) {
+            FreeBuffers(buffer_pool_[i]);
+      }
+      delete xrun_journal_;
+      pthread_cond_destroy(&idle_cond_);
 
-            if (channel_[c].mask != NULL) {
-                  delete channel_[c].mask;
-            }
+      StopRecording();
+      pthread_mutex_destroy(&recorder_lock_);
+
+      DestroyRetiredConfigurations();
+      if (config_published_ != config_) {
+            delete config_published_;
       }
+      delete config_;
+      delete config_pending_;
 
-      delete[] channel_;
-      delete[] buf_data_;
+      pthread_mutex_destroy(&config_lock_);
+      pthread_mutex_destroy(&config_writer_lock_);
+      pthread_mutex_destroy(&stats_lock_);
       
 }
 
@@ -100,15 +191,102 @@ int ThdAnalyzer::Init() {
       assert(internal_state_ == kNotInitialized);
 
       
-      if (AdcSetup() != 0) {
+      if (source_->IsOpen() == false && source_->Open() != 0) {
+            error_description_ = source_->ErrorDescription();
             return 1;
       };
-           
+      if (source_->ChannelCount() != channel_count_) {
+            error_description_ = "capture source channel count changed on Open()";
+            return 1;
+      }
+      capture_rate_ = source_->SampleRate();
+      if (capture_rate_ % decimation_ != 0) {
+            error_description_ = "the sampling rate is not a multiple of the decimation factor";
+            return 1;
+      }
+      sample_rate_ = capture_rate_ / decimation_;
+
+      // Con decimación cada bloque son DftSize() * DecimationFactor() frames de la fuente.
+      if (decimation_ > 1 && source_->Reconfigure(capture_rate_, block_size_ * decimation_) != 0) {
+            error_description_ = source_->ErrorDescription();
+            return 1;
+      }
+
+      // El hardware puede haber elegido otra frecuencia de muestreo. La configuración más reciente (la pendiente si
+      // la hay, con las máscaras y la ventana que haya puesto la aplicación) se remuestrea a la frecuencia real para
+      // que las máscaras tengan la resolución correcta, y pasa a ser la única: el hilo de procesado aún no existe.
+      pthread_mutex_lock(&config_writer_lock_);
+      if (LatestConfiguration()->SamplingFrequency() != sample_rate_) {
+            AnalyzerConfig* config = new AnalyzerConfig(*LatestConfiguration(), sample_rate_, block_size_);
+            delete config_pending_;
+            delete config_;
+            config_pending_ = NULL;
+            config_ = config;
+            config_published_ = config;
+      }
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      // Las vistas dependen del tamaño de bloque y de la frecuencia, se crean ahora que se conocen. Toda su
+      // memoria se escribe aquí, antes del primer bloque. Si Init() falla después se liberan con las bandas, para
+      // que un nuevo intento no las vuelva a añadir.
+      if (AllocateViews(block_size_log2_, capture_rate_, &views_) != 0) {
+            return 1;
+      }
+
+      // Igual que las vistas, las bandas dependen de la frecuencia y del tamaño de bloque.
+      if (band_fraction_ > 0) {
+            bands_ = CreateBands(sample_rate_, block_size_);
+            if (bands_ == NULL) {
+                  FreeViewsAndBands();
+                  return 1;
+            }
+            band_power_.assign(channel_count_ * bands_->BandCount(), 0.0);
+            band_power_next_.assign(channel_count_ * bands_->BandCount(), 0.0);
+      }
+
+      // Bloqueo de memoria antes de tocar los búferes: con MCL_CURRENT se cargan y bloquean todas las páginas ya
+      // reservadas, MCL_FUTURE hace lo mismo con las que se reserven después (pilas de los hilos, grabación...).
+      if (lock_memory_ == true && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            error_description_ = std::string("mlockall(): ") + strerror(errno);
+            FreeViewsAndBands();
+            return 1;
+      }
+
+      if (prefault_ == true) {
+            PrefaultBuffers(buffers_);
+      }
 
-      // Creación del hilo que lee y procesa las muestras de audio.
       int r;
+
+      if (sched_policy_ >= 0) {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = sched_priority_;
+            pthread_attr_setinheritsched(&thread_attr_, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&thread_attr_, sched_policy_);
+            pthread_attr_setschedparam(&thread_attr_, &param);
+      }
+
+      if (cpu_affinity_.empty() == false) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (size_t i = 0; i < cpu_affinity_.size(); i++) {
+                  CPU_SET(cpu_affinity_[i], &cpus);
+            }
+            r = pthread_attr_setaffinity_np(&thread_attr_, sizeof(cpus), &cpus);
+            if (r != 0) {
+                  error_description_ = std::string("pthread_attr_setaffinity_np(): ") + strerror(r);
+                  FreeViewsAndBands();
+                  return 1;
+            }
+      }
+
+      // Creación del hilo que lee y procesa las muestras de audio. Con planificación en tiempo real sin permiso
+      // falla con EPERM.
       r = pthread_create(&thread_, &thread_attr_, ThdAnalyzer::ThreadFuncHelper, this);
       if (r != 0) {
+            error_description_ = std::string("pthread_create(): ") + strerror(r);
+            FreeViewsAndBands();
             return 1;
       }
 
@@ -117,184 +295,1556 @@ int ThdAnalyzer::Init() {
 }
 
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int ThdAnalyzer::Start() {
-      assert(internal_state_ != kNotInitialized);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::SetRealTimeScheduling(int policy, int priority) {
+      assert(internal_state_ == kNotInitialized);
 
-      pthread_mutex_lock(&lock_);
-      internal_state_ = kRunning;
-      pthread_cond_signal(&can_continue_);
-      pthread_mutex_unlock(&lock_);
+      if (policy != SCHED_FIFO && policy != SCHED_RR && policy != SCHED_OTHER) {
+            error_description_ = "scheduling policy must be SCHED_FIFO, SCHED_RR or SCHED_OTHER";
+            return 1;
+      }
+      if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) {
+            error_description_ = "scheduling priority out of range for the policy";
+            return 1;
+      }
 
+      sched_policy_ = policy;
+      sched_priority_ = priority;
       return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::SetCpuAffinity(const std::vector<int>& cpus) {
+      assert(internal_state_ == kNotInitialized);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int ThdAnalyzer::Stop() {
-      assert(internal_state_ != kNotInitialized);
-
-      pthread_mutex_lock(&lock_);
-      internal_state_ = kStopped;
-      pthread_cond_signal(&can_continue_);
-      pthread_mutex_unlock(&lock_);
+      long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+      for (size_t i = 0; i < cpus.size(); i++) {
+            if (cpus[i] < 0 || cpus[i] >= cpu_count || cpus[i] >= CPU_SETSIZE) {
+                  error_description_ = "no such CPU in the affinity mask";
+                  return 1;
+            }
+      }
 
+      cpu_affinity_ = cpus;
       return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::SetMemoryLocking(bool lock) {
+      assert(internal_state_ == kNotInitialized);
+      lock_memory_ = lock;
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int ThdAnalyzer::AdcSetup() {
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::SetPrefaulting(bool prefault) {
+      assert(internal_state_ == kNotInitialized);
+      prefault_ = prefault;
+}
 
-      int err;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::SetHugePages(bool huge_pages) {
+      assert(internal_state_ == kNotInitialized);
 
-      snd_pcm_hw_params_t* hw_params = NULL;
-      snd_pcm_sw_params_t* sw_params = NULL;
+      if (huge_pages == huge_pages_) {
+            return;
+      }
+      huge_pages_ = huge_pages;
 
-      // Inicialización del dispositivo de captura de audio: Parámetros HW
-      // ---------------------------------------------------------------------------------------------------------------      
-      if ((err = snd_pcm_open(&capture_handle_, device_.c_str(), SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-            goto fatal_error;
+      // Los búferes creados en el constructor pasan a las páginas pedidas.
+      FreeBuffers(buffers_);
+      buffers_ = AllocateBuffers(block_size_log2_);
+      channel_ = buffers_->channel;
+      buf_data_ = buffers_->frames;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::SetSnapshotEncoding(SnapshotEncoding encoding, double min_db, double max_db) {
+      assert(internal_state_ == kNotInitialized);
+
+      if (encoding == kSnapshotDecibels16 && !(max_db > min_db)) {
+            error_description_ = "the snapshot decibel range is empty";
+            return 1;
       }
-      if ((err = snd_pcm_hw_params_malloc(&hw_params)) < 0) {
-            goto fatal_error;      
+
+      snapshot_min_db_ = min_db;
+      snapshot_step_ = (max_db - min_db) / 65535;
+      if (encoding == snapshot_encoding_) {
+            return 0;
       }
-      if ((err = snd_pcm_hw_params_any(capture_handle_, hw_params)) < 0) {
-            goto fatal_error;
+      snapshot_encoding_ = encoding;
+
+      // Las instantáneas están en la arena de los búferes.
+      FreeBuffers(buffers_);
+      buffers_ = AllocateBuffers(block_size_log2_);
+      channel_ = buffers_->channel;
+      buf_data_ = buffers_->frames;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::SetDecimation(int factor) {
+      assert(internal_state_ == kNotInitialized);
+
+      if (Decimator::IsValidFactor(factor) == false) {
+            error_description_ = "the decimation factor must be a power of 2 up to 64";
+            return 1;
       }
-      if ((err = snd_pcm_hw_params_set_access(capture_handle_, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-            goto fatal_error;
+      if (factor == decimation_) {
+            return 0;
       }
-      if ((err = snd_pcm_hw_params_set_format(capture_handle_, hw_params, SND_PCM_FORMAT_S32_LE)) < 0) {
-            goto fatal_error;
+      decimation_ = factor;
+
+      // Los búferes de las muestras de la fuente cambian de tamaño y los canales necesitan sus decimadores.
+      FreeBuffers(buffers_);
+      buffers_ = AllocateBuffers(block_size_log2_);
+      channel_ = buffers_->channel;
+      buf_data_ = buffers_->frames;
+
+      // La configuración, que aún no ha usado el hilo de procesado, pasa a la frecuencia decimada. Si no es
+      // múltiplo del factor fallará Init(), salvo que el hardware elija otra.
+      sample_rate_ = capture_rate_ / decimation_;
+      AnalyzerConfig* config = new AnalyzerConfig(*config_, sample_rate_, block_size_);
+      delete config_;
+      config_ = config;
+      config_published_ = config;
+      if (config_pending_ != NULL) {
+            config = new AnalyzerConfig(*config_pending_, sample_rate_, block_size_);
+            delete config_pending_;
+            config_pending_ = config;
       }
-      // Restrict a configuration space to contain only real hardware rates
-      if ((err = snd_pcm_hw_params_set_rate_resample(capture_handle_, hw_params, 0)) < 0) {
-            goto fatal_error;
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::AddView(int log2_block_size, int hop, AnalyzerConfig::Window window, int decimation) {
+      assert(internal_state_ == kNotInitialized);
+
+      if (log2_block_size < 4 || log2_block_size > 20) {
+            error_description_ = "block size out of range";
+            return -1;
       }
-      if ((err = snd_pcm_hw_params_set_rate_min(capture_handle_, hw_params, (unsigned int*) &sample_rate_, NULL)) < 0) {
-            goto fatal_error;
+      if (hop < 0) {
+            error_description_ = "the hop must not be negative";
+            return -1;
       }
-      if ((err = snd_pcm_hw_params_set_channels(capture_handle_, hw_params, 2)) < 0) {
-            goto fatal_error;
+      if (Decimator::IsValidFactor(decimation) == false) {
+            error_description_ = "the decimation factor must be a power of 2 up to 64";
+            return -1;
       }
-      if ((err = snd_pcm_hw_params(capture_handle_, hw_params)) < 0) {
-            goto fatal_error;
+
+      ViewSpec spec;
+      spec.block_size_log2 = log2_block_size;
+      spec.hop = hop;
+      spec.window = window;
+      spec.decimation = decimation;
+      view_specs_.push_back(spec);
+
+      return (int) view_specs_.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::AllocateViews(int log2_block_size, int capture_rate, std::vector<View*>* views) {
+
+      int n = 1 << log2_block_size;
+      size_t i;
+
+      for (i = 0; i < view_specs_.size(); i++) {
+            const ViewSpec& spec = view_specs_[i];
+
+            // La vista recibe la señal del análisis principal, ya decimada por decimation_, y la decima por r.
+            int r = spec.decimation / decimation_;
+            const char* error = NULL;
+            if (spec.decimation < decimation_) {
+                  error = "the decimation of a view must be a multiple of the analyzer decimation";
+            } else if (r > n) {
+                  error = "the decimation of a view is too large for the block size";
+            } else if (capture_rate % spec.decimation != 0) {
+                  error = "the sampling rate is not a multiple of the decimation factor of a view";
+            }
+            if (error != NULL) {
+                  error_description_ = error;
+                  size_t j;
+                  for (j = 0; j < views->size(); j++) {
+                        FreeView((*views)[j]);
+                  }
+                  views->clear();
+                  return 1;
+            }
+
+            View* v = new View;
+            v->block_size_log2 = spec.block_size_log2;
+            v->block_size = 1 << spec.block_size_log2;
+            v->hop = (spec.hop > 0) ? spec.hop : v->block_size;
+            v->decimation = spec.decimation;
+            v->sample_rate = capture_rate / spec.decimation;
+            v->config = new AnalyzerConfig(channel_count_, v->sample_rate, v->block_size);
+            v->config->SetWindow(spec.window);
+            v->chunk = n / r;
+            v->count = 0;
+            v->since = 0;
+            v->block_count = 0;
+
+            // Todos los vectores de los canales en una arena, que empieza a cero.
+            int size = v->block_size;
+            size_t bytes = BufferArena::AlignedSize((size + v->chunk) * sizeof(double)) +
+                  BufferArena::AlignedSize(size * sizeof(double)) +
+                  2 * BufferArena::AlignedSize((size / 2 + 1) * sizeof(double));
+            v->arena = new BufferArena(channel_storage_count_ * bytes, huge_pages_);
+
+            v->channel = new ViewChannel[channel_storage_count_];
+            for (int c = 0; c < channel_storage_count_; c++) {
+                  ViewChannel* vc = &v->channel[c];
+                  vc->decimator = (r > 1 && c < channel_count_) ? new Decimator(r, v->chunk) : NULL;
+                  vc->samples = v->arena->AllocateDoubles(size + v->chunk);
+                  vc->data = v->arena->AllocateDoubles(size);
+                  vc->pwsd = v->arena->AllocateDoubles(size / 2 + 1);
+                  vc->pwsd_next = v->arena->AllocateDoubles(size / 2 + 1);
+                  vc->peak_bin = 0.0;
+                  vc->peak_bin_next = 0.0;
+                  vc->peak_amplitude = 0.0;
+                  vc->peak_amplitude_next = 0.0;
+            }
+
+            if (prefault_ == true) {
+                  v->arena->Prefault();
+            }
+            views->push_back(v);
       }
-	
-      // Inicialización del dispositivo de captura de audio: Parámetros SW
-      // ---------------------------------------------------------------------------------------------------------------
-      if ((err = snd_pcm_sw_params_malloc(&sw_params)) < 0) {
-            goto fatal_error;
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::FreeView(View* v) {
+      for (int c = 0; c < channel_storage_count_; c++) {
+            delete v->channel[c].decimator;
       }
-      if ((err = snd_pcm_sw_params_current(capture_handle_, sw_params)) < 0) {
-            goto fatal_error;
+      delete[] v->channel;
+      delete v->arena;
+      delete v->config;
+      delete v;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::FreeViewsAndBands() {
+      size_t i;
+      for (i = 0; i < views_.size(); i++) {
+            FreeView(views_[i]);
       }
-      if ((err = snd_pcm_sw_params_set_avail_min(capture_handle_, sw_params, block_size_)) < 0) {
-            goto fatal_error;
+      views_.clear();
+      delete bands_;
+      bands_ = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::PushViews(int channel, const double* x) {
+
+      // |x| son las block_size_ muestras del bloque en el canal |channel|, a la frecuencia del análisis principal y
+      // sin ventana. Se añaden detrás de las que ya tiene cada vista; ProcessViews() actualiza la cuenta.
+      size_t i;
+      for (i = 0; i < views_.size(); i++) {
+            View* v = views_[i];
+            ViewChannel* vc = &v->channel[channel];
+            if (vc->decimator != NULL) {
+                  memcpy(vc->decimator->Input(), x, block_size_ * sizeof(double));
+                  vc->decimator->Process(vc->samples + v->count);
+            } else {
+                  memcpy(vc->samples + v->count, x, block_size_ * sizeof(double));
+            }
       }
-      if ((err = snd_pcm_sw_params_set_start_threshold(capture_handle_, sw_params, 0U)) < 0) {
-            goto fatal_error;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ProcessViews() {
+
+      // La misma normalización que Process()
+      double fftnorm = 2.0 / (1 + sqrt(2));
+      int c;
+      int i;
+      size_t j;
+
+      for (j = 0; j < views_.size(); j++) {
+            View* v = views_[j];
+            int n = v->block_size;
+
+            v->count += v->chunk;
+            v->since += v->chunk;
+
+            // Final del último salto completado, el espectro se calcula con las n muestras anteriores.
+            int end = -1;
+            if (v->since >= v->hop) {
+                  v->since -= (v->since / v->hop) * v->hop;
+                  end = v->count - v->since;
+            }
+
+            if (end >= n) {
+                  const double* w = &v->config->window_coefficients_[0];
+
+                  for (c = 0; c < channel_storage_count_; c += 2) {
+                        for (int k = c; k < c + 2; k++) {
+                              double* data = v->channel[k].data;
+                              if (k >= channel_count_) {
+                                    memset(data, 0, n * sizeof(double));
+                                    continue;
+                              }
+                              const double* x = v->channel[k].samples + end - n;
+                              for (i = 0; i < n; i++) {
+                                    data[i] = w[i] * x[i];
+                              }
+                        }
+
+                        double* re = v->channel[c].data;
+                        double* im = v->channel[c + 1].data;
+                        thd_analyzer::FFT(1, v->block_size_log2, re, im);
+                        TwoRealPowerSpectra(re, im, n, fftnorm, v->channel[c].pwsd_next,
+                                            (c + 1 < channel_count_) ? v->channel[c + 1].pwsd_next : NULL);
+                  }
+
+                  for (c = 0; c < channel_count_; c++) {
+                        ViewChannel* vc = &v->channel[c];
+                        double value;
+                        int k = FindMaximum(vc->pwsd_next, n / 2, 1e-16, &value);
+                        if (k < 0) {
+                              vc->peak_bin_next = 0.0;
+                              vc->peak_amplitude_next = 0.0;
+                              continue;
+                        }
+                        double gain;
+                        double d = InterpolatePeak(vc->pwsd_next, k, n, &v->config->window_terms_[0],
+                                                   (int) v->config->window_terms_.size(), &gain);
+                        vc->peak_bin_next = k + d;
+                        vc->peak_amplitude_next = fftnorm * sqrt(vc->pwsd_next[k]) / gain;
+                  }
+
+                  pthread_mutex_lock(&channel_lock_);
+                  for (c = 0; c < channel_count_; c++) {
+                        ViewChannel* vc = &v->channel[c];
+                        double* tmp = vc->pwsd;
+                        vc->pwsd = vc->pwsd_next;
+                        vc->pwsd_next = tmp;
+                        vc->peak_bin = vc->peak_bin_next;
+                        vc->peak_amplitude = vc->peak_amplitude_next;
+                  }
+                  v->block_count++;
+                  pthread_mutex_unlock(&channel_lock_);
+            }
+
+            // Para el siguiente salto solo hacen falta las n últimas muestras
+            if (v->count > n) {
+                  for (c = 0; c < channel_count_; c++) {
+                        memmove(v->channel[c].samples, v->channel[c].samples + v->count - n, n * sizeof(double));
+                  }
+                  v->count = n;
+            }
       }
-      if ((err = snd_pcm_sw_params(capture_handle_, sw_params)) < 0) {
-            goto fatal_error;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::ViewDftSize(int view) const {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      return views_[view]->block_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::ViewSamplingFrequency(int view) const {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      return views_[view]->sample_rate;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::ViewAnalogResolution(int view) const {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      return (double) views_[view]->sample_rate / (double) views_[view]->block_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::ViewBlockCount(int view) {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+
+      pthread_mutex_lock(&channel_lock_);
+      int count = views_[view]->block_count;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::ViewPowerSpectralDensity(int view, int channel, int frequency_index) {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      assert(channel < channel_count_);
+      assert(frequency_index >= 0 && frequency_index < views_[view]->block_size);
+
+      if (frequency_index > views_[view]->block_size / 2) {
+            frequency_index = views_[view]->block_size - frequency_index;
+      }
+
+      pthread_mutex_lock(&channel_lock_);
+      double ps = views_[view]->channel[channel].pwsd[frequency_index];
+      pthread_mutex_unlock(&channel_lock_);
+
+      return ps;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetViewSpectrum(int view, int channel, std::vector<double>* psd) {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      assert(channel < channel_count_);
+      assert(psd != NULL);
+
+      View* v = views_[view];
+      psd->resize(v->block_size / 2);
+
+      pthread_mutex_lock(&channel_lock_);
+      memcpy(&(*psd)[0], v->channel[channel].pwsd, (v->block_size / 2) * sizeof(double));
+      int count = v->block_count;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::ViewPeakFrequency(int view, int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      assert(channel < channel_count_);
+
+      View* v = views_[view];
+
+      pthread_mutex_lock(&channel_lock_);
+      double bin = v->channel[channel].peak_bin;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return bin * v->sample_rate / v->block_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::ViewPeakAmplitude(int view, int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(view >= 0 && view < (int) views_.size());
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      double amplitude = views_[view]->channel[channel].peak_amplitude;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return amplitude;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::EnableOctaveBands(int bands_per_octave, double min_frequency, double max_frequency,
+                                   OctaveBands::Method method) {
+      assert(internal_state_ == kNotInitialized);
+
+      if (bands_per_octave < 1) {
+            error_description_ = "the number of bands per octave must be at least 1";
+            return 1;
+      }
+      if (min_frequency <= 0.0 || max_frequency < min_frequency) {
+            error_description_ = "invalid octave band frequency range";
+            return 1;
       }
 
-      snd_pcm_hw_params_free(hw_params);
-      snd_pcm_sw_params_free(sw_params);
-      hw_params = NULL;
-      sw_params = NULL;
+      band_fraction_ = bands_per_octave;
+      band_min_frequency_ = min_frequency;
+      band_max_frequency_ = max_frequency;
+      band_method_ = method;
       return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+OctaveBands* ThdAnalyzer::CreateBands(int sampling_rate, int block_size) {
+      OctaveBands* bands = new OctaveBands(band_fraction_, band_min_frequency_, band_max_frequency_, band_method_,
+                                           channel_count_, sampling_rate, block_size);
+      if (bands->BandCount() == 0) {
+            error_description_ = "no octave band fits below the Nyquist frequency";
+            delete bands;
+            return NULL;
+      }
+      return bands;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::BandCount() const {
+      return (bands_ != NULL) ? bands_->BandCount() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::BandCenterFrequency(int band) const {
+      assert(band >= 0 && band < BandCount());
+      return bands_->CenterFrequency(band);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::BandLowerFrequency(int band) const {
+      assert(band >= 0 && band < BandCount());
+      return bands_->LowerFrequency(band);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::BandUpperFrequency(int band) const {
+      assert(band >= 0 && band < BandCount());
+      return bands_->UpperFrequency(band);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::BandPower(int channel, int band) {
+      assert(channel < channel_count_);
+      assert(band >= 0 && band < BandCount());
+
+      pthread_mutex_lock(&channel_lock_);
+      double power = band_power_[channel * bands_->BandCount() + band];
+      pthread_mutex_unlock(&channel_lock_);
+
+      return power;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetBandLevels(int channel, std::vector<double>* levels) {
+      assert(channel < channel_count_);
+      assert(levels != NULL);
+
+      int n = BandCount();
+      levels->resize(n);
+
+      pthread_mutex_lock(&channel_lock_);
+      if (n > 0) {
+            memcpy(&(*levels)[0], &band_power_[channel * n], n * sizeof(double));
+      }
+      int count = block_count_;
+      pthread_mutex_unlock(&channel_lock_);
+
+      // Los logaritmos fuera del bloqueo. El mínimo es -300 dB, para no devolver -inf con silencio.
+      int i;
+      for (i = 0; i < n; i++) {
+            (*levels)[i] = 10.0 * log10(2.0 * (*levels)[i] + 1e-30);
+      }
+      return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::PrefaultBuffers(BlockBuffers* b) {
+
+      // mmap() solo reserva direcciones, la primera escritura en cada página provoca el fallo de página. Se
+      // escriben todas aquí, sin cambiar su contenido.
+      b->arena->Prefault();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ThdAnalyzer::BlockBuffers* ThdAnalyzer::AllocateBuffers(int log2_block_size) {
+
+      int n = 1 << log2_block_size;
+
+      BlockBuffers* b = new BlockBuffers;
+      b->block_size_log2 = log2_block_size;
+
+      // Una sola arena con las muestras de la fuente y, a continuación, los vectores de cada canal, uno detrás de
+      // otro. Todos alineados a 64 bytes, ninguna línea de caché es de dos vectores ni de dos canales.
+      size_t snapshot_bytes = 0;
+      if (snapshot_encoding_ == kSnapshotFloat32) {
+            snapshot_bytes = BufferArena::AlignedSize((n / 2 + 1) * sizeof(float));
+      } else if (snapshot_encoding_ == kSnapshotDecibels16) {
+            snapshot_bytes = BufferArena::AlignedSize((n / 2 + 1) * sizeof(uint16_t));
+      }
+      size_t channel_bytes = BufferArena::AlignedSize(n * sizeof(double)) +
+            4 * BufferArena::AlignedSize((n / 2 + 1) * sizeof(double)) +
+            3 * BufferArena::AlignedSize((n / 2) * sizeof(double)) + 2 * snapshot_bytes;
+      size_t frame_bytes = BufferArena::AlignedSize(channel_count_ * n * decimation_ * sizeof(int32_t));
+      b->arena = new BufferArena(frame_bytes + channel_storage_count_ * channel_bytes, huge_pages_);
+
+      // Formato de las muestras tal como las entrega la fuente: S32, un frame es una muestra de cada canal. Con
+      // decimación un bloque son n * decimation_ frames.
+      b->frames = b->arena->AllocateInt32(channel_count_ * n * decimation_);
+
+      b->channel = new Channel[channel_storage_count_];
+      for (int c = 0; c < channel_storage_count_; c++) {
+            Channel* ch = &b->channel[c];
+            ch->size = n;
+            ch->data = b->arena->AllocateDoubles(n);
+            ch->pwsd = b->arena->AllocateDoubles(n / 2 + 1); // es real, |X(k)|^2
+            ch->pwsd_next = b->arena->AllocateDoubles(n / 2 + 1);
+            ch->psd_sum = b->arena->AllocateDoubles(n / 2 + 1);
+            ch->psd_sum_next = b->arena->AllocateDoubles(n / 2 + 1);
+            ch->avg = b->arena->AllocateDoubles(n / 2);
+            ch->avg_next = b->arena->AllocateDoubles(n / 2);
+            ch->avg_sum = b->arena->AllocateDoubles(n / 2);
+            ch->snapshot = NULL;
+            ch->snapshot_next = NULL;
+            if (snapshot_bytes > 0) {
+                  ch->snapshot = b->arena->Allocate(snapshot_bytes);
+                  ch->snapshot_next = b->arena->Allocate(snapshot_bytes);
+            }
+            ch->history = NULL;
+            ch->decimator = NULL;
+            if (decimation_ > 1 && c < channel_count_) {
+                  ch->decimator = new Decimator(decimation_, n);
+            }
+      }
+
+      ResetBuffers(b);
+      return b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ResetBuffers(BlockBuffers* b) {
+
+      // Estado inicial de las medidas: espectro nulo, sin máximo y promedio por reiniciar.
+      int n = 1 << b->block_size_log2;
+      for (int c = 0; c < channel_storage_count_; c++) {
+            Channel* ch = &b->channel[c];
+            ch->peakf = 0;
+            ch->peakv = 0.0;
+            ch->peakf_next = 0;
+            ch->peakv_next = 0.0;
+            ch->peak_bin = 0.0;
+            ch->peak_bin_next = 0.0;
+            ch->peak_amplitude = 0.0;
+            ch->peak_amplitude_next = 0.0;
+            memset(&ch->level, 0, sizeof(LevelStats));
+            memset(&ch->level_next, 0, sizeof(LevelStats));
+
+            memset(ch->pwsd, 0, (n / 2 + 1) * sizeof(double));
+            memset(ch->psd_sum, 0, (n / 2 + 1) * sizeof(double));
+            memset(ch->avg, 0, (n / 2) * sizeof(double));
+            if (ch->snapshot != NULL) {
+                  // Espectro nulo: 0.0f, o el código 0 (el mínimo) con kSnapshotDecibels16.
+                  size_t size = (snapshot_encoding_ == kSnapshotFloat32) ? sizeof(float) : sizeof(uint16_t);
+                  memset(ch->snapshot, 0, (n / 2 + 1) * size);
+            }
+
+            ch->avg_count = 0;
+            ch->avg_count_next = 0;
+            ch->avg_mode = AnalyzerConfig::kAveragingNone;
+            ch->avg_parameter = 0.0;
+            ch->avg_reset = true;
+            ch->avg_reset_done = false;
+            ch->avg_none = false;
+            ch->avg_none_next = false;
+
+            if (ch->decimator != NULL) {
+                  ch->decimator->Reset();
+            }
+
+            // El historial empieza vacío
+            delete ch->history;
+            ch->history = NULL;
+            if (history_capacity_ > 0 && c < channel_count_) {
+                  ch->history = new SpectrumHistory(history_capacity_, n / 2, history_encoding_, history_min_db_,
+                                                    history_max_db_);
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::FreeBuffers(BlockBuffers* b) {
+      for (int c = 0; c < channel_storage_count_; c++) {
+            delete b->channel[c].history;
+            delete b->channel[c].decimator;
+      }
+      delete[] b->channel;
+      delete b->arena;
+      delete b;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::Reconfigure(int sampling_rate, int log2_block_size) {
+      assert(internal_state_ != kNotInitialized);
+
+      if (log2_block_size < 4 || log2_block_size > 20) {
+            error_description_ = "block size out of range";
+            return 1;
+      }
+      if (sampling_rate <= 0) {
+            sampling_rate = capture_rate_;
+      }
+      if (sampling_rate == capture_rate_ && log2_block_size == block_size_log2_) {
+            return 0;
+      }
+      if (sampling_rate % decimation_ != 0) {
+            error_description_ = "the sampling rate is not a multiple of the decimation factor";
+            return 1;
+      }
+
+      // Las grabaciones tienen registros de tamaño fijo
+      pthread_mutex_lock(&recorder_lock_);
+      bool recording = (recorder_ != NULL);
+      pthread_mutex_unlock(&recorder_lock_);
+      if (recording == true) {
+            error_description_ = "stop recording before reconfiguring";
+            return 1;
+      }
+
+      // config_writer_lock_ serializa Reconfigure() con los cambios de configuración y protege buffer_pool_.
+      pthread_mutex_lock(&config_writer_lock_);
+      DestroyRetiredConfigurations();
+
+      // Búferes del nuevo tamaño, antes de detener el hilo: de la reserva si ya se usaron, si no nuevos.
+      BlockBuffers* b = NULL;
+      size_t i;
+      for (i = 0; i < buffer_pool_.size(); i++) {
+            if (buffer_pool_[i]->block_size_log2 == log2_block_size) {
+                  b = buffer_pool_[i];
+                  buffer_pool_.erase(buffer_pool_.begin() + i);
+                  ResetBuffers(b);
+                  break;
+            }
+      }
+      if (b == NULL) {
+            b = AllocateBuffers(log2_block_size);
+            if (prefault_ == true) {
+                  PrefaultBuffers(b);
+            }
+      }
+
+      // Las vistas se vuelven a crear para el nuevo tamaño de bloque y la nueva frecuencia.
+      std::vector<View*> views;
+      if (AllocateViews(log2_block_size, sampling_rate, &views) != 0) {
+            buffer_pool_.push_back(b);
+            pthread_mutex_unlock(&config_writer_lock_);
+            return 1;
+      }
+
+      // Y las bandas, con sus búferes de potencia.
+      OctaveBands* bands = NULL;
+      std::vector<double> band_power;
+      std::vector<double> band_power_next;
+      if (band_fraction_ > 0) {
+            bands = CreateBands(sampling_rate / decimation_, 1 << log2_block_size);
+            if (bands == NULL) {
+                  for (i = 0; i < views.size(); i++) {
+                        FreeView(views[i]);
+                  }
+                  buffer_pool_.push_back(b);
+                  pthread_mutex_unlock(&config_writer_lock_);
+                  return 1;
+            }
+      }
+
+      if (Park() != 0) {
+            error_description_ = "the analyzer is not running";
+            for (i = 0; i < views.size(); i++) {
+                  FreeView(views[i]);
+            }
+            delete bands;
+            buffer_pool_.push_back(b);
+            pthread_mutex_unlock(&config_writer_lock_);
+            return 1;
+      }
+
+      // Con el hilo detenido entre dos bloques nadie está leyendo de la fuente. Solo se renegocia el hardware si
+      // cambia la frecuencia, el tamaño de bloque solo cambia el número de frames de cada lectura.
+      int rate = -1;
+      if (source_->Reconfigure(sampling_rate, (1 << log2_block_size) * decimation_) != 0) {
+            error_description_ = source_->ErrorDescription();
+      } else {
+            // La fuente puede haber ajustado la frecuencia. Si ya no es múltiplo de los factores de decimación se
+            // vuelve a la de antes.
+            rate = source_->SampleRate();
+            for (i = 0; i < views.size(); i++) {
+                  if (rate % views[i]->decimation != 0) {
+                        rate = -1;
+                        break;
+                  }
+                  views[i]->sample_rate = rate / views[i]->decimation;
+            }
+            if (rate < 0 || rate % decimation_ != 0) {
+                  source_->Reconfigure(capture_rate_, block_size_ * decimation_);
+                  error_description_ = "the sampling rate is not a multiple of the decimation factor";
+                  rate = -1;
+            }
+      }
+
+      // Si la fuente ha elegido otra frecuencia las bandas se vuelven a crear, con el hilo detenido. Es raro: la
+      // aplicación normalmente pide una frecuencia que la fuente admite.
+      if (rate > 0 && bands != NULL && rate != sampling_rate) {
+            delete bands;
+            bands = CreateBands(rate / decimation_, 1 << log2_block_size);
+            if (bands == NULL) {
+                  source_->Reconfigure(capture_rate_, block_size_ * decimation_);
+                  rate = -1;
+            }
+      }
+      if (bands != NULL) {
+            band_power.assign(channel_count_ * bands->BandCount(), 0.0);
+            band_power_next.assign(channel_count_ * bands->BandCount(), 0.0);
+      }
+
+      if (rate < 0) {
+            Resume();
+            for (i = 0; i < views.size(); i++) {
+                  FreeView(views[i]);
+            }
+            delete bands;
+            buffer_pool_.push_back(b);
+            pthread_mutex_unlock(&config_writer_lock_);
+            return 1;
+      }
+
+      // La configuración se rehace con la frecuencia real.
+      AnalyzerConfig* config = new AnalyzerConfig(*LatestConfiguration(), rate / decimation_, 1 << log2_block_size);
+      AnalyzerConfig* discarded;
+
+      BlockBuffers* old = buffers_;
+
+      pthread_mutex_lock(&channel_lock_);
+      buffers_ = b;
+      channel_ = b->channel;
+      buf_data_ = b->frames;
+      block_size_log2_ = log2_block_size;
+      block_size_ = 1 << log2_block_size;
+      capture_rate_ = rate;
+      sample_rate_ = rate / decimation_;
+      views_.swap(views);
+      OctaveBands* old_bands = bands_;
+      bands_ = bands;
+      bands = old_bands;
+      band_power_.swap(band_power);
+      band_power_next_.swap(band_power_next);
+
+      // Las configuraciones del tamaño anterior se retiran: la publicada y, si es otra, la que usaba el hilo. La
+      // pendiente nunca llegó a usarse.
+      pthread_mutex_lock(&config_lock_);
+      discarded = config_pending_;
+      config_pending_ = NULL;
+      if (config_ != config_published_) {
+            config_->retired_next_ = config_retired_;
+            config_retired_ = config_;
+      }
+      config_published_->retired_next_ = config_retired_;
+      config_retired_ = config_published_;
+      config_ = config;
+      config_published_ = config;
+      pthread_mutex_unlock(&config_lock_);
+
+      pthread_mutex_unlock(&channel_lock_);
+
+      Resume();
+
+      delete discarded;
+      for (i = 0; i < views.size(); i++) {
+            FreeView(views[i]);
+      }
+      delete bands;
+      buffer_pool_.push_back(old);
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::Park() {
+
+      // El hilo se detiene al empezar el siguiente bloque, o ya está esperando si el analizador está parado.
+      pthread_mutex_lock(&lock_);
+      park_request_ = true;
+      while (idle_ == false && (internal_state_ == kRunning || internal_state_ == kStopped)) {
+            pthread_cond_wait(&idle_cond_, &lock_);
+      }
+      bool parked = idle_;
+      if (parked == false) {
+            park_request_ = false;
+      }
+      pthread_mutex_unlock(&lock_);
+
+      return (parked == true) ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::Resume() {
+      pthread_mutex_lock(&lock_);
+      park_request_ = false;
+      pthread_cond_signal(&can_continue_);
+      pthread_mutex_unlock(&lock_);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::EnableHistory(int capacity, SpectrumHistory::Encoding encoding, double min_db, double max_db) {
+      assert(internal_state_ == kNotInitialized);
+
+      if (history_capacity_ > 0) {
+            return 1;
+      }
+
+      // Se guardan los parámetros para los búferes de otros tamaños (Reconfigure()).
+      history_capacity_ = capacity;
+      history_encoding_ = encoding;
+      history_min_db_ = min_db;
+      history_max_db_ = max_db;
+
+      for (int c = 0; c < channel_count_; c++) {
+            channel_[c].history = new SpectrumHistory(capacity, block_size_ / 2, encoding, min_db, max_db);
+      }
+      return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::Start() {
+      assert(internal_state_ != kNotInitialized);
+
+      // Si el hilo ya ha terminado (kCrashed, kFinished) el estado no cambia.
+      pthread_mutex_lock(&lock_);
+      if (internal_state_ == kStopped) {
+            internal_state_ = kRunning;
+            pthread_cond_signal(&can_continue_);
+      }
+      pthread_mutex_unlock(&lock_);
+
+      return 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::Stop() {
+      assert(internal_state_ != kNotInitialized);
+
+      pthread_mutex_lock(&lock_);
+      if (internal_state_ == kRunning) {
+            internal_state_ = kStopped;
+            pthread_cond_signal(&can_continue_);
+      }
+      pthread_mutex_unlock(&lock_);
+
+      return 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::FindPeak(int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      int peakf;
+
+      pthread_mutex_lock(&channel_lock_);
+      peakf = channel_[channel].peakf;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return peakf;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::PeakFrequency(int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      double bin;
+
+      pthread_mutex_lock(&channel_lock_);
+      bin = channel_[channel].peak_bin;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return bin * sample_rate_ / block_size_;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::PeakAmplitude(int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      double amplitude;
+
+      pthread_mutex_lock(&channel_lock_);
+      amplitude = channel_[channel].peak_amplitude;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return amplitude;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig* ThdAnalyzer::Configuration() {
+
+      AnalyzerConfig* copy;
+
+      pthread_mutex_lock(&config_writer_lock_);
+      DestroyRetiredConfigurations();
+
+      // La copia se hace fuera de config_lock_ para no retener al hilo de procesado. La configuración copiada no se
+      // puede destruir mientras tanto porque solo se destruyen configuraciones con config_writer_lock_ adquirido.
+      copy = new AnalyzerConfig(*LatestConfiguration());
+
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return copy;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::SetConfiguration(AnalyzerConfig* config) {
+      assert(config != NULL);
+
+      AnalyzerConfig* discarded;
+
+      // Reconfigure() cambia sample_rate_ y block_size_ con config_writer_lock_, la comprobación y la entrega tienen
+      // que hacerse sin soltarlo para que no llegue una configuración del tamaño anterior.
+      pthread_mutex_lock(&config_writer_lock_);
+      if (config->ChannelCount() != channel_count_ || config->SamplingFrequency() != sample_rate_ ||
+          config->DftSize() != block_size_) {
+            pthread_mutex_unlock(&config_writer_lock_);
+            error_description_ = "configuration does not match the analyzer";
+            delete config;
+            return 1;
+      }
+
+      DestroyRetiredConfigurations();
+
+      pthread_mutex_lock(&config_lock_);
+      discarded = config_pending_;
+      config_pending_ = config;
+      pthread_mutex_unlock(&config_lock_);
+
+      // Nunca llegó a usarla el hilo de procesado
+      delete discarded;
+
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask* ThdAnalyzer::Mask(int channel) {
+      assert(channel < channel_count_);
+
+      SpectrumMask* m = NULL;
+
+      pthread_mutex_lock(&config_writer_lock_);
+      AnalyzerConfig* config = LatestConfiguration();
+      if (config->MaskCount(channel) > 0) {
+            m = config->Mask(channel, 0);
+            FillMaskCounters(channel, m);
+      }
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+SpectrumMask* ThdAnalyzer::Mask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      SpectrumMask* m;
+
+      pthread_mutex_lock(&config_writer_lock_);
+      m = LatestConfiguration()->Mask(channel, name);
+      if (m != NULL) {
+            FillMaskCounters(channel, m);
+      }
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return m;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::FillMaskCounters(int channel, SpectrumMask* m) {
+
+      // Con config_writer_lock_ adquirido. Campos antiguos de SpectrumMask a partir del informe publicado de la
+      // máscara del mismo nombre: el hilo de procesado no los escribe, así que la aplicación los lee sin carreras.
+      pthread_mutex_lock(&channel_lock_);
+      int i = config_published_->FindMask(channel, m->Name());
+      const MaskReport* r = (i >= 0) ? &config_published_->channel_[channel].report[i] : NULL;
+      if (r == NULL || r->violations.empty() == true) {
+            m->error_count = (r != NULL) ? r->error_count : 0;
+            m->first_trespassing_frequency = nan("");
+            m->first_trespassing_value = nan("");
+            m->last_trespassing_frequency = nan("");
+            m->last_trespassing_value = nan("");
+      } else {
+            const double* pwsd = channel_[channel].pwsd;
+            int k1 = r->violations.front().first_bin;
+            int k2 = r->violations.back().last_bin;
+            m->error_count = r->error_count;
+            m->first_trespassing_frequency = AnalogFrequency(k1);
+            m->first_trespassing_value = 10.0 * log10(pwsd[k1]);
+            m->last_trespassing_frequency = AnalogFrequency(k2);
+            m->last_trespassing_value = 10.0 * log10(pwsd[k2]);
+      }
+      pthread_mutex_unlock(&channel_lock_);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::AddMask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      AnalyzerConfig* config = Configuration();
+      if (config->AddMask(channel, name) == NULL) {
+            delete config;
+            return 1;
+      }
+
+      // Falla si Reconfigure() ha cambiado el tamaño mientras tanto.
+      return SetConfiguration(config);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::RemoveMask(int channel, const std::string& name) {
+      assert(channel < channel_count_);
+
+      AnalyzerConfig* config = Configuration();
+      if (config->RemoveMask(channel, name) != 0) {
+            delete config;
+            return 1;
+      }
+
+      // Falla si Reconfigure() ha cambiado el tamaño mientras tanto.
+      return SetConfiguration(config);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::MaskCount(int channel) {
+      assert(channel < channel_count_);
+
+      int n;
+
+      pthread_mutex_lock(&config_writer_lock_);
+      n = LatestConfiguration()->MaskCount(channel);
+      pthread_mutex_unlock(&config_writer_lock_);
+
+      return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AnalyzerConfig* ThdAnalyzer::LatestConfiguration() {
+      // Con config_writer_lock_ adquirido. config_ solo lo cambia el hilo de procesado, con config_lock_ adquirido.
+      AnalyzerConfig* config;
+
+      pthread_mutex_lock(&config_lock_);
+      config = (config_pending_ != NULL) ? config_pending_ : config_;
+      pthread_mutex_unlock(&config_lock_);
+
+      return config;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::DestroyRetiredConfigurations() {
+      // Con config_writer_lock_ adquirido (o desde el destructor, con el hilo de procesado ya terminado).
+      AnalyzerConfig* list;
+
+      pthread_mutex_lock(&config_lock_);
+      list = config_retired_;
+      config_retired_ = NULL;
+      pthread_mutex_unlock(&config_lock_);
+
+      while (list != NULL) {
+            AnalyzerConfig* next = list->retired_next_;
+            delete list;
+            list = next;
+      }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::UpdateConfiguration() {
+      // Hilo de procesado, entre dos bloques. La configuración anterior no se retira todavía, los informes publicados
+      // apuntan a ella hasta que se publique el siguiente bloque (ver Publish()).
+      pthread_mutex_lock(&config_lock_);
+      if (config_pending_ != NULL) {
+            config_ = config_pending_;
+            config_pending_ = NULL;
+      }
+      pthread_mutex_unlock(&config_lock_);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetMaskReport(int channel, MaskReport* report) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(report != NULL);
+
+      int r = 1;
+
+      pthread_mutex_lock(&channel_lock_);
+      if (config_published_->channel_[channel].report.empty() == false) {
+            *report = config_published_->channel_[channel].report[0];
+            r = 0;
+      }
+      pthread_mutex_unlock(&channel_lock_);
+
+      return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetMaskReport(int channel, const std::string& name, MaskReport* report) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(report != NULL);
+
+      int r = 1;
+
+      pthread_mutex_lock(&channel_lock_);
+      int i = config_published_->FindMask(channel, name);
+      if (i >= 0) {
+            *report = config_published_->channel_[channel].report[i];
+            r = 0;
+      }
+      pthread_mutex_unlock(&channel_lock_);
+
+      return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::FrequencyBins(double f1, double f2, int* k1, int* k2) const {
+
+      // Con channel_lock_ adquirido: Reconfigure() cambia la frecuencia y el tamaño de bloque. Bins de f1 a f2, ambos
+      // incluidos, dentro de las frecuencias positivas; si no hay ninguno *k2 es *k1 - 1.
+      double analog_resolution = (double) sample_rate_ / (double) block_size_;
+      int half = block_size_ / 2;
+      *k1 = (int) floor(f1 / analog_resolution);
+      *k2 = (int) ceil(f2 / analog_resolution);
+      if (*k1 < 0) {
+            *k1 = 0;
+      }
+      if (*k1 > half) {
+            *k1 = half;
+      }
+      if (*k2 > half - 1) {
+            *k2 = half - 1;
+      }
+      if (*k2 < *k1 - 1) {
+            *k2 = *k1 - 1;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::EvaluateSnri(int channel, double f1, double f2) const {
+
+      // Con channel_lock_ adquirido. Antes se sumaban los N puntos del espectro, también las frecuencias negativas, y
+      // la imagen de la señal contaba como ruido. Ahora señal y ruido son de las frecuencias positivas.
+      int d1;
+      int d2;
+      FrequencyBins(f1, f2, &d1, &d2);
+      const double* sum = channel_[channel].psd_sum;
+      double sig = sum[d2 + 1] - sum[d1];
+      double acc = sum[block_size_ / 2] - sig;
+
+      return 10.0 * log10(sig / acc);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::EvaluateBandPower(int channel, double f1, double f2) const {
+
+      // Con channel_lock_ adquirido. La ventana es la del espectro publicado.
+      int k1;
+      int k2;
+      FrequencyBins(f1, f2, &k1, &k2);
+      const double* sum = channel_[channel].psd_sum;
+      const std::vector<double>& terms = config_published_->window_terms_;
+      double enbw = CosineWindowNoiseBandwidth(&terms[0], (int) terms.size());
+
+      // La misma normalización de la FFT que en Process(), ver el cálculo de las bandas de octava.
+      double fftnorm = 2.0 / (1 + sqrt(2));
+      return (sum[k2 + 1] - sum[k1]) * fftnorm * fftnorm / (2.0 * enbw);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::EvaluateHarmonics(int channel, double fundamental, std::vector<double>* amplitude,
+                                   double* frequency) const {
+
+      // Con channel_lock_ adquirido. Cada armónico se busca en el lóbulo principal de la ventana alrededor de su
+      // frecuencia teórica, tantos bins a cada lado como términos tiene, y su amplitud se corrige como en
+      // PeakAmplitude().
+      const Channel* ch = &channel_[channel];
+      const std::vector<double>& terms = config_published_->window_terms_;
+      int lobe = (int) terms.size();
+      int half = block_size_ / 2;
+      double fftnorm = 2.0 / (1 + sqrt(2));
+
+      double f0 = (fundamental > 0.0) ? fundamental / AnalogResolution() : ch->peak_bin;
+      *frequency = f0 * AnalogResolution();
+
+      size_t h;
+      int valid = 0;
+      for (h = 0; h < amplitude->size(); h++) {
+            (*amplitude)[h] = 0.0;
+            int center = (int) floor((h + 1) * f0 + 0.5);
+            if (center < 1 || center > half - 2) {
+                  continue;
+            }
+            int k1 = (center - lobe < 1) ? 1 : center - lobe;
+            int k2 = (center + lobe > half - 2) ? half - 2 : center + lobe;
+            int k = k1;
+            int i;
+            for (i = k1 + 1; i <= k2; i++) {
+                  if (ch->pwsd[i] > ch->pwsd[k]) {
+                        k = i;
+                  }
+            }
+            double gain;
+            InterpolatePeak(ch->pwsd, k, block_size_, &terms[0], (int) terms.size(), &gain);
+            (*amplitude)[h] = fftnorm * sqrt(ch->pwsd[k]) / gain;
+            if (h == 0) {
+                  valid = 1;
+            }
+      }
+      return valid;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::SNRI(int channel, double f1, double f2) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      double db = EvaluateSnri(channel, f1, f2);
+      pthread_mutex_unlock(&channel_lock_);
+
+      return db;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::SpectrumBandPower(int channel, double f1, double f2) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      double power = EvaluateBandPower(channel, f1, f2);
+      pthread_mutex_unlock(&channel_lock_);
+
+      return power;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::Measure(const MeasurementList& list, MeasurementReport* report) {
+      assert(internal_state_ != kNotInitialized);
+      assert(report != NULL);
+
+      // La memoria de los resultados se prepara antes del bloqueo. Si |report| se reutiliza de una llamada a otra
+      // con la misma lista ya no se pide memoria, salvo para informes de máscara con más intervalos.
+      int n = list.Count();
+      report->results.resize(n);
+      int i;
+      for (i = 0; i < n; i++) {
+            const Measurement& m = list.Get(i);
+            assert(m.channel < channel_count_);
+            MeasurementResult* r = &report->results[i];
+            r->type = m.type;
+            r->channel = m.channel;
+            r->valid = true;
+            r->value = 0.0;
+            r->frequency = 0.0;
+            r->harmonics.resize((m.type == Measurement::kHarmonics) ? m.harmonic_count : 0);
+      }
+
+      // Un solo bloqueo para todas las medidas: son todas del mismo bloque, el que se publicó el último.
+      pthread_mutex_lock(&channel_lock_);
+
+      report->block = block_count_;
+      for (i = 0; i < n; i++) {
+            const Measurement& m = list.Get(i);
+            MeasurementResult* r = &report->results[i];
+            const Channel* ch = &channel_[m.channel];
+
+            switch (m.type) {
+            case Measurement::kPeak:
+                  r->value = ch->peak_amplitude;
+                  r->frequency = ch->peak_bin * AnalogResolution();
+                  r->valid = (ch->peakf >= 0);
+                  break;
+            case Measurement::kBandPower:
+                  r->value = EvaluateBandPower(m.channel, m.f1, m.f2);
+                  break;
+            case Measurement::kSnri:
+                  r->value = EvaluateSnri(m.channel, m.f1, m.f2);
+                  break;
+            case Measurement::kHarmonics: {
+                  r->valid = (EvaluateHarmonics(m.channel, m.f1, &r->harmonics, &r->frequency) == 1 &&
+                              r->harmonics[0] > 0.0);
+                  double sum = 0.0;
+                  size_t h;
+                  for (h = 1; h < r->harmonics.size(); h++) {
+                        sum += r->harmonics[h] * r->harmonics[h];
+                  }
+                  r->value = (r->valid == true) ? sqrt(sum) / r->harmonics[0] : 0.0;
+                  break;
+            }
+            case Measurement::kMask: {
+                  int k = config_published_->FindMask(m.channel, m.mask_name);
+                  r->valid = (k >= 0);
+                  if (k >= 0) {
+                        const MaskReport& mr = config_published_->channel_[m.channel].report[k];
+                        r->mask.block = mr.block;
+                        r->mask.error_count = mr.error_count;
+                        r->mask.violations.assign(mr.violations.begin(), mr.violations.end());
+                        r->value = mr.error_count;
+                  }
+                  break;
+            }
+            }
+      }
+
+      pthread_mutex_unlock(&channel_lock_);
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetLevelStats(int channel, LevelStats* stats) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      *stats = channel_[channel].level;
+      int block = block_count_;
+      pthread_mutex_unlock(&channel_lock_);
+      return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::RmsAmplitude(int channel) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      double rms = channel_[channel].level.rms;
+      pthread_mutex_unlock(&channel_lock_);
+      return rms;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::PowerSpectralDensity(int channel, int frequency_index) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(frequency_index >= 0 && frequency_index < block_size_);
+
+      double ps;
+
+      // Frecuencias negativas: la imagen de las positivas.
+      if (frequency_index > block_size_ / 2) {
+            frequency_index = block_size_ - frequency_index;
+      }
+
+      pthread_mutex_lock(&channel_lock_);      
+      ps = channel_[channel].pwsd[frequency_index];
+      pthread_mutex_unlock(&channel_lock_);
+
+      return ps;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetSpectrum(int channel, std::vector<double>* psd) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(psd != NULL);
+
+      int bins = block_size_ / 2 + 1;
+      psd->resize(bins);
+
+      pthread_mutex_lock(&channel_lock_);
+      memcpy(&(*psd)[0], channel_[channel].pwsd, bins * sizeof(double));
+      int count = block_count_;
+      pthread_mutex_unlock(&channel_lock_);
+
+      return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetSpectrum(int channel, std::vector<float>* psd) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(psd != NULL);
+
+      int bins = block_size_ / 2 + 1;
+      psd->resize(bins);
+
+      pthread_mutex_lock(&channel_lock_);
+      if (snapshot_encoding_ == kSnapshotFloat32) {
+            memcpy(&(*psd)[0], channel_[channel].snapshot, bins * sizeof(float));
+      } else {
+            ConvertToFloat(channel_[channel].pwsd, bins, &(*psd)[0]);
+      }
+      int count = block_count_;
+      pthread_mutex_unlock(&channel_lock_);
 
-fatal_error:
-      error_description_ = snd_strerror(err);
-      return 1;
+      return count;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int ThdAnalyzer::FindPeak(int channel) {
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::GetSpectrumCodes(int channel, std::vector<uint16_t>* codes) {
       assert(internal_state_ != kNotInitialized);
       assert(channel < channel_count_);
-      return channel_[channel].peakf;
-}
+      assert(codes != NULL);
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-double ThdAnalyzer::SNRI(int channel, double f1, double f2) {
+      if (snapshot_encoding_ != kSnapshotDecibels16) {
+            codes->clear();
+            return -1;
+      }
 
-      // Estimación de la SNRI considerando la banda (af1, af2) = (900, 1100) Hz
-      double analog_resolution = (double) sample_rate_ / (double) block_size_; 
-      int d1 = (int) floor(f1 / analog_resolution);
-      int d2 = (int) ceil (f2 / analog_resolution);
+      int bins = block_size_ / 2 + 1;
+      codes->resize(bins);
 
+      pthread_mutex_lock(&channel_lock_);
+      memcpy(&(*codes)[0], channel_[channel].snapshot, bins * sizeof(uint16_t));
+      int count = block_count_;
+      pthread_mutex_unlock(&channel_lock_);
 
-      double snri;
-      double acc;
-      double sig;
-      
-      sig = 0.0;
-      acc = 0.0;
+      return count;
+}
 
-      pthread_mutex_lock(&channel_lock_);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double ThdAnalyzer::PowerSpectralDensityDecibels(int channel, int frequency_index) {
+      assert(internal_state_ != kNotInitialized);
+      assert(channel < channel_count_);
+      assert(frequency_index >= 0 && frequency_index < block_size_);
 
-      double* psd = channel_[channel].pwsd;
-      assert(psd != NULL);
+      double db;
 
-      int i;
-      for (i = 0; i < channel_[channel].size; i++) {
-            acc += psd[i]; // !! CONCURRENCIA !! TODO: pthread_mutex_lock/unlock
-      }
-      
-      // d1 y d2 ambos inclusive
-      for (i = d1; i < d2 + 1; i++) {
-            sig += psd[i]; // !! CONCURRENCIA !! TODO: pthread_mutex_lock/unlock
+      if (frequency_index > block_size_ / 2) {
+            frequency_index = block_size_ - frequency_index;
       }
-      
-      pthread_mutex_unlock(&channel_lock_);
 
-      acc -= sig;
-      snri = sig / acc;
+      pthread_mutex_lock(&channel_lock_);
+      db = 10.0 * log10(channel_[channel].pwsd[frequency_index]);
+      pthread_mutex_unlock(&channel_lock_);
 
-      double db = 10.0 * log10(snri);
       return db;
 }
 
-/*
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-double ThdAnalyzer::RmsAmplitude(int channel) {
-assert(internal_state_ != kNotInitialized);
-assert(channel < channel_count_);
-return channel_[channel].rms;
-}
-*/
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-double ThdAnalyzer::PowerSpectralDensity(int channel, int frequency_index) {
+double ThdAnalyzer::AveragedPowerSpectralDensity(int channel, int frequency_index) {
       assert(internal_state_ != kNotInitialized);
       assert(channel < channel_count_);
-      assert(frequency_index < block_size_);
+      assert(frequency_index < block_size_ / 2);
 
       double ps;
 
-      pthread_mutex_lock(&channel_lock_);      
-      ps = channel_[channel].pwsd[frequency_index];
+      pthread_mutex_lock(&channel_lock_);
+      if (channel_[channel].avg_none == true) {
+            ps = channel_[channel].pwsd[frequency_index];
+      } else {
+            ps = channel_[channel].avg[frequency_index];
+      }
       pthread_mutex_unlock(&channel_lock_);
 
       return ps;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-double ThdAnalyzer::PowerSpectralDensityDecibels(int channel, int frequency_index) {
+double ThdAnalyzer::AveragedPowerSpectralDensityDecibels(int channel, int frequency_index) {
+      return 10.0 * log10(AveragedPowerSpectralDensity(channel, frequency_index));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::AveragedBlockCount(int channel) {
       assert(internal_state_ != kNotInitialized);
       assert(channel < channel_count_);
-      assert(frequency_index < block_size_);
 
-      double db;
+      int n;
 
       pthread_mutex_lock(&channel_lock_);
-      db = 10.0 * log10(channel_[channel].pwsd[frequency_index]);
+      n = channel_[channel].avg_count;
       pthread_mutex_unlock(&channel_lock_);
 
-      return db;
+      return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ResetAveraging(int channel) {
+      assert(channel < channel_count_);
+
+      pthread_mutex_lock(&channel_lock_);
+      channel_[channel].avg_reset = true;
+      pthread_mutex_unlock(&channel_lock_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -321,6 +1871,12 @@ int ThdAnalyzer::SamplingFrequency() const {
       return sample_rate_;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::CaptureSamplingFrequency() const {
+      assert(internal_state_ != kNotInitialized);
+      return capture_rate_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 double ThdAnalyzer::AnalogResolution() const {
       assert(internal_state_ != kNotInitialized);
@@ -336,135 +1892,180 @@ void* ThdAnalyzer::ThreadFuncHelper(void* p) {
 
 void* ThdAnalyzer::ThreadFunc() {
 
-      Stopwatch watch;
-      uint64_t t0,t1,t2;
-
-      /*
-        if (AdcSetup() != 0) {
-        return NULL;
-        };
-      */
-      int err;
-      if ((err = snd_pcm_prepare(capture_handle_)) < 0) {
-            error_description_ = snd_strerror(err);
-            goto fatal_error;
-      }
+      uint64_t t0;
+      uint64_t t1;
 
+      SetTraceThreadName("analyzer");
+
+      // Fallos de página de la pila antes del primer bloque.
+      if (prefault_ == true) {
+            PrefaultStack();
+      }
 
-      watch.Start();
+      if (source_->Prepare() != 0) {
+            error_description_ = source_->ErrorDescription();
+            goto fatal_error;
+      }
 
       while (1) {
 
             // Quedo a la espera de que la aplicación principal me permita continuar
+            // También se queda aquí, entre dos bloques, mientras Reconfigure() cambia los búferes (park_request_).
             pthread_mutex_lock(&lock_);                  
-            while (internal_state_ != kRunning) {
-                  //snd_pcm_drop(capture_handle_);
+            while ((internal_state_ != kRunning || park_request_ == true) && exit_thread_ == false) {
+                  idle_ = true;
+                  pthread_cond_broadcast(&idle_cond_);
                   pthread_cond_wait(&can_continue_, &lock_);
             }
+            idle_ = false;
             pthread_mutex_unlock(&lock_);
 
-            int r;
-            int frames = block_size_;
-            //int16_t* b = buf_data_;
-            int32_t* b = buf_data_;
-
-            watch.Reset();
-            do {
-                  // Bloqueante
-                  r = snd_pcm_readi(capture_handle_, b, frames);
-                  if (r == -EPIPE) {
-                        // OVERRUN
-                        overrun_count_++;
-                        
-                        r = snd_pcm_recover(capture_handle_, r, 1); //1 = silent
-                        if (r < 0) {
-                              goto fatal_error;
-                        }
-                        continue;
-                  }
-
-                  // 2 int16_t por frame
-                  b += r * 2; 
-                  frames -= r;
+            if (exit_thread_ == true) {
+                  break;
+            }
 
-            } while (r >= 1 && frames > 0);
+            int r;
 
-            int i;
-            t0 = watch.ElapsedMicroseconds();
+            t0 = MonotonicNanoseconds();
+            // Bloqueante en las fuentes de tiempo real, las de fichero entregan el bloque enseguida.
+            {
+                  TraceSpan span("capture");
+                  r = source_->Read(buf_data_, block_size_ * decimation_);
+            }
+            if (r < 0) {
+                  error_description_ = source_->ErrorDescription();
+                  goto fatal_error;
+            }
+            overrun_count_ = source_->OverrunCount();
+
+            // Overruns durante esta lectura. stage_ns_ aún tiene las duraciones del bloque anterior.
+            XrunRecord xrun;
+            while (source_->PopXrun(&xrun) == true) {
+                  xrun.block = block_count_;
+                  xrun.previous_process_ns = stage_ns_[AnalyzerStats::kStageProcess];
+                  xrun_journal_->Append(xrun);
+            }
+            if (r < block_size_ * decimation_) {
+                  // Fin de los datos, el último bloque incompleto se descarta.
+                  goto finished;
+            }
 
+            int c;
+            t1 = MonotonicNanoseconds();
+            stage_ns_[AnalyzerStats::kStageCapture] = t1 - t0;
+            block_timestamp_ = t1 / 1000;
 
+            // Frontera entre bloques: si la aplicación ha entregado una configuración nueva se usa desde este bloque.
+            UpdateConfiguration();
 
-            watch.Reset();
+            t0 = MonotonicNanoseconds();
             // Conversión de formato y a coma flotante y normalización de las muestras en el intervalo 
-            // semiabierto [-1.0, 1.0)
-            for (i = 0; i < block_size_; i++) {
-
-                  // 16 bits con signo
-                  //channel_[0].data[i] = ((double) buf_data_[2 * i + 0]) / 32768.0;
-                  //channel_[1].data[i] = ((double) buf_data_[2 * i + 1]) / 32768.0;
-
-                  // 32 bits con signo
-                  channel_[0].data[i] = ((double) buf_data_[2 * i + 0]) / 2147483648.0;
-                  channel_[1].data[i] = ((double) buf_data_[2 * i + 1]) / 2147483648.0;
-                  
-                  assert(channel_[0].data[i] < 1.0);
-                  assert(channel_[0].data[i] >= -1.0);
-                  assert(channel_[1].data[i] < 1.0);
-                  assert(channel_[1].data[i] >= -1.0);
-            }
-            t1 = watch.ElapsedMicroseconds();
-
-            // Señales sintéticas para depuración
-            /*
-              static int z = 0;
-              for (i = 0; i < block_size_; i++) {
-              // Frecuencia en Hz
-              channel_[0].data[i] = 0.01 * cos(1000 * M_PI / (sample_rate_ / 2) * z);
-              channel_[1].data[i] = 0.95 * sin(2000 * M_PI / (sample_rate_ / 2) * z);
-              z++;                  
-              }
-            */
-
-            watch.Reset();           
-            Process();
-            block_count_++;
-
-            t2 = watch.ElapsedMicroseconds();
-            if (block_count_ % 4 == 0) {
-                  printf("TP: %llu %llu %llu us\n", t0, t1, t2);
+            // semiabierto [-1.0, 1.0). La ventana, ya normalizada, y las estadísticas de nivel se calculan en la
+            // misma pasada.
+            {
+                  TraceSpan span("convert");
+                  const double* w = &config_->window_coefficients_[0];
+                  bool filter_bands = (bands_ != NULL && bands_->GetMethod() == OctaveBands::kMethodFilterBank);
+                  if (decimation_ == 1 && views_.empty() == true && filter_bands == false) {
+                        for (c = 0; c < channel_count_; c++) {
+                              ConvertSamples(c, w, block_size_, channel_[c].data);
+                        }
+                  } else {
+                        for (c = 0; c < channel_count_; c++) {
+                              if (decimation_ == 1) {
+                                    ConvertSamples(c, NULL, block_size_, channel_[c].data);
+                              } else {
+                                    // Filtro antialiasing y decimación entre la conversión y la ventana.
+                                    TraceSpan span("decimate");
+                                    Decimator* d = channel_[c].decimator;
+                                    ConvertSamples(c, NULL, d->InputSize(), d->Input());
+                                    d->Process(channel_[c].data);
+                              }
+                              // Las vistas y el banco de filtros de las bandas reciben la señal antes de la ventana
+                              PushViews(c, channel_[c].data);
+                              if (filter_bands == true) {
+                                    TraceSpan span("bands");
+                                    bands_->Filter(c, channel_[c].data,
+                                                   &band_power_next_[c * bands_->BandCount()]);
+                              }
+                              ApplyWindow(w, block_size_, channel_[c].data);
+                        }
+                  }
+                  // Canal nulo de relleno, la FFT del bloque anterior lo ha sobreescrito.
+                  for (c = channel_count_; c < channel_storage_count_; c++) {
+                        memset(channel_[c].data, 0, block_size_ * sizeof(double));
+                  }
             }
+            t1 = MonotonicNanoseconds();
+            stage_ns_[AnalyzerStats::kStageConvert] = t1 - t0;
 
+            Process();
 
-            if (exit_thread_ == true) {
-                  break;
+            if (views_.empty() == false) {
+                  TraceSpan span("views");
+                  ProcessViews();
             }
+
+            stage_ns_[AnalyzerStats::kStageProcess] = MonotonicNanoseconds() - t0;
+            RecordStats();
       }
 
+      pthread_mutex_lock(&lock_);
       internal_state_ = kStopped;
-      snd_pcm_close(capture_handle_);
-      capture_handle_ = NULL;
+      pthread_cond_broadcast(&idle_cond_);
+      pthread_mutex_unlock(&lock_);
+      source_->Close();
+      return NULL;
+
+finished:
+      pthread_mutex_lock(&lock_);
+      internal_state_ = kFinished;
+      pthread_cond_broadcast(&idle_cond_);
+      pthread_mutex_unlock(&lock_);
+      source_->Close();
       return NULL;
 
 fatal_error:
+      pthread_mutex_lock(&lock_);
       internal_state_ = kCrashed;
-      snd_pcm_close(capture_handle_);
-      capture_handle_ = NULL;
+      pthread_cond_broadcast(&idle_cond_);
+      pthread_mutex_unlock(&lock_);
+      source_->Close();
       return NULL;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ConvertSamples(int channel, const double* window, int n, double* out) {
+
+      SampleStats s;
+      ConvertChannelStats(buf_data_, channel_count_, channel, window, n, config_->clip_threshold_, out, &s);
+
+      LevelStats* l = &channel_[channel].level_next;
+      l->sample_count = n;
+      l->rms = sqrt(s.sum_squares / n);
+      l->dc = s.sum / n;
+      l->min = ((double) s.min) / 2147483648.0;
+      l->max = ((double) s.max) / 2147483648.0;
+      l->peak = (-l->min > l->max) ? -l->min : l->max;
+      l->crest_factor = (l->rms > 0.0) ? l->peak / l->rms : 0.0;
+      l->clip_count = s.clip_count;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 int ThdAnalyzer::Process() {
 
       int c;
-      int k;
       int N;
       double* re;
       double* im;
       double fftnorm;
-      double Xre;
-      double Xim;
+      uint64_t t0;
+      uint64_t t1;
+
+      TraceSpan process_span("process");
 
       N = block_size_;
+      t0 = MonotonicNanoseconds();
       
       // La rutina de cálculo de la FFT que utilizo no normaliza los coeficientes de la DFT de la forma estándar.
       //fftnorm = 1.20;
@@ -478,129 +2079,476 @@ int ThdAnalyzer::Process() {
       //
 
 
-      for (c = 0; c < channel_count_; c += 2) {
+      for (c = 0; c < channel_storage_count_; c += 2) {
 
             re = channel_[c + 0].data;
             im = channel_[c + 1].data;
 
             // Esta función calcula los coeficientes "in-place", sobreescribiendo los valores previos de señal.
-            thd_analyzer::FFT(1, block_size_log2_, re, im);
-
-            pthread_mutex_lock(&channel_lock_);
-
-            for (k = 0; k < N; k++) {
-                  // Señal c + 0
-                  Xre =  ( re[k] + re[N-k] ) / fftnorm;
-                  Xim =  ( im[k] - im[N-k] ) / fftnorm;
-                  channel_[c + 0].pwsd[k] = Xre*Xre + Xim*Xim; // NO SQRT
-                  //channel_[c + 0].pwsd[k] = sqrt(Xre*Xre + Xim*Xim); // NO SQRT
-                  //assert(channel_[c + 0].pwsd[k] <= 1.000001);
- 
-                  // Señal c + 1
-                  Xre =  ( im[k] + im[N-k] ) / fftnorm;
-                  Xim =  ( re[N-k] - re[k] ) / fftnorm;
-                  channel_[c + 1].pwsd[k] = Xre*Xre + Xim*Xim; // NO SQRT
-                  //channel_[c + 1].pwsd[k] = sqrt(Xre*Xre + Xim*Xim); // NO SQRT
-                  //assert(channel_[c + 0].pwsd[k] <= 1.000001);
+            {
+                  TraceSpan span("fft");
+                  thd_analyzer::FFT(1, block_size_log2_, re, im);
             }
 
-            pthread_mutex_unlock(&channel_lock_);
-
+            TraceSpan span("psd");
+
+            // Se escribe en pwsd_next, que solo usa este hilo, así que no hace falta channel_lock_. El espectro se
+            // publica entero al final del bloque en Publish(). El canal nulo de relleno no se calcula.
+            TwoRealPowerSpectra(re, im, N, fftnorm, channel_[c + 0].pwsd_next,
+                                (c + 1 < channel_count_) ? channel_[c + 1].pwsd_next : NULL);
+
+            // Promediado, sumas acumuladas e instantánea compacta, justo después de calcular el espectro mientras
+            // aún está en la caché.
+            Average(c + 0);
+            PrefixSum(channel_[c + 0].pwsd_next, N / 2, channel_[c + 0].psd_sum_next);
+            EncodeSnapshot(c + 0);
+            if (c + 1 < channel_count_) {
+                  Average(c + 1);
+                  PrefixSum(channel_[c + 1].pwsd_next, N / 2, channel_[c + 1].psd_sum_next);
+                  EncodeSnapshot(c + 1);
+            }
       }
 
 
+      t1 = MonotonicNanoseconds();
+      stage_ns_[AnalyzerStats::kStageSpectrum] = t1 - t0;
+      t0 = t1;
+
       // pwsd[k] es la amplitud al cuadrado de la frecuencia k-ésima de la señal. Por ejemplo: un tono 0.5*cos(wn) lo
       // detecta con amplitud 0.25. Hay que aplicar la raiz cuadrada si queremos obtener la amplitud, esto se hace así
       // para reducir carga computacional (no hay que llamar a sqrt() en cada muestra).
 
-      int max_index;
-      double max_value;
-
       // Proceso canal por canal
       // Búque del máximo absoluto (peakv) y la posición en la que está (peakf)
-      for (c = 0; c < channel_count_; c++) {
-           
-            // *** PROCESADO: Búsqueda del máximo absoluto
-            max_value = 1e-16;  // Umbral mínimo de detección 
-            max_index = -1;     // -1 significa que ninguna de las frecuencias tiene una potencia que supere el umbral prefijado.
-
-            // block_size_ / 2 = solo frecuencias positivas
-            for (k = 0; k < block_size_ / 2; k++) {
-                  if (channel_[c].pwsd[k] > max_value) {
-                        max_value = channel_[c].pwsd[k];
-                        max_index = k;
-                  }
-            }
-            
-            channel_[c].peakv = max_value; 
-            channel_[c].peakf = max_index;
-            
-            // *** PROCESADO: Comprobación de la máscara
-            if (channel_[c].mask != NULL) {
-
-                  bool first = true;
-                  SpectrumMask* m = channel_[c].mask;
-                  
-                  m->error_count = 0;
-                  m->last_trespassing_frequency = nan("");
-                  m->last_trespassing_value = nan("");
-                  m->first_trespassing_frequency = nan("");
-                  m->first_trespassing_value = nan("");
+      {
+            TraceSpan span("peak");
+            for (c = 0; c < channel_count_; c++) {
 
+                  // *** PROCESADO: Búsqueda del máximo absoluto. 1e-16 es el umbral mínimo de detección, -1 significa
+                  // que ninguna de las frecuencias tiene una potencia que supere el umbral prefijado.
                   // block_size_ / 2 = solo frecuencias positivas
-                  for (k = 0; k < block_size_ / 2; k++) {
-                        
-                        double db = 10.0 * log10(channel_[c].pwsd[k]);
-                        
-                        if (db > m->value[k]) {
-                              m->error_count++;
-                              if (first == true) {
-                                    first = false;
-                                    m->first_trespassing_frequency = AnalogFrequency(k);
-                                    m->first_trespassing_value = db;
-                                    m->last_trespassing_frequency = AnalogFrequency(k);
-                                    m->last_trespassing_value = db;
-                              } else {
-                                    m->last_trespassing_frequency = AnalogFrequency(k);
-                                    m->last_trespassing_value = db;
-                              }
-                        }
+                  channel_[c].peakf_next = FindMaximum(channel_[c].pwsd_next, block_size_ / 2, 1e-16,
+                                                       &channel_[c].peakv_next);
+
+                  // Posición y amplitud exactas del tono. pwsd es (A/2 |W(d)|)^2 * (2 / fftnorm)^2 para un tono
+                  // A cos(wn), con W la respuesta de la ventana normalizada.
+                  int k = channel_[c].peakf_next;
+                  if (k < 0) {
+                        channel_[c].peak_bin_next = 0.0;
+                        channel_[c].peak_amplitude_next = 0.0;
+                        continue;
                   }
+                  double gain;
+                  double d = InterpolatePeak(channel_[c].pwsd_next, k, N, &config_->window_terms_[0],
+                                             (int) config_->window_terms_.size(), &gain);
+                  channel_[c].peak_bin_next = k + d;
+                  channel_[c].peak_amplitude_next = fftnorm * sqrt(channel_[c].pwsd_next[k]) / gain;
+            }
+      }
+
+      // *** PROCESADO: Comprobación de las máscaras.
+      {
+            TraceSpan span("masks");
+            for (c = 0; c < channel_count_; c++) {
+                  EvaluateMasks(c);
+            }
+      }
 
+      // Bandas de octava a partir del espectro. pwsd es |X|^2 / fftnorm^2 con la ganancia coherente de la ventana
+      // normalizada a 1, así que un tono A cos(wn) suma A^2 / fftnorm^2 veces el ancho de banda equivalente de
+      // ruido y su potencia es A^2 / 2.
+      if (bands_ != NULL && bands_->GetMethod() == OctaveBands::kMethodSpectrum) {
+            TraceSpan span("bands");
+            double enbw = CosineWindowNoiseBandwidth(&config_->window_terms_[0], (int) config_->window_terms_.size());
+            double scale = fftnorm * fftnorm / (2.0 * enbw);
+            for (c = 0; c < channel_count_; c++) {
+                  bands_->SumBins(channel_[c].pwsd_next, scale, &band_power_next_[c * bands_->BandCount()]);
             }
+      }
+
+      t1 = MonotonicNanoseconds();
+      stage_ns_[AnalyzerStats::kStageMasks] = t1 - t0;
+      t0 = t1;
+
+      {
+            TraceSpan span("publish");
+            Publish();
+      }
+
+      // El historial tiene su propio bloqueo, se escribe después de publicar para no retener channel_lock_.
+      // Solo este hilo escribe pwsd, así que se puede leer sin channel_lock_.
+      {
+            TraceSpan span("history");
+            for (c = 0; c < channel_count_; c++) {
+                  if (channel_[c].history != NULL) {
+                        channel_[c].history->Append(block_count_, block_timestamp_, channel_[c].pwsd);
+                  }
+            }
+      }
 
+      // Grabación: Write() solo copia el espectro a la cola del hilo de escritura, nunca espera al disco.
+      TraceSpan record_span("record");
+      pthread_mutex_lock(&recorder_lock_);
+      if (recorder_ != NULL) {
+            for (c = 0; c < channel_count_; c++) {
+                  recorder_psd_[c] = channel_[c].pwsd;
+            }
+            block_dropped_ = (recorder_->Write(block_count_, block_timestamp_, &recorder_psd_[0]) != 0);
       }
+      pthread_mutex_unlock(&recorder_lock_);
+
+      stage_ns_[AnalyzerStats::kStagePublish] = MonotonicNanoseconds() - t0;
 
       return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::RecordStats() {
+
+      int overrun_count = source_->OverrunCount();
+
+      pthread_mutex_lock(&stats_lock_);
+      for (int i = 0; i < AnalyzerStats::kStageCount; i++) {
+            stats_.latency[i].Record(stage_ns_[i]);
+      }
+      stats_.block_count++;
+      stats_.overrun_count += overrun_count - stats_overrun_count_;
+      if (block_dropped_ == true) {
+            stats_.dropped_count++;
+      }
+      pthread_mutex_unlock(&stats_lock_);
+
+      stats_overrun_count_ = overrun_count;
+      block_dropped_ = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::Stats(AnalyzerStats* stats, bool reset) {
+      assert(stats != NULL);
+
+      // Copia y puesta a cero con el mismo bloqueo, el hilo de procesado no puede registrar un bloque entre medias.
+      pthread_mutex_lock(&stats_lock_);
+      *stats = stats_;
+      if (reset == true) {
+            ClearStats();
+      }
+      pthread_mutex_unlock(&stats_lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ResetStats() {
+      pthread_mutex_lock(&stats_lock_);
+      ClearStats();
+      pthread_mutex_unlock(&stats_lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::ClearStats() {
+      // Con stats_lock_ adquirido
+      for (int i = 0; i < AnalyzerStats::kStageCount; i++) {
+            stats_.latency[i].Reset();
+      }
+      stats_.block_count = 0;
+      stats_.overrun_count = 0;
+      stats_.dropped_count = 0;
+      stats_.reset_timestamp_us = MonotonicNanoseconds() / 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const char* AnalyzerStats::StageName(int stage) {
+      static const char* names[kStageCount] = { "capture", "convert", "spectrum", "masks", "publish", "process" };
+
+      assert(stage >= 0 && stage < kStageCount);
+      return names[stage];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::Average(int channel) {
+
+      Channel* ch = &channel_[channel];
+      const AnalyzerConfig::ChannelConfig* cc = &config_->channel_[channel];
+
+      // avg es el promedio publicado. Solo lo escribe este hilo (en Publish()), así que se puede leer sin bloqueos.
+      const double* x = ch->pwsd_next;
+      const double* prev = ch->avg;
+      double* next = ch->avg_next;
+      double* sum = ch->avg_sum;
+      int n = block_size_ / 2;
+      int k;
+
+      // ResetAveraging() o cambio de modo en la configuración. La aplicación escribe avg_reset con channel_lock_.
+      pthread_mutex_lock(&channel_lock_);
+      bool reset = ch->avg_reset;
+      pthread_mutex_unlock(&channel_lock_);
+      ch->avg_reset_done = reset;
+      if (cc->averaging != ch->avg_mode || cc->averaging_parameter != ch->avg_parameter) {
+            ch->avg_mode = cc->averaging;
+            ch->avg_parameter = cc->averaging_parameter;
+            reset = true;
+      }
+      if (cc->averaging == AnalyzerConfig::kAveragingLinear && ch->avg_count >= cc->group_size) {
+            // Grupo completo, empieza otro
+            reset = true;
+      }
+
+      // Sin promediado no se copia nada: AveragedPowerSpectralDensity() lee el espectro publicado.
+      ch->avg_none_next = (cc->averaging == AnalyzerConfig::kAveragingNone);
+      if (ch->avg_none_next == true) {
+            ch->avg_count_next = 1;
+            return;
+      }
+
+      if (reset == true) {
+            for (k = 0; k < n; k++) {
+                  next[k] = x[k];
+                  sum[k] = x[k];
+            }
+            ch->avg_count_next = 1;
+            return;
+      }
+
+      switch (cc->averaging) {
+      case AnalyzerConfig::kAveragingExponential: {
+            double alpha = cc->alpha;
+            for (k = 0; k < n; k++) {
+                  next[k] = prev[k] + alpha * (x[k] - prev[k]);
+            }
+            break;
+      }
+      case AnalyzerConfig::kAveragingLinear: {
+            double inv = 1.0 / (double) (ch->avg_count + 1);
+            for (k = 0; k < n; k++) {
+                  sum[k] += x[k];
+                  next[k] = sum[k] * inv;
+            }
+            break;
+      }
+      case AnalyzerConfig::kAveragingPeakHold:
+            for (k = 0; k < n; k++) {
+                  next[k] = (x[k] > prev[k]) ? x[k] : prev[k];
+            }
+            break;
+      case AnalyzerConfig::kAveragingMinHold:
+            for (k = 0; k < n; k++) {
+                  next[k] = (x[k] < prev[k]) ? x[k] : prev[k];
+            }
+            break;
+      default:
+            break;
+      }
+
+      ch->avg_count_next = ch->avg_count + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::EncodeSnapshot(int channel) {
+      Channel* ch = &channel_[channel];
+      int bins = block_size_ / 2 + 1;
+
+      if (snapshot_encoding_ == kSnapshotFloat32) {
+            ConvertToFloat(ch->pwsd_next, bins, (float*) ch->snapshot_next);
+      } else if (snapshot_encoding_ == kSnapshotDecibels16) {
+            QuantizeDecibels(ch->pwsd_next, bins, snapshot_min_db_, snapshot_step_, 65535,
+                             (uint16_t*) ch->snapshot_next);
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::EvaluateMasks(int channel) {
+
+      // Número de puntos del espectro que se comparan con todas las máscaras antes de pasar al siguiente trozo, 4 kB
+      // de pwsd, que se quedan en la caché L1 mientras se recorren todas las máscaras.
+      const int kChunk = 512;
+
+      const double* psd = channel_[channel].pwsd_next;
+      AnalyzerConfig::ChannelConfig* cc = &config_->channel_[channel];
+
+      size_t m;
+      size_t n = cc->masks.size();
+
+      for (m = 0; m < n; m++) {
+            cc->report_next[m].block = block_count_ + 1;
+            cc->report_next[m].error_count = 0;
+            cc->report_next[m].violations.clear();
+      }
+
+      // block_size_ / 2 = solo frecuencias positivas
+      int k1;
+      int k2;
+      for (k1 = 0; k1 < block_size_ / 2; k1 += kChunk) {
+            k2 = k1 + kChunk;
+            if (k2 > block_size_ / 2) {
+                  k2 = block_size_ / 2;
+            }
+            for (m = 0; m < n; m++) {
+                  cc->masks[m]->Evaluate(psd, k1, k2, &cc->report_next[m]);
+            }
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void ThdAnalyzer::Publish() {
+
+      // Intercambio de punteros, el bloqueo dura muy poco y todas las medidas de un canal (espectro, máximo e informe
+      // de la máscara) pasan a ser visibles a la vez.
+      pthread_mutex_lock(&channel_lock_);
+
+      block_count_++;
+
+      // Si la configuración ha cambiado en este bloque, la anterior deja de estar publicada y se retira. La destruye
+      // la aplicación en su siguiente cambio de configuración.
+      if (config_published_ != config_) {
+            pthread_mutex_lock(&config_lock_);
+            config_published_->retired_next_ = config_retired_;
+            config_retired_ = config_published_;
+            pthread_mutex_unlock(&config_lock_);
+            config_published_ = config_;
+      }
+
+      // Potencia de las bandas de todos los canales, vector::swap() no pide memoria.
+      band_power_.swap(band_power_next_);
+
+      int c;
+      for (c = 0; c < channel_count_; c++) {
+            Channel* ch = &channel_[c];
+
+            double* tmp = ch->pwsd;
+            ch->pwsd = ch->pwsd_next;
+            ch->pwsd_next = tmp;
+
+            tmp = ch->psd_sum;
+            ch->psd_sum = ch->psd_sum_next;
+            ch->psd_sum_next = tmp;
+
+            void* snapshot = ch->snapshot;
+            ch->snapshot = ch->snapshot_next;
+            ch->snapshot_next = snapshot;
+
+            ch->peakv = ch->peakv_next;
+            ch->peakf = ch->peakf_next;
+            ch->peak_bin = ch->peak_bin_next;
+            ch->peak_amplitude = ch->peak_amplitude_next;
+            ch->level = ch->level_next;
+
+            tmp = ch->avg;
+            ch->avg = ch->avg_next;
+            ch->avg_next = tmp;
+            ch->avg_count = ch->avg_count_next;
+            ch->avg_none = ch->avg_none_next;
+            if (ch->avg_reset_done == true) {
+                  ch->avg_reset = false;
+            }
+
+            AnalyzerConfig::ChannelConfig* cc = &config_->channel_[c];
+
+            size_t i;
+            for (i = 0; i < cc->masks.size(); i++) {
+                  MaskReport* r = &cc->report[i];
+                  r->block = cc->report_next[i].block;
+                  r->error_count = cc->report_next[i].error_count;
+                  r->violations.swap(cc->report_next[i].violations);
+            }
+      }
+
+      pthread_mutex_unlock(&channel_lock_);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 int ThdAnalyzer::GnuplotFileDump(std::string file_name) {
+
+      TraceSpan span("gnuplot dump");
+
+      int bins = block_size_ / 2;
+      std::vector<double> psd((size_t) channel_count_ * bins);
+
+      int i;
+      int j;
+
+      // Solo se copia el espectro con channel_lock_ adquirido, el formateo y el disco van fuera.
+      pthread_mutex_lock(&channel_lock_);
+      for (j = 0; j < channel_count_; j++) {
+            memcpy(&psd[(size_t) j * bins], channel_[j].pwsd, bins * sizeof(double));
+      }
+      pthread_mutex_unlock(&channel_lock_);
+
       FILE* fd;
       fd = fopen(file_name.c_str(), "w");
       if (fd == NULL) {
             return 1;
       }
-      
-      int i;
-      int j;
 
-      // LOCK
-      pthread_mutex_lock(&channel_lock_);
-      for (i = 0; i < block_size_ / 2; i++) {
+      for (i = 0; i < bins; i++) {
             // Columna 1 - Frecuencia analógica
             fprintf(fd, "%09.2f ", AnalogFrequency(i));
             for (j = 0; j < channel_count_; j++) {
-                  fprintf(fd, "%010.8f ", channel_[j].pwsd[i]);
+                  fprintf(fd, "%010.8f ", psd[(size_t) j * bins + i]);
             }
             fprintf(fd, "\n");
       }
-      // UNLOCK
-      pthread_mutex_unlock(&channel_lock_);
       
       fclose(fd);
       return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::StartRecording(const std::string& file_name) {
+
+      SpectrumFileWriter* w = new SpectrumFileWriter();
+      if (w->Open(file_name, sample_rate_, block_size_, channel_count_) != 0) {
+            error_description_ = w->ErrorDescription();
+            delete w;
+            return 1;
+      }
+
+      pthread_mutex_lock(&recorder_lock_);
+      if (recorder_ != NULL) {
+            pthread_mutex_unlock(&recorder_lock_);
+            error_description_ = "already recording";
+            delete w;
+            return 1;
+      }
+      recorder_ = w;
+      pthread_mutex_unlock(&recorder_lock_);
+
+      return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int ThdAnalyzer::StopRecording() {
+
+      SpectrumFileWriter* w;
+
+      pthread_mutex_lock(&recorder_lock_);
+      w = recorder_;
+      recorder_ = NULL;
+      pthread_mutex_unlock(&recorder_lock_);
+
+      if (w == NULL) {
+            return 0;
+      }
+
+      // Close() espera a que se escriba la cola, fuera de recorder_lock_ para no retener al hilo de procesado.
+      int r = w->Close();
+      if (r != 0) {
+            error_description_ = w->ErrorDescription();
+      }
+      delete w;
+      return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int64_t ThdAnalyzer::RecordingDroppedCount() {
+
+      int64_t n = 0;
+
+      pthread_mutex_lock(&recorder_lock_);
+      if (recorder_ != NULL) {
+            n = recorder_->DroppedCount();
+      }
+      pthread_mutex_unlock(&recorder_lock_);
+
+      return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
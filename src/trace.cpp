@@ -0,0 +1,269 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+using namespace thd_analyzer;
+
+namespace {
+
+      struct TraceEvent {
+            const char* name;
+            uint64_t begin;
+            uint64_t end;
+      };
+
+      /**
+       * Búfer circular de un hilo. Solo escribe el hilo propietario; head es el número de eventos escritos desde el
+       * principio y se publica con semántica release después de escribir el evento, así el lector sabe qué
+       * posiciones están completas sin bloquear al escritor.
+       *
+       * events es NULL hasta que se activan las trazas; se publica con semántica release después de capacity.
+       */
+      struct TraceBuffer {
+            TraceEvent* events;
+            uint64_t capacity;
+            uint64_t head;
+            long tid;
+            const char* thread_name;
+
+            // El hilo ha terminado. Su traza se sigue pudiendo volcar hasta que otro hilo reutiliza el búfer.
+            bool exited;
+      };
+
+      // Lista de los búferes de todos los hilos registrados. No se destruyen: el de un hilo que termina se reutiliza
+      // para el siguiente que se registre, así crear y terminar hilos (uno por grabación) no acumula memoria.
+      // Protegida por registry_lock.
+      std::vector<TraceBuffer*> registry;
+      pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+      // Clave para enterarse de que un hilo termina, su destructor marca el búfer como libre.
+      pthread_key_t exit_key;
+      pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+      int enabled = 0;
+      int events_per_thread = 16384;
+      uint64_t cleared_before = 0;
+
+      __thread TraceBuffer* thread_buffer = NULL;
+
+      uint64_t TraceClock() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+            return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+      }
+
+      // Con registry_lock adquirido.
+      void AllocateEvents(TraceBuffer* b) {
+            if (b->events == NULL) {
+                  b->capacity = events_per_thread;
+                  __atomic_store_n(&b->events, new TraceEvent[b->capacity], __ATOMIC_RELEASE);
+            }
+      }
+
+      void ThreadExited(void* p) {
+            TraceBuffer* b = (TraceBuffer*) p;
+
+            pthread_mutex_lock(&registry_lock);
+            b->exited = true;
+            pthread_mutex_unlock(&registry_lock);
+      }
+
+      void CreateExitKey() {
+            pthread_key_create(&exit_key, ThreadExited);
+      }
+
+      // Registra el hilo que llama, con el búfer de un hilo que ya ha terminado si lo hay. Si las trazas están
+      // activadas reserva también los eventos, para que TraceSpan no tenga que pedir memoria.
+      TraceBuffer* RegisterThread() {
+            if (thread_buffer != NULL) {
+                  return thread_buffer;
+            }
+
+            pthread_once(&exit_key_once, CreateExitKey);
+
+            TraceBuffer* b = NULL;
+            size_t i;
+
+            pthread_mutex_lock(&registry_lock);
+            for (i = 0; i < registry.size(); i++) {
+                  if (registry[i]->exited == true) {
+                        b = registry[i];
+                        break;
+                  }
+            }
+            if (b == NULL) {
+                  b = new TraceBuffer;
+                  b->events = NULL;
+                  b->capacity = 0;
+                  registry.push_back(b);
+            }
+            b->head = 0;
+            b->tid = syscall(SYS_gettid);
+            b->thread_name = NULL;
+            b->exited = false;
+            if (__atomic_load_n(&enabled, __ATOMIC_RELAXED) != 0) {
+                  AllocateEvents(b);
+            }
+            pthread_mutex_unlock(&registry_lock);
+
+            pthread_setspecific(exit_key, b);
+            thread_buffer = b;
+            return b;
+      }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TraceSpan::TraceSpan(const char* name) {
+      name_ = name;
+      begin_ = (__atomic_load_n(&enabled, __ATOMIC_RELAXED) != 0) ? TraceClock() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TraceSpan::~TraceSpan() {
+      if (begin_ == 0) {
+            return;
+      }
+
+      // Los hilos sin registrar, o registrados sin eventos reservados, no dejan traza: aquí nunca se pide memoria.
+      TraceBuffer* b = thread_buffer;
+      if (b == NULL) {
+            return;
+      }
+      TraceEvent* events = __atomic_load_n(&b->events, __ATOMIC_ACQUIRE);
+      if (events == NULL) {
+            return;
+      }
+
+      uint64_t h = b->head;
+      TraceEvent* e = &events[h % b->capacity];
+      e->name = name_;
+      e->begin = begin_;
+      e->end = TraceClock();
+      __atomic_store_n(&b->head, h + 1, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::EnableTracing(int events) {
+      // El tamaño solo afecta a los búferes que se reserven a partir de ahora.
+      if (events > 0) {
+            events_per_thread = events;
+      }
+
+      // Se registra el hilo que llama y se reservan los eventos de todos los hilos registrados que aún no los
+      // tienen, incluidos los que ya están en marcha.
+      RegisterThread();
+
+      size_t i;
+      pthread_mutex_lock(&registry_lock);
+      __atomic_store_n(&enabled, 1, __ATOMIC_RELAXED);
+      for (i = 0; i < registry.size(); i++) {
+            AllocateEvents(registry[i]);
+      }
+      pthread_mutex_unlock(&registry_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::DisableTracing() {
+      __atomic_store_n(&enabled, 0, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool thd_analyzer::TracingEnabled() {
+      return __atomic_load_n(&enabled, __ATOMIC_RELAXED) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::ClearTracing() {
+      // Solo el propietario escribe en su búfer, así que no se borra nada: WriteChromeTrace() se salta los eventos
+      // que empezaron antes de este instante.
+      __atomic_store_n(&cleared_before, TraceClock(), __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void thd_analyzer::SetTraceThreadName(const char* name) {
+      TraceBuffer* b = RegisterThread();
+
+      pthread_mutex_lock(&registry_lock);
+      b->thread_name = name;
+      pthread_mutex_unlock(&registry_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int thd_analyzer::WriteChromeTrace(const std::string& file_name, std::string* error) {
+
+      FILE* fd = fopen(file_name.c_str(), "w");
+      if (fd == NULL) {
+            if (error != NULL) {
+                  *error = strerror(errno);
+            }
+            return 1;
+      }
+
+      long pid = getpid();
+      uint64_t since = __atomic_load_n(&cleared_before, __ATOMIC_RELAXED);
+      std::vector<TraceEvent> copy;
+      bool first = true;
+
+      fprintf(fd, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+      pthread_mutex_lock(&registry_lock);
+      size_t i;
+      for (i = 0; i < registry.size(); i++) {
+            TraceBuffer* b = registry[i];
+            if (b->events == NULL) {
+                  continue;
+            }
+
+            if (b->thread_name != NULL) {
+                  fprintf(fd, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+                          "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", pid, b->tid, b->thread_name);
+                  first = false;
+            }
+
+            // Copia de los eventos completos. El escritor puede haber sobreescrito las primeras posiciones mientras
+            // se copiaban; después de copiar se vuelve a leer head y se descartan las que ya no son válidas.
+            uint64_t h1 = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+            uint64_t n = (h1 < b->capacity) ? h1 : b->capacity;
+            uint64_t j;
+            copy.resize(n);
+            for (j = 0; j < n; j++) {
+                  copy[j] = b->events[(h1 - n + j) % b->capacity];
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            uint64_t h2 = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+
+            // El evento de índice h1 - n + j es válido si el escritor no ha llegado a reutilizar su posición, es
+            // decir, si h1 - n + j + capacity > h2 (la posición h2 puede estar a medio escribir).
+            for (j = 0; j < n; j++) {
+                  if (h1 - n + j + b->capacity <= h2) {
+                        continue;
+                  }
+                  const TraceEvent& e = copy[j];
+                  if (e.begin < since || e.end < e.begin) {
+                        continue;
+                  }
+                  fprintf(fd, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                          first ? "" : ",\n", e.name, pid, b->tid, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+                  first = false;
+            }
+      }
+      pthread_mutex_unlock(&registry_lock);
+
+      fprintf(fd, "\n]}\n");
+
+      if (fclose(fd) != 0) {
+            if (error != NULL) {
+                  *error = strerror(errno);
+            }
+            return 1;
+      }
+      return 0;
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -17,20 +17,33 @@ WaveformGenerator::WaveformGenerator(const char* playback_pcm_device) {
 
       initialized_ = false;
       run_ = false;
+      quit_ = 0;
 
       pthread_attr_init(&thread_attr_);
 
       sample_rate_ = 192000; //48000; //192000; //44100;
       block_size_  = 1024;
       buf_data_    = new int16_t[2 * block_size_];
+      wave_        = new double[block_size_];
       frequency_   = 440;
       amplitude_   = 1.0;
+      waveform_    = kWaveformSine;
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 WaveformGenerator::~WaveformGenerator() {
-      
+
+      // El hilo de envío usa los búferes: se le pide que termine (snd_pcm_wait() vuelve como mucho en 1 s) y se
+      // espera por él antes de liberarlos.
+      if (initialized_ == true) {
+            __atomic_store_n(&quit_, 1, __ATOMIC_RELAXED);
+            pthread_join(thread_, NULL);
+      }
+      pthread_attr_destroy(&thread_attr_);
+
+      delete[] wave_;
+      delete[] buf_data_;
 }
 
 
@@ -67,6 +80,12 @@ int WaveformGenerator::Stop() {
 }
 
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void WaveformGenerator::SetWaveType(Waveform type) {
+      waveform_ = type;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void WaveformGenerator::SetFrequency(double frequency) {
       frequency_ = frequency;
@@ -181,7 +200,7 @@ void* WaveformGenerator::ThreadFunc() {
             return NULL;
       }
 
-      while (1) {
+      while (__atomic_load_n(&quit_, __ATOMIC_RELAXED) == 0) {
             
             // wait till the interface is ready for data, or 1 second has elapsed.            
             if ((err = snd_pcm_wait (playback_handle_, 1000)) < 0) {
@@ -213,19 +232,29 @@ void* WaveformGenerator::ThreadFunc() {
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 int WaveformGenerator::SendSamples(snd_pcm_sframes_t nframes) {
 
+      assert(nframes <= block_size_);
+
       int err;
-      static int n = 0;
       int i;
       short s;
 
-      double w = 2 * M_PI * frequency_ / sample_rate_;
-      //double w = 2 * M_PI * frequency_ / sample_rate_ / 4; 
-      // Esto funciona, ¿por qué? Sospecha: empaquetado de muestras con snd_pcm_writei
-
+      // El incremento de fase se recalcula en cada bloque con la frecuencia de SetFrequency(); la fase sigue donde
+      // acabó el bloque anterior, sin saltos.
+      oscillator_.SetFrequency(frequency_ / sample_rate_);
+      switch (waveform_) {
+      case kWaveformSawTooth:
+            oscillator_.GenerateSawTooth(32767 * amplitude_, nframes, wave_);
+            break;
+      case kWaveformSquare:
+            oscillator_.GenerateSquare(32767 * amplitude_, nframes, wave_);
+            break;
+      default:
+            oscillator_.Generate(32767 * amplitude_, nframes, wave_);
+            break;
+      }
 
       for (i = 0; i < nframes; i++) {
-            s = (int16_t) (32767 * amplitude_ * cos(w * n));
-            n++;
+            s = (int16_t) wave_[i];
 
             // Escribo un "frame". Un frame es un bloque de 2 muestras: una muestra del canal L y otra del R
             buf_data_[2 * i + 0] = s; // Canal L
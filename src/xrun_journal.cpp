@@ -0,0 +1,65 @@
+// Hi Emacs, this is -*- mode: c++; tab-width: 6; indent-tabs-mode: nil; c-basic-offset: 6 -*-
+#include <cassert>
+#include "xrun_journal.h"
+
+using namespace thd_analyzer;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+XrunJournal::XrunJournal(int capacity) {
+      assert(capacity > 0);
+
+      records_.resize(capacity);
+      first_ = 0;
+      count_ = 0;
+      total_ = 0;
+      pthread_mutex_init(&lock_, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+XrunJournal::~XrunJournal() {
+      pthread_mutex_destroy(&lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void XrunJournal::Append(const XrunRecord& record) {
+      int capacity = (int) records_.size();
+
+      pthread_mutex_lock(&lock_);
+      total_++;
+
+      // Lleno: se sobreescribe el más antiguo
+      int i = (first_ + count_) % capacity;
+      if (count_ == capacity) {
+            first_ = (first_ + 1) % capacity;
+      } else {
+            count_++;
+      }
+
+      records_[i] = record;
+      records_[i].sequence = total_;
+      pthread_mutex_unlock(&lock_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int64_t XrunJournal::Get(std::vector<XrunRecord>* records) const {
+      int capacity = (int) records_.size();
+
+      pthread_mutex_lock(&lock_);
+      records->resize(count_);
+      for (int i = 0; i < count_; i++) {
+            (*records)[i] = records_[(first_ + i) % capacity];
+      }
+      int64_t total = total_;
+      pthread_mutex_unlock(&lock_);
+
+      return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void XrunJournal::Clear() {
+      pthread_mutex_lock(&lock_);
+      first_ = 0;
+      count_ = 0;
+      pthread_mutex_unlock(&lock_);
+}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////